@@ -0,0 +1,110 @@
+// replaces the global allocation functions to count allocations
+//   in the whole process, including those made inside the library.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "bench.hpp"
+
+namespace jsonlogic_bench {
+namespace {
+
+// relaxed ordering suffices, as the counters are only read between runs.
+std::atomic<std::size_t> numAllocs{0};
+std::atomic<std::size_t> numBytes{0};
+std::atomic<std::size_t> numLive{0};
+
+/// each block is preceded by a header recording the requested size and
+///   the distance to the start of the underlying allocation.
+struct block_header {
+  std::size_t size;
+  std::size_t offset;
+};
+
+constexpr std::size_t HEADER_SIZE = alignof(std::max_align_t);
+
+static_assert(sizeof(block_header) <= HEADER_SIZE, "header too large");
+
+block_header &header(void *p) {
+  return *(static_cast<block_header *>(p) - 1);
+}
+
+void *counted_alloc(std::size_t sz, std::size_t align) {
+  const std::size_t offset = align > HEADER_SIZE ? align : HEADER_SIZE;
+  // aligned_alloc requires a size that is a multiple of the alignment
+  const std::size_t total = (offset + sz + align - 1) / align * align;
+  void *raw = align > HEADER_SIZE ? std::aligned_alloc(align, total)
+                                  : std::malloc(total);
+
+  if (raw == nullptr)
+    throw std::bad_alloc{};
+
+  void *res = static_cast<char *>(raw) + offset;
+
+  header(res) = {sz, offset};
+  numAllocs.fetch_add(1, std::memory_order_relaxed);
+  numBytes.fetch_add(sz, std::memory_order_relaxed);
+  numLive.fetch_add(sz, std::memory_order_relaxed);
+  return res;
+}
+
+void counted_free(void *p) noexcept {
+  if (p == nullptr)
+    return;
+
+  const block_header hdr = header(p);
+
+  numLive.fetch_sub(hdr.size, std::memory_order_relaxed);
+  std::free(static_cast<char *>(p) - hdr.offset);
+}
+
+} // namespace
+
+allocation_counts allocations() {
+  return {numAllocs.load(std::memory_order_relaxed),
+          numBytes.load(std::memory_order_relaxed),
+          numLive.load(std::memory_order_relaxed)};
+}
+
+} // namespace jsonlogic_bench
+
+namespace jb = jsonlogic_bench;
+
+void *operator new(std::size_t sz) {
+  return jb::counted_alloc(sz, jb::HEADER_SIZE);
+}
+
+void *operator new[](std::size_t sz) {
+  return jb::counted_alloc(sz, jb::HEADER_SIZE);
+}
+
+void *operator new(std::size_t sz, std::align_val_t al) {
+  return jb::counted_alloc(sz, static_cast<std::size_t>(al));
+}
+
+void *operator new[](std::size_t sz, std::align_val_t al) {
+  return jb::counted_alloc(sz, static_cast<std::size_t>(al));
+}
+
+void operator delete(void *p) noexcept { jb::counted_free(p); }
+void operator delete[](void *p) noexcept { jb::counted_free(p); }
+void operator delete(void *p, std::size_t) noexcept { jb::counted_free(p); }
+void operator delete[](void *p, std::size_t) noexcept { jb::counted_free(p); }
+
+void operator delete(void *p, std::align_val_t) noexcept {
+  jb::counted_free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+  jb::counted_free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  jb::counted_free(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  jb::counted_free(p);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace jsonlogic_bench {
+
+/// runs the measured operation n times
+using benchmark_fn = std::function<void(std::size_t n)>;
+
+/// a named benchmark within a suite
+struct benchmark {
+  std::string name;
+  benchmark_fn fn;
+};
+
+/// sets up the data of a suite and adds its benchmarks
+using suite_fn = void (*)(std::vector<benchmark> &);
+
+/// registers a suite at static initialization time
+struct suite_registrar {
+  suite_registrar(const char *name, suite_fn fn);
+};
+
+/// allocations made through the global operator new since program start
+struct allocation_counts {
+  std::size_t allocs; ///< number of allocations
+  std::size_t bytes;  ///< total number of bytes requested
+  std::size_t live;   ///< number of bytes currently allocated
+};
+
+/// returns the allocation counters of all threads
+allocation_counts allocations();
+
+/// prevents the compiler from discarding \ref val
+template <class T> inline void keep(const T &val) {
+  asm volatile("" : : "g"(&val) : "memory");
+}
+
+} // namespace jsonlogic_bench
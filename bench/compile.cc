@@ -0,0 +1,88 @@
+// benchmarks rule compilation (create_logic)
+
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "bench.hpp"
+#include "jsonlogic/logic.hpp"
+
+namespace bjsn = boost::json;
+
+namespace {
+
+constexpr std::size_t NUM_BULK_RULES = 1024;
+
+/// an "or" over \ref width guarded comparisons, touching most operators
+bjsn::value make_wide_rule(std::size_t width) {
+  static const char *const shapes[] = {
+      R"({"and":[{">=":[{"var":"age"},18]},{"<":[{"var":"age"},65]}]})",
+      R"({"==":[{"var":"country"},"US"]})",
+      R"({"!":{"missing":["name","email"]}})",
+      R"({"some":[{"var":"tags"},{"===":[{"var":""},"vip"]}]})",
+      R"({"<=":[{"+":[{"var":"a"},{"*":[{"var":"b"},2]}]},{"max":[3,4]}]})",
+      R"({"!=":[{"cat":[{"var":"first"}," ",{"var":"last"}]},""]})",
+      R"({"if":[{"var":"flag"},{"%":[{"var":"n"},7]},{"-":[{"var":"n"}]}]})",
+  };
+
+  bjsn::array terms;
+
+  for (std::size_t i = 0; i < width; ++i)
+    terms.push_back(bjsn::parse(shapes[i % std::size(shapes)]));
+
+  return bjsn::object{{"or", std::move(terms)}};
+}
+
+void add_single(std::vector<jsonlogic_bench::benchmark> &benchmarks,
+                std::string name, bjsn::value rule) {
+  auto src = std::make_shared<bjsn::value>(std::move(rule));
+
+  benchmarks.push_back({std::move(name), [src](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            jsonlogic::logic_details logic =
+                                jsonlogic::create_logic(*src);
+
+                            jsonlogic_bench::keep(logic);
+                          }
+                        }});
+}
+
+void setup(std::vector<jsonlogic_bench::benchmark> &benchmarks) {
+  add_single(benchmarks, "single/predicate",
+             bjsn::parse(R"({"and":[{">=":[{"var":"age"},18]},)"
+                         R"({"==":[{"var":"country"},"US"]}]})"));
+
+  for (std::size_t width : {8, 64})
+    add_single(benchmarks, "single/width=" + std::to_string(width),
+               make_wide_rule(width));
+
+  // one operation compiles NUM_BULK_RULES rules
+  auto rules = std::make_shared<std::vector<bjsn::value>>();
+
+  for (std::size_t i = 0; i < NUM_BULK_RULES; ++i)
+    rules->push_back(make_wide_rule(1 + i % 16));
+
+  for (unsigned threads : {1, 0}) {
+    const std::string suffix =
+        threads ? std::to_string(threads) : std::string{"auto"};
+
+    benchmarks.push_back(
+        {"bulk/rules=" + std::to_string(NUM_BULK_RULES) + "/threads=" + suffix,
+         [rules, threads](std::size_t n) -> void {
+           for (std::size_t i = 0; i < n; ++i) {
+             std::vector<jsonlogic::logic_details> logic =
+                 jsonlogic::create_logic(rules->data(), rules->size(), nullptr,
+                                         threads);
+
+             jsonlogic_bench::keep(logic);
+           }
+         }});
+  }
+}
+
+jsonlogic_bench::suite_registrar registration{"compile", setup};
+
+} // namespace
@@ -0,0 +1,306 @@
+// runs the test corpus in-process under each evaluation engine,
+//   verifies the results, and reports timing and allocations per case.
+//
+// usage: jsonlogic_conformance [options] (file.json | directory)..
+//   options:
+//     --repeat k       evaluates each case k times (default: 100)
+//     --engine name    runs only the named engine; may be repeated
+//
+// A case passes if its result prints as "expected", or if evaluation
+// throws and the case has no "expected" member. The results are printed
+// as Json array; failures are reported on stderr and yield exit code 1.
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "bench.hpp"
+#include "jsonlogic/logic.hpp"
+
+#include <boost/json/src.hpp>
+
+namespace bjsn = boost::json;
+namespace jb = jsonlogic_bench;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct test_case {
+  std::string name;
+  bjsn::value rule;
+  bjsn::value data;
+  bool hasExpected = false;
+  std::string expected; ///< the printed expected result
+  bool expectedTruth = false;
+};
+
+/// evaluates the prepared rule once and returns the printed result
+using evaluation_fn = std::function<std::string()>;
+
+/// an evaluation engine prepares a case outside of the timed loop
+struct engine {
+  const char *name;
+  /// returns an empty function if the engine does not apply to a case
+  std::function<evaluation_fn(const test_case &)> prepare;
+};
+
+std::string print(jsonlogic::any_expr &res) {
+  std::stringstream os;
+
+  os << res;
+  return os.str();
+}
+
+/// the state that an engine keeps across the evaluations of one case
+struct prepared_rule {
+  explicit prepared_rule(const test_case &tc)
+      : logic(jsonlogic::create_logic(tc.rule)),
+        vars(jsonlogic::data_accessor(tc.data)) {}
+
+  jsonlogic::logic_details logic;
+  jsonlogic::variable_accessor vars;
+};
+
+const engine engines[] = {
+    {"apply",
+     [](const test_case &tc) -> evaluation_fn {
+       auto prep = std::make_shared<prepared_rule>(tc);
+
+       return [prep]() -> std::string {
+         jsonlogic::any_expr res =
+             jsonlogic::apply(prep->logic.synatx_tree(), prep->vars);
+
+         return print(res);
+       };
+     }},
+    {"matches",
+     [](const test_case &tc) -> evaluation_fn {
+       // error cases may fail in apply but not in a boolean context
+       if (!tc.hasExpected)
+         return {};
+
+       auto prep = std::make_shared<prepared_rule>(tc);
+       const bool expected = tc.expectedTruth;
+       const std::string printed = tc.expected;
+
+       // reports the expected result, if matches agrees with it
+       return [prep, expected, printed]() -> std::string {
+         const bool res =
+             jsonlogic::matches(prep->logic.synatx_tree(), prep->vars);
+
+         return res == expected ? printed : std::string{res ? "truthy"
+                                                            : "falsy"};
+       };
+     }},
+    {"context",
+     [](const test_case &tc) -> evaluation_fn {
+       auto prep = std::make_shared<prepared_rule>(tc);
+       auto ctx = std::make_shared<jsonlogic::evaluation_context>();
+
+       return [prep, ctx]() -> std::string {
+         jsonlogic::any_expr res =
+             jsonlogic::apply(prep->logic.synatx_tree(), prep->vars, *ctx,
+                              jsonlogic::result_storage::arena);
+         std::string text = print(res);
+
+         res.reset();
+         ctx->release();
+         return text;
+       };
+     }},
+    {"snapshot",
+     [](const test_case &tc) -> evaluation_fn {
+       auto prep = std::make_shared<prepared_rule>(tc);
+       std::stringstream buf;
+
+       jsonlogic::write_snapshot(buf, &prep->logic, 1);
+
+       const std::string image = buf.str();
+
+       prep->logic = jsonlogic::snapshot(image.data(), image.size()).rule(0);
+
+       return [prep]() -> std::string {
+         jsonlogic::any_expr res =
+             jsonlogic::apply(prep->logic.synatx_tree(), prep->vars);
+
+         return print(res);
+       };
+     }},
+    {"incremental",
+     // after the first evaluation, all results are reused
+     [](const test_case &tc) -> evaluation_fn {
+       auto prep = std::make_shared<prepared_rule>(tc);
+       auto inc = std::make_shared<jsonlogic::incremental_evaluator>(
+           prep->logic);
+
+       return [prep, inc]() -> std::string {
+         jsonlogic::any_expr res = inc->evaluate(prep->vars);
+
+         return print(res);
+       };
+     }},
+};
+
+bjsn::value parse_file(const fs::path &file) {
+  std::ifstream is{file};
+  std::stringstream text;
+
+  text << is.rdbuf();
+  return bjsn::parse(text.str());
+}
+
+test_case load_case(const fs::path &file) {
+  bjsn::value all = parse_file(file);
+  bjsn::object &obj = all.as_object();
+  test_case res;
+
+  res.name = file.filename().string();
+  res.rule = obj["rule"];
+
+  if (const bjsn::value *dat = obj.if_contains("data"))
+    res.data = *dat;
+  else
+    res.data.emplace_object();
+
+  if (const bjsn::value *exp = obj.if_contains("expected")) {
+    jsonlogic::any_expr val = jsonlogic::to_expr(*exp);
+    std::stringstream os;
+
+    os << *exp;
+    res.hasExpected = true;
+    res.expected = os.str();
+    res.expectedTruth = jsonlogic::truthy(val);
+  }
+
+  return res;
+}
+
+/// collects the json files in \ref arg, sorted by name
+void collect(const fs::path &arg, std::vector<fs::path> &files) {
+  if (!fs::is_directory(arg)) {
+    files.push_back(arg);
+    return;
+  }
+
+  std::vector<fs::path> found;
+
+  for (const fs::directory_entry &entry : fs::directory_iterator{arg})
+    if (entry.path().extension() == ".json")
+      found.push_back(entry.path());
+
+  std::sort(found.begin(), found.end());
+  files.insert(files.end(), found.begin(), found.end());
+}
+
+/// runs one case under one engine
+/// \return true if the case passes
+bool run(const test_case &tc, const engine &eng, std::size_t repeat,
+         bjsn::array &results) {
+  using clock = std::chrono::steady_clock;
+
+  bjsn::object entry;
+  std::string outcome;
+  bool passed = false;
+
+  entry["case"] = tc.name;
+  entry["engine"] = eng.name;
+
+  try {
+    evaluation_fn fn = eng.prepare(tc);
+
+    if (!fn)
+      return true;
+
+    const std::string first = fn();
+
+    passed = tc.hasExpected && (first == tc.expected);
+    outcome = first;
+
+    if (passed) {
+      const jb::allocation_counts before = jb::allocations();
+      const clock::time_point start = clock::now();
+
+      for (std::size_t i = 0; i < repeat; ++i)
+        jb::keep(fn());
+
+      const std::chrono::nanoseconds time = clock::now() - start;
+      const jb::allocation_counts after = jb::allocations();
+
+      entry["iterations"] = repeat;
+      entry["ns_per_op"] = double(time.count()) / repeat;
+      entry["allocs_per_op"] = double(after.allocs - before.allocs) / repeat;
+      entry["bytes_per_op"] = double(after.bytes - before.bytes) / repeat;
+    }
+  } catch (const std::exception &ex) {
+    passed = !tc.hasExpected;
+    outcome = std::string{"exception: "} + ex.what();
+  }
+
+  entry["passed"] = passed;
+  results.push_back(std::move(entry));
+
+  if (!passed)
+    std::cerr << "FAIL " << tc.name << " [" << eng.name << "]"
+              << "\n  exp: " << (tc.hasExpected ? tc.expected : "an error")
+              << "\n  got: " << outcome << std::endl;
+
+  return passed;
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  std::size_t repeat = 100;
+  std::vector<std::string> selected;
+  std::vector<fs::path> files;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool hasValue = (i + 1 < argc);
+
+    if (arg == "--repeat" && hasValue)
+      repeat = std::max<std::size_t>(std::stoull(argv[++i]), 1);
+    else if (arg == "--engine" && hasValue)
+      selected.emplace_back(argv[++i]);
+    else
+      collect(arg, files);
+  }
+
+  auto isSelected = [&selected](const char *name) -> bool {
+    return selected.empty() ||
+           std::find(selected.begin(), selected.end(), name) != selected.end();
+  };
+
+  bjsn::array results;
+  std::size_t failures = 0;
+
+  for (const fs::path &file : files) {
+    test_case tc;
+
+    try {
+      tc = load_case(file);
+    } catch (const std::exception &ex) {
+      std::cerr << "FAIL " << file.string() << ": " << ex.what() << std::endl;
+      ++failures;
+      continue;
+    }
+
+    for (const engine &eng : engines)
+      if (isSelected(eng.name) && !run(tc, eng, repeat, results))
+        ++failures;
+  }
+
+  std::cout << results << std::endl;
+  std::cerr << files.size() << " cases, " << failures << " failures"
+            << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,353 @@
+// macro benchmarks for the engine paths: compile and evaluate a complete
+//   rule, and print results.
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "bench.hpp"
+#include "jsonlogic/logic.hpp"
+
+namespace bjsn = boost::json;
+
+namespace {
+
+constexpr std::size_t NUM_RESULT_ELEMENTS = 256;
+
+/// a rule in the style of typical eligibility checks
+const char *const rule_text = R"({"and":[
+  {">=":[{"var":"age"},18]},
+  {"or":[{"==":[{"var":"country"},"US"]},{"==":[{"var":"country"},"CA"]}]},
+  {"!":{"missing":["name","email"]}},
+  {"some":[{"var":"orders"},{">":[{"var":"total"},100]}]},
+  {"if":[{"var":"vip"},true,{"<":[{"var":"balance"},{"*":[{"var":"limit"},0.8]}]}]}
+]})";
+
+const char *const data_text = R"({
+  "age": 34, "country": "CA", "name": "ann", "email": "ann@example.com",
+  "orders": [{"total": 20}, {"total": 80}, {"total": 120}],
+  "vip": false, "balance": 700, "limit": 1000
+})";
+
+/// the input of the printing benchmarks: an array mixing all value types
+bjsn::value make_result() {
+  bjsn::array res;
+
+  for (std::size_t i = 0; i < NUM_RESULT_ELEMENTS; ++i) {
+    switch (i % 5) {
+    case 0:
+      res.push_back(std::int64_t(i) * 1009);
+      break;
+    case 1:
+      res.push_back(double(i) / 8);
+      break;
+    case 2:
+      res.push_back(bjsn::string{"element-" + std::to_string(i)});
+      break;
+    case 3:
+      res.push_back(i % 2 == 0);
+      break;
+    default:
+      res.push_back(nullptr);
+    }
+  }
+
+  return res;
+}
+
+constexpr std::size_t NUM_ROUTES = 256;
+
+/// a routing rule: an if that compares a variable with NUM_ROUTES strings
+bjsn::value make_routing_rule() {
+  bjsn::array arms;
+
+  for (std::size_t i = 0; i < NUM_ROUTES; ++i) {
+    arms.push_back(bjsn::object{
+        {"==", bjsn::array{bjsn::object{{"var", "route"}},
+                           "route-" + std::to_string(i)}}});
+    arms.push_back(std::int64_t(i));
+  }
+
+  arms.push_back(-1);
+  return bjsn::object{{"if", std::move(arms)}};
+}
+
+constexpr std::size_t NUM_MESSAGE_FIELDS = 64;
+
+/// a message rule: a cat of NUM_MESSAGE_FIELDS labels and variables
+bjsn::value make_message_rule() {
+  bjsn::array parts;
+
+  for (std::size_t i = 0; i < NUM_MESSAGE_FIELDS; ++i) {
+    parts.push_back(" field" + std::to_string(i) + "=");
+    parts.push_back(bjsn::object{{"var", i % 2 ? "amount" : "user"}});
+  }
+
+  return bjsn::object{{"cat", std::move(parts)}};
+}
+
+constexpr std::size_t NUM_VALIDATED_FIELDS = 40;
+
+/// a validation rule: a missing_some over NUM_VALIDATED_FIELDS fields
+bjsn::value make_validation_rule() {
+  bjsn::array fields;
+
+  for (std::size_t i = 0; i < NUM_VALIDATED_FIELDS; ++i)
+    fields.push_back("record.field" + std::to_string(i));
+
+  return bjsn::object{
+      {"missing_some", bjsn::array{std::int64_t(NUM_VALIDATED_FIELDS),
+                                   std::move(fields)}}};
+}
+
+/// a record that has every other field of the validation rule
+bjsn::value make_validated_record() {
+  bjsn::object record;
+
+  for (std::size_t i = 0; i < NUM_VALIDATED_FIELDS; i += 2)
+    record["field" + std::to_string(i)] = bjsn::array{1, 2, 3};
+
+  return bjsn::object{{"record", std::move(record)}};
+}
+
+constexpr std::size_t NUM_REDUCED_ELEMENTS = 1024;
+
+/// reduction rules over the array "items"
+/// \{
+const char *const sum_rule =
+    R"({"reduce":[{"var":"items"},{"+":[{"var":"accumulator"},{"var":"current"}]},0]})";
+
+const char *const collect_rule =
+    R"({"reduce":[{"var":"items"},{"merge":[{"var":"accumulator"},[{"var":"current"}]]},[]]})";
+/// \}
+
+void setup(std::vector<jsonlogic_bench::benchmark> &benchmarks) {
+  auto rule = std::make_shared<bjsn::value>(bjsn::parse(rule_text));
+  auto data = std::make_shared<bjsn::value>(bjsn::parse(data_text));
+
+  benchmarks.push_back({"compile", [rule](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            jsonlogic::logic_details logic =
+                                jsonlogic::create_logic(*rule);
+
+                            jsonlogic_bench::keep(logic);
+                          }
+                        }});
+
+  // compiles and evaluates the rule in every operation
+  benchmarks.push_back({"apply/json", [rule, data](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            jsonlogic::any_expr res =
+                                jsonlogic::apply(*rule, *data);
+
+                            jsonlogic_bench::keep(res);
+                          }
+                        }});
+
+  auto logic = std::make_shared<jsonlogic::logic_details>(
+      jsonlogic::create_logic(*rule));
+  const jsonlogic::variable_accessor vars = jsonlogic::data_accessor(*data);
+
+  benchmarks.push_back({"apply/compiled", [logic, vars](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            jsonlogic::any_expr res =
+                                jsonlogic::apply(logic->synatx_tree(), vars);
+
+                            jsonlogic_bench::keep(res);
+                          }
+                        }});
+
+  // every evaluation is sampled; the trace is drained after each
+  benchmarks.push_back(
+      {"apply/traced", [logic, vars](std::size_t n) -> void {
+         jsonlogic::trace_buffer sink;
+         std::vector<jsonlogic::trace_record> records;
+
+         for (std::size_t i = 0; i < n; ++i) {
+           jsonlogic::any_expr res =
+               jsonlogic::apply(logic->synatx_tree(), vars, &sink);
+
+           jsonlogic_bench::keep(res);
+           records.clear();
+           sink.drain(records);
+         }
+       }});
+
+  // a rule that logs a value, with batched output that is discarded
+  auto logged = std::make_shared<bjsn::value>(
+      bjsn::object{{"log", bjsn::object{{"var", "orders"}}}});
+
+  benchmarks.push_back(
+      {"log/async", [logged, vars](std::size_t n) -> void {
+         jsonlogic::logic_details logic = jsonlogic::create_logic(*logged);
+         auto sink = std::make_shared<jsonlogic::async_log_sink>(
+             [](bjsn::string_view batch) -> void {
+               jsonlogic_bench::keep(batch);
+             });
+
+         jsonlogic::use_log_sink(sink);
+
+         for (std::size_t i = 0; i < n; ++i) {
+           jsonlogic::any_expr res = jsonlogic::apply(logic.synatx_tree(), vars);
+
+           jsonlogic_bench::keep(res);
+         }
+
+         sink->flush();
+         jsonlogic::use_log_sink(nullptr);
+       }});
+
+  benchmarks.push_back(
+      {"log/stripped", [logged, vars](std::size_t n) -> void {
+         jsonlogic::logic_options opts;
+
+         opts.strip_log = true;
+
+         jsonlogic::logic_details logic = jsonlogic::create_logic(*logged, opts);
+
+         for (std::size_t i = 0; i < n; ++i) {
+           jsonlogic::any_expr res = jsonlogic::apply(logic.synatx_tree(), vars);
+
+           jsonlogic_bench::keep(res);
+         }
+       }});
+
+  benchmarks.push_back(
+      {"matches/compiled", [logic, vars](std::size_t n) -> void {
+         for (std::size_t i = 0; i < n; ++i)
+           jsonlogic_bench::keep(
+               jsonlogic::matches(logic->synatx_tree(), vars));
+       }});
+
+  // includes sampling and reordering of the and and or operands
+  benchmarks.push_back(
+      {"matches/adaptive", [rule, vars](std::size_t n) -> void {
+         jsonlogic::logic_options opts;
+
+         opts.adaptive_order = true;
+
+         jsonlogic::logic_details logic = jsonlogic::create_logic(*rule, opts);
+
+         for (std::size_t i = 0; i < n; ++i)
+           jsonlogic_bench::keep(jsonlogic::matches(logic.synatx_tree(), vars));
+       }});
+
+  benchmarks.push_back(
+      {"apply/context", [logic, vars](std::size_t n) -> void {
+         jsonlogic::evaluation_context ctx;
+
+         for (std::size_t i = 0; i < n; ++i) {
+           jsonlogic::any_expr res =
+               jsonlogic::apply(logic->synatx_tree(), vars, ctx,
+                                jsonlogic::result_storage::arena);
+
+           jsonlogic_bench::keep(res);
+           res.reset();
+           ctx.release();
+         }
+       }});
+
+  auto result =
+      std::make_shared<jsonlogic::any_expr>(jsonlogic::to_expr(make_result()));
+
+  benchmarks.push_back({"print/stream", [result](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            std::ostringstream os;
+
+                            os << *result;
+                            jsonlogic_bench::keep(os);
+                          }
+                        }});
+
+  // selects the last arm of the routing rule
+  auto routing = std::make_shared<jsonlogic::logic_details>(
+      jsonlogic::create_logic(make_routing_rule()));
+  const jsonlogic::variable_accessor route = jsonlogic::data_accessor(
+      bjsn::object{{"route", "route-" + std::to_string(NUM_ROUTES - 1)}});
+
+  benchmarks.push_back({"apply/routing", [routing, route](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            jsonlogic::any_expr res =
+                                jsonlogic::apply(routing->synatx_tree(), route);
+
+                            jsonlogic_bench::keep(res);
+                          }
+                        }});
+
+  auto message = std::make_shared<jsonlogic::logic_details>(
+      jsonlogic::create_logic(make_message_rule()));
+  const jsonlogic::variable_accessor fields = jsonlogic::data_accessor(
+      bjsn::object{{"user", "jdoe"}, {"amount", 1234.5}});
+
+  benchmarks.push_back({"apply/message", [message, fields](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            jsonlogic::any_expr res =
+                                jsonlogic::apply(message->synatx_tree(), fields);
+
+                            jsonlogic_bench::keep(res);
+                          }
+                        }});
+
+  auto validation = std::make_shared<jsonlogic::logic_details>(
+      jsonlogic::create_logic(make_validation_rule()));
+  const jsonlogic::variable_accessor record =
+      jsonlogic::data_accessor(make_validated_record());
+
+  benchmarks.push_back({"apply/validation", [validation, record](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            jsonlogic::any_expr res = jsonlogic::apply(
+                                validation->synatx_tree(), record);
+
+                            jsonlogic_bench::keep(res);
+                          }
+                        }});
+
+  bjsn::array items;
+
+  for (std::size_t i = 0; i < NUM_REDUCED_ELEMENTS; ++i)
+    items.push_back(std::int64_t(i));
+
+  const jsonlogic::variable_accessor sequence =
+      jsonlogic::data_accessor(bjsn::object{{"items", std::move(items)}});
+
+  for (auto [name, text] : {std::pair{"apply/reduce-sum", sum_rule},
+                            std::pair{"apply/reduce-collect", collect_rule}}) {
+    auto reduction = std::make_shared<jsonlogic::logic_details>(
+        jsonlogic::create_logic(bjsn::parse(text)));
+
+    benchmarks.push_back({name, [reduction, sequence](std::size_t n) -> void {
+                            for (std::size_t i = 0; i < n; ++i) {
+                              jsonlogic::any_expr res = jsonlogic::apply(
+                                  reduction->synatx_tree(), sequence);
+
+                              jsonlogic_bench::keep(res);
+                            }
+                          }});
+  }
+
+  benchmarks.push_back({"print/serialize", [result](std::size_t n) -> void {
+                          std::string out;
+
+                          for (std::size_t i = 0; i < n; ++i) {
+                            out.clear();
+                            jsonlogic::serialize(*result, out);
+                            jsonlogic_bench::keep(out);
+                          }
+                        }});
+
+  benchmarks.push_back({"print/to_json", [result](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            bjsn::value json = jsonlogic::to_json(*result);
+
+                            jsonlogic_bench::keep(json);
+                          }
+                        }});
+}
+
+jsonlogic_bench::suite_registrar registration{"engine", setup};
+
+} // namespace
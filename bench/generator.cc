@@ -0,0 +1,397 @@
+// generates random rules and data of a controllable shape
+
+#include "generator.hpp"
+
+#include <algorithm>
+#include <array>
+#include <string>
+
+#include "jsonlogic/logic.hpp"
+
+namespace bjsn = boost::json;
+
+namespace jsonlogic_bench {
+namespace {
+
+enum class value_type { number, boolean, string, array };
+
+constexpr std::array<value_type, 4> all_types = {
+    value_type::number, value_type::boolean, value_type::string,
+    value_type::array};
+
+/// describes what variables refer to
+enum class scope {
+  record,   ///< the data record
+  element,  ///< the current element in map, filter, all, none, some
+  reduction ///< the current element in reduce
+};
+
+const char *const words[] = {"alpha", "beta", "gamma", "delta",
+                             "epsilon", "zeta", "eta", "theta"};
+
+/// a splitmix64 generator
+/// \details
+///    the distributions of the standard library are not portable,
+///    which would make corpora differ between platforms.
+struct random_source {
+  explicit random_source(std::uint64_t seed) : state(seed) {}
+
+  std::uint64_t next() {
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  /// returns a number in [0, n)
+  std::size_t below(std::size_t n) { return n ? next() % n : 0; }
+
+  bool coin() { return next() & 1; }
+
+private:
+  std::uint64_t state;
+};
+
+class generator;
+
+using operator_builder = bjsn::value (generator::*)(const char *,
+                                                    std::size_t, scope,
+                                                    value_type);
+
+/// an operator together with the type it produces
+struct operator_shape {
+  const char *name;
+  value_type result;
+  operator_builder build;
+};
+
+class generator {
+public:
+  explicit generator(const corpus_shape &s);
+
+  bjsn::value rule() {
+    return expression(all_types[rnd.below(all_types.size())], shape.depth,
+                      scope::record);
+  }
+
+  bjsn::value data();
+
+private:
+  bjsn::value expression(value_type ty, std::size_t depth, scope sc);
+  bjsn::value leaf(value_type ty, scope sc);
+  bjsn::value literal(value_type ty);
+
+  std::string field_name(std::size_t i) const {
+    return "f" + std::to_string(i);
+  }
+
+  value_type field_type(std::size_t i) const { return all_types[i % 4]; }
+
+  bjsn::value operands(value_type ty, std::size_t num, std::size_t depth,
+                       scope sc) {
+    bjsn::array res;
+
+    for (std::size_t i = 0; i < num; ++i)
+      res.push_back(expression(ty, depth, sc));
+
+    return res;
+  }
+
+  bjsn::value make(const char *name, bjsn::value args) {
+    return bjsn::object{{name, std::move(args)}};
+  }
+
+  // builders for groups of operators
+
+  bjsn::value comparison(const char *name, std::size_t depth, scope sc,
+                         value_type) {
+    const value_type ty = rnd.below(4) ? value_type::number
+                                       : value_type::string;
+
+    return make(name, operands(ty, 2, depth, sc));
+  }
+
+  bjsn::value nary(const char *name, std::size_t depth, scope sc,
+                   value_type ty) {
+    return make(name, operands(ty, shape.fanout, depth, sc));
+  }
+
+  bjsn::value unary(const char *name, std::size_t depth, scope sc,
+                    value_type) {
+    return make(name, operands(value_type::boolean, 1, depth, sc));
+  }
+
+  bjsn::value binary(const char *name, std::size_t depth, scope sc,
+                     value_type ty) {
+    return make(name, operands(ty, 2, depth, sc));
+  }
+
+  /// the second operand is a small non-zero integer, which avoids
+  ///   division by zero and overflow.
+  /// \details
+  ///    % does not accept doubles, so its first operand is an integer
+  ///    field or literal; elements may be results of /.
+  bjsn::value scaled(const char *name, std::size_t depth, scope sc,
+                     value_type) {
+    bjsn::value lhs;
+
+    if (name[0] != '%')
+      lhs = expression(value_type::number, depth, sc);
+    else if (sc == scope::record)
+      lhs = leaf(value_type::number, sc);
+    else
+      lhs = literal(value_type::number);
+
+    return make(name,
+                bjsn::array{std::move(lhs), std::int64_t(1 + rnd.below(3))});
+  }
+
+  bjsn::value conditional(const char *name, std::size_t depth, scope sc,
+                          value_type ty) {
+    return make(name, bjsn::array{expression(value_type::boolean, depth, sc),
+                                  expression(ty, depth, sc),
+                                  expression(ty, depth, sc)});
+  }
+
+  bjsn::value concatenation(const char *name, std::size_t depth, scope sc,
+                            value_type) {
+    bjsn::array args;
+
+    for (std::size_t i = 0; i < shape.fanout; ++i)
+      args.push_back(expression(
+          rnd.coin() ? value_type::string : value_type::number, depth, sc));
+
+    return make(name, std::move(args));
+  }
+
+  bjsn::value membership(const char *name, std::size_t depth, scope sc,
+                         value_type) {
+    const bjsn::string_view word = words[rnd.below(std::size(words))];
+
+    return make(name, bjsn::array{bjsn::string{word.substr(0, 2)},
+                                  expression(value_type::string, depth, sc)});
+  }
+
+  bjsn::value pattern(const char *name, std::size_t depth, scope sc,
+                      value_type) {
+    return make(name, bjsn::array{"^[a-e]", expression(value_type::string,
+                                                       depth, sc)});
+  }
+
+  /// map, filter, all, none, some
+  bjsn::value sequence(const char *name, std::size_t depth, scope sc,
+                       value_type) {
+    const value_type body = std::string{name} == "map" ? value_type::number
+                                                       : value_type::boolean;
+
+    return make(name, bjsn::array{expression(value_type::array, depth, sc),
+                                  expression(body, depth, scope::element)});
+  }
+
+  /// the accumulator only occurs as summand of the reduction, so
+  ///   that its value grows linearly with the array length.
+  bjsn::value reduction(const char *name, std::size_t depth, scope sc,
+                        value_type) {
+    bjsn::value step = make(
+        "+", bjsn::array{bjsn::object{{"var", "accumulator"}},
+                         expression(value_type::number, depth,
+                                    scope::reduction)});
+
+    return make(name, bjsn::array{expression(value_type::array, depth, sc),
+                                  std::move(step), 0});
+  }
+
+  /// missing and missing_some, negated as in the common "all present"
+  ///   test; some names refer to absent fields.
+  /// \details
+  ///    the result arrays hold strings, which other array operators
+  ///    would not accept as numbers.
+  bjsn::value absence(const char *name, std::size_t, scope sc,
+                      value_type ty) {
+    if (sc != scope::record)
+      return literal(ty);
+
+    bjsn::array names;
+
+    for (std::size_t i = 0; i < shape.fanout; ++i)
+      names.push_back(bjsn::string{field_name(rnd.below(shape.width * 2))});
+
+    if (std::string{name} == "missing")
+      return make("!", make(name, std::move(names)));
+
+    return make("!", make(name, bjsn::array{1, std::move(names)}));
+  }
+
+  static const operator_shape known_operators[];
+
+  corpus_shape shape;
+  random_source rnd;
+
+  /// the available operators by result type
+  std::array<std::vector<const operator_shape *>, 4> producers;
+
+  /// the variables of the record by type
+  std::array<std::vector<std::size_t>, 4> fields;
+};
+
+const operator_shape generator::known_operators[] = {
+    {"==", value_type::boolean, &generator::comparison},
+    {"===", value_type::boolean, &generator::comparison},
+    {"!=", value_type::boolean, &generator::comparison},
+    {"!==", value_type::boolean, &generator::comparison},
+    {">", value_type::boolean, &generator::comparison},
+    {">=", value_type::boolean, &generator::comparison},
+    {"<", value_type::boolean, &generator::comparison},
+    {"<=", value_type::boolean, &generator::comparison},
+    {"if", value_type::number, &generator::conditional},
+    {"if", value_type::string, &generator::conditional},
+    {"!", value_type::boolean, &generator::unary},
+    {"!!", value_type::boolean, &generator::unary},
+    {"or", value_type::boolean, &generator::nary},
+    {"and", value_type::boolean, &generator::nary},
+    {"max", value_type::number, &generator::nary},
+    {"min", value_type::number, &generator::nary},
+    {"+", value_type::number, &generator::nary},
+    {"-", value_type::number, &generator::binary},
+    {"*", value_type::number, &generator::scaled},
+    {"/", value_type::number, &generator::scaled},
+    {"%", value_type::number, &generator::scaled},
+    {"map", value_type::array, &generator::sequence},
+    {"filter", value_type::array, &generator::sequence},
+    {"all", value_type::boolean, &generator::sequence},
+    {"none", value_type::boolean, &generator::sequence},
+    {"some", value_type::boolean, &generator::sequence},
+    {"reduce", value_type::number, &generator::reduction},
+    {"merge", value_type::array, &generator::nary},
+    {"membership", value_type::boolean, &generator::membership},
+    {"cat", value_type::string, &generator::concatenation},
+    {"missing", value_type::boolean, &generator::absence},
+    {"missing_some", value_type::boolean, &generator::absence},
+    {"regex", value_type::boolean, &generator::pattern},
+    // var is generated by leaf, log would write to the output
+};
+
+generator::generator(const corpus_shape &s) : shape(s), rnd(s.seed) {
+  const std::vector<bjsn::string_view> names =
+      jsonlogic::builtin_operator_names();
+
+  for (const operator_shape &op : known_operators) {
+    if (std::find(names.begin(), names.end(), op.name) != names.end())
+      producers[std::size_t(op.result)].push_back(&op);
+  }
+
+  const std::size_t numvars = std::min(shape.variables, shape.width);
+
+  for (std::size_t i = 0; i < numvars; ++i)
+    fields[std::size_t(field_type(i))].push_back(i);
+}
+
+bjsn::value generator::expression(value_type ty, std::size_t depth,
+                                  scope sc) {
+  const std::vector<const operator_shape *> &ops = producers[std::size_t(ty)];
+
+  if (depth == 0 || ops.empty())
+    return leaf(ty, sc);
+
+  const operator_shape &op = *ops[rnd.below(ops.size())];
+
+  return (this->*op.build)(op.name, depth - 1, sc, ty);
+}
+
+bjsn::value generator::leaf(value_type ty, scope sc) {
+  if (rnd.coin())
+    return literal(ty);
+
+  switch (sc) {
+  case scope::element:
+    if (ty == value_type::number)
+      return bjsn::object{{"var", ""}};
+    break;
+
+  case scope::reduction:
+    if (ty == value_type::number)
+      return bjsn::object{{"var", "current"}};
+    break;
+
+  default: {
+    const std::vector<std::size_t> &candidates = fields[std::size_t(ty)];
+
+    if (!candidates.empty())
+      return bjsn::object{
+          {"var", field_name(candidates[rnd.below(candidates.size())])}};
+  }
+  }
+
+  return literal(ty);
+}
+
+bjsn::value generator::literal(value_type ty) {
+  switch (ty) {
+  case value_type::number:
+    return std::int64_t(rnd.below(100));
+
+  case value_type::boolean:
+    return rnd.coin();
+
+  case value_type::string:
+    return bjsn::string{words[rnd.below(std::size(words))]};
+
+  default: {
+    bjsn::array res;
+
+    for (std::size_t i = 0; i < 3; ++i)
+      res.push_back(std::int64_t(rnd.below(100)));
+
+    return res;
+  }
+  }
+}
+
+bjsn::value generator::data() {
+  bjsn::object res;
+
+  for (std::size_t i = 0; i < shape.width; ++i) {
+    const value_type ty = field_type(i);
+
+    if (ty == value_type::array) {
+      bjsn::array elems;
+
+      for (std::size_t j = 0; j < shape.array_length; ++j)
+        elems.push_back(std::int64_t(rnd.below(100)));
+
+      res[field_name(i)] = std::move(elems);
+    } else {
+      res[field_name(i)] = literal(ty);
+    }
+  }
+
+  return res;
+}
+
+} // namespace
+
+corpus generate_corpus(const corpus_shape &shape) {
+  generator gen{shape};
+  corpus res;
+
+  res.data = gen.data();
+  res.rules.reserve(shape.rules);
+
+  for (std::size_t i = 0; i < shape.rules; ++i)
+    res.rules.push_back(gen.rule());
+
+  return res;
+}
+
+bjsn::object to_json(const corpus_shape &shape) {
+  return {{"depth", shape.depth},
+          {"fanout", shape.fanout},
+          {"variables", shape.variables},
+          {"array_length", shape.array_length},
+          {"width", shape.width},
+          {"rules", shape.rules},
+          {"seed", shape.seed}};
+}
+
+} // namespace jsonlogic_bench
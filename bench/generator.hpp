@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <boost/json.hpp>
+
+namespace jsonlogic_bench {
+
+/// the shape parameters of a generated rule and data corpus
+struct corpus_shape {
+  std::size_t depth = 3;         ///< nesting depth of operator nodes
+  std::size_t fanout = 3;        ///< number of operands of n-ary operators
+  std::size_t variables = 8;     ///< number of distinct variables in rules
+  std::size_t array_length = 16; ///< number of elements of array fields
+  std::size_t width = 16;        ///< number of fields of the data record
+  std::size_t rules = 64;        ///< number of rules
+  std::uint64_t seed = 1;        ///< seed of the random number generator
+};
+
+/// a set of rules together with a matching data record
+struct corpus {
+  std::vector<boost::json::value> rules;
+  boost::json::value data;
+};
+
+/// generates a corpus of the given \ref shape
+/// \details
+///    the rules use the built-in operators of the library, except log.
+///    Operands are generated for the types an operator expects, so that
+///    evaluating a rule on the data does not throw.
+///    Equal shapes generate equal corpora on all platforms.
+corpus generate_corpus(const corpus_shape &shape);
+
+/// returns the shape parameters of \ref shape as json object
+boost::json::object to_json(const corpus_shape &shape);
+
+} // namespace jsonlogic_bench
@@ -0,0 +1,104 @@
+// compares full and incremental re-evaluation after single field updates
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "bench.hpp"
+#include "jsonlogic/logic.hpp"
+
+namespace bjsn = boost::json;
+
+namespace {
+
+constexpr std::size_t NUM_FIELDS = 32;
+
+std::string field_name(std::size_t i) { return "field" + std::to_string(i); }
+
+/// an "or" over \ref width range tests on the record fields
+bjsn::value make_rule(std::size_t width) {
+  bjsn::array terms;
+
+  for (std::size_t i = 0; i < width; ++i) {
+    const std::string field = field_name(i % NUM_FIELDS);
+
+    terms.push_back(bjsn::parse(R"({"and":[{">":[{"var":")" + field +
+                                R"("},)" + std::to_string(100 + i) + R"(]},)" +
+                                R"({"<":[{"*":[{"var":")" + field +
+                                R"("},2]},)" + std::to_string(50 + i) +
+                                R"(]}]})"));
+  }
+
+  return bjsn::object{{"or", std::move(terms)}};
+}
+
+struct record_state {
+  bjsn::object record;
+  jsonlogic::logic_details logic;
+  std::unique_ptr<jsonlogic::incremental_evaluator> incremental;
+  std::size_t updates = 0;
+
+  explicit record_state(std::size_t width)
+      : logic(jsonlogic::create_logic(make_rule(width))) {
+    for (std::size_t i = 0; i < NUM_FIELDS; ++i)
+      record[field_name(i)] = i;
+
+    incremental = std::make_unique<jsonlogic::incremental_evaluator>(logic);
+  }
+
+  jsonlogic::variable_accessor accessor() {
+    bjsn::object *rec = &record;
+
+    return [rec](const bjsn::value &key, int) -> jsonlogic::any_expr {
+      return jsonlogic::to_expr(rec->at(key.as_string()));
+    };
+  }
+
+  /// modifies one field and returns its name
+  std::string update() {
+    const std::string name = field_name(updates % NUM_FIELDS);
+
+    record[name] = updates++;
+    return name;
+  }
+};
+
+void setup(std::vector<jsonlogic_bench::benchmark> &benchmarks) {
+  for (std::size_t width : {16, 256}) {
+    const std::string suffix = "/width=" + std::to_string(width);
+    auto state = std::make_shared<record_state>(width);
+
+    benchmarks.push_back({"full" + suffix, [state](std::size_t n) -> void {
+                            jsonlogic::variable_accessor vars =
+                                state->accessor();
+
+                            for (std::size_t i = 0; i < n; ++i) {
+                              state->update();
+
+                              jsonlogic::any_expr res = jsonlogic::apply(
+                                  state->logic.synatx_tree(), vars);
+
+                              jsonlogic_bench::keep(res);
+                            }
+                          }});
+
+    benchmarks.push_back(
+        {"incremental" + suffix, [state](std::size_t n) -> void {
+           jsonlogic::variable_accessor vars = state->accessor();
+
+           for (std::size_t i = 0; i < n; ++i) {
+             state->incremental->changed(state->update());
+
+             jsonlogic::any_expr res = state->incremental->evaluate(vars);
+
+             jsonlogic_bench::keep(res);
+           }
+         }});
+  }
+}
+
+jsonlogic_bench::suite_registrar registration{"incremental", setup};
+
+} // namespace
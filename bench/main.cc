@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "bench.hpp"
+
+#include <boost/json/src.hpp>
+
+namespace bjsn = boost::json;
+
+namespace jsonlogic_bench {
+namespace {
+
+std::vector<std::pair<std::string, suite_fn>> &suites() {
+  static std::vector<std::pair<std::string, suite_fn>> all;
+
+  return all;
+}
+
+struct measurement {
+  std::size_t iterations = 0;
+  std::chrono::nanoseconds time{};
+  std::size_t allocs = 0;
+  std::size_t bytes = 0;
+};
+
+/// doubles the iteration count until a run takes at least \ref minTime
+measurement measure(const benchmark_fn &fn,
+                    std::chrono::milliseconds minTime) {
+  using clock = std::chrono::steady_clock;
+
+  measurement res;
+
+  for (std::size_t n = 1; res.time < minTime; n *= 2) {
+    const allocation_counts before = allocations();
+    const clock::time_point start = clock::now();
+
+    fn(n);
+
+    res.time = clock::now() - start;
+
+    const allocation_counts after = allocations();
+
+    res.iterations = n;
+    res.allocs = after.allocs - before.allocs;
+    res.bytes = after.bytes - before.bytes;
+  }
+
+  return res;
+}
+
+} // namespace
+
+suite_registrar::suite_registrar(const char *name, suite_fn fn) {
+  suites().emplace_back(name, fn);
+}
+
+} // namespace jsonlogic_bench
+
+int main(int argc, const char **argv) {
+  namespace jb = jsonlogic_bench;
+
+  std::vector<std::string> selected(argv + 1, argv + argc);
+  std::chrono::milliseconds minTime{200};
+  bjsn::array results;
+
+  auto isSelected = [&selected](const std::string &name) -> bool {
+    return selected.empty() ||
+           std::find(selected.begin(), selected.end(), name) != selected.end();
+  };
+
+  for (const auto &[suitename, setup] : jb::suites()) {
+    if (!isSelected(suitename))
+      continue;
+
+    std::vector<jb::benchmark> benchmarks;
+
+    setup(benchmarks);
+
+    for (const jb::benchmark &bm : benchmarks) {
+      bjsn::object entry;
+
+      entry["suite"] = suitename;
+      entry["name"] = bm.name;
+
+      jb::measurement m;
+
+      try {
+        m = jb::measure(bm.fn, minTime);
+      } catch (const std::exception &ex) {
+        // a failing benchmark is reported, but does not stop the others
+        entry["error"] = std::string{ex.what()};
+        results.push_back(std::move(entry));
+        continue;
+      }
+
+      const double nsPerOp = double(m.time.count()) / m.iterations;
+
+      entry["iterations"] = m.iterations;
+      entry["ns_per_op"] = nsPerOp;
+      entry["allocs_per_op"] = double(m.allocs) / m.iterations;
+      entry["bytes_per_op"] = double(m.bytes) / m.iterations;
+      results.push_back(std::move(entry));
+    }
+  }
+
+  std::cout << results << std::endl;
+  return 0;
+}
@@ -0,0 +1,80 @@
+// benchmarks field access on records inside map and filter
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "bench.hpp"
+#include "jsonlogic/details/ast-full.hpp"
+#include "jsonlogic/logic.hpp"
+
+namespace bjsn = boost::json;
+
+namespace {
+
+constexpr std::size_t NUM_RECORDS = 256;
+
+/// creates records with \ref width fields; the last one is called score
+bjsn::value make_records(std::size_t width) {
+  bjsn::array records;
+
+  for (std::size_t i = 0; i < NUM_RECORDS; ++i) {
+    bjsn::object rec;
+
+    for (std::size_t fld = 1; fld < width; ++fld)
+      rec["field" + std::to_string(fld)] = fld;
+
+    rec["score"] = i % 100;
+    records.push_back(std::move(rec));
+  }
+
+  return bjsn::object{{"rows", std::move(records)}};
+}
+
+void add_rule(std::vector<jsonlogic_bench::benchmark> &benchmarks,
+              std::string name, const char *rule, const bjsn::value &data) {
+  auto logic = std::make_shared<jsonlogic::logic_details>(
+      jsonlogic::create_logic(bjsn::parse(rule)));
+  jsonlogic::variable_accessor vars = jsonlogic::data_accessor(data);
+
+  benchmarks.push_back(
+      {std::move(name), [logic, vars](std::size_t n) -> void {
+         for (std::size_t i = 0; i < n; ++i) {
+           jsonlogic::any_expr res =
+               jsonlogic::apply(logic->synatx_tree(), vars);
+
+           jsonlogic_bench::keep(res);
+         }
+       }});
+}
+
+void setup(std::vector<jsonlogic_bench::benchmark> &benchmarks) {
+  for (std::size_t width : {4, 16, 64}) {
+    const std::string suffix = "/width=" + std::to_string(width);
+    const bjsn::value data = make_records(width);
+
+    add_rule(benchmarks, "map" + suffix,
+             R"({"map":[{"var":"rows"},{"var":"score"}]})", data);
+    add_rule(benchmarks, "filter" + suffix,
+             R"({"filter":[{"var":"rows"},{">":[{"var":"score"},50]}]})",
+             data);
+
+    // key lookup in isolation
+    auto rec = std::make_shared<jsonlogic::any_expr>(
+        jsonlogic::to_expr(data.as_object().at("rows").as_array().at(0)));
+
+    benchmarks.push_back(
+        {"find" + suffix, [rec](std::size_t n) -> void {
+           auto &obj = dynamic_cast<jsonlogic::object_value &>(**rec);
+
+           for (std::size_t i = 0; i < n; ++i)
+             jsonlogic_bench::keep(*obj.find("score"));
+         }});
+  }
+}
+
+jsonlogic_bench::suite_registrar registration{"objects", setup};
+
+} // namespace
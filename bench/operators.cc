@@ -0,0 +1,151 @@
+// microbenchmarks for every operator of the dispatch table
+//   operands are read from variables, so that the measured time includes
+//   the type dispatch on the operand values.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "bench.hpp"
+#include "jsonlogic/logic.hpp"
+
+namespace bjsn = boost::json;
+
+namespace {
+
+/// one value per operand type
+const char *const data_text = R"({
+  "i": 42, "j": 7, "u": 18446744073709551615, "d": 2.5, "e": 0.75,
+  "s": "apple", "t": "banana", "ns": "12", "ms": "3.5", "b": true, "f": false,
+  "n": null, "a": [1, 2, 3, 4, 5, 6, 7, 8], "sa": ["x", "y", "z"],
+  "rec": {"name": "ann", "age": 31, "tags": ["a", "b"]}
+})";
+
+/// operand type combinations of comparisons, named by type
+const char *const comparison_operands[][2] = {
+    {"int,int", R"([{"var":"i"},{"var":"j"}])"},
+    {"uint,int", R"([{"var":"u"},{"var":"j"}])"},
+    {"double,double", R"([{"var":"d"},{"var":"e"}])"},
+    {"int,double", R"([{"var":"i"},{"var":"d"}])"},
+    {"string,string", R"([{"var":"s"},{"var":"t"}])"},
+    {"string,int", R"([{"var":"ns"},{"var":"i"}])"},
+    {"int,literal", R"([{"var":"i"},"40"])"},
+    {"array,array", R"([{"var":"a"},{"var":"a"}])"},
+    {"bool,int", R"([{"var":"b"},{"var":"i"}])"},
+    {"null,int", R"([{"var":"n"},{"var":"i"}])"},
+};
+
+/// operand type combinations of arithmetic operators
+/// \details
+///    converting a string that does not hold a number throws, so all
+///    string operands are numeric.
+const char *const arithmetic_operands[][2] = {
+    {"int,int", R"([{"var":"i"},{"var":"j"}])"},
+    {"uint,int", R"([{"var":"u"},{"var":"j"}])"},
+    {"double,double", R"([{"var":"d"},{"var":"e"}])"},
+    {"int,double", R"([{"var":"i"},{"var":"d"}])"},
+    {"string,string", R"([{"var":"ns"},{"var":"ms"}])"},
+    {"string,int", R"([{"var":"ns"},{"var":"i"}])"},
+    {"literal,int", R"(["1.5",{"var":"i"}])"},
+    {"bool,int", R"([{"var":"b"},{"var":"i"}])"},
+    {"null,int", R"([{"var":"n"},{"var":"i"}])"},
+};
+
+/// operand type combinations of unary and boolean operators
+const char *const unary_operands[][2] = {
+    {"bool", R"([{"var":"b"}])"},
+    {"int", R"([{"var":"i"}])"},
+    {"string", R"([{"var":"s"}])"},
+    {"null", R"([{"var":"n"}])"},
+    {"array", R"([{"var":"a"}])"},
+};
+
+const char *const comparison_operators[] = {"==", "===", "!=", "!==",
+                                            ">",  ">=",  "<",  "<="};
+
+const char *const arithmetic_operators[] = {"+", "-", "*", "/",
+                                            "%", "max", "min"};
+
+/// operators whose operands need a specific shape
+const char *const shaped_rules[][2] = {
+    {"if/bool", R"({"if":[{"var":"b"},{"var":"i"},{"var":"j"}]})"},
+    {"if/chain", R"({"if":[{"var":"f"},1,{"var":"n"},2,{"var":"b"},3,4]})"},
+    {"and/bool,bool", R"({"and":[{"var":"b"},{"var":"f"}]})"},
+    {"and/int,string", R"({"and":[{"var":"i"},{"var":"s"}]})"},
+    {"or/bool,bool", R"({"or":[{"var":"f"},{"var":"b"}]})"},
+    {"or/null,string", R"({"or":[{"var":"n"},{"var":"s"}]})"},
+    {"-/int", R"({"-":[{"var":"i"}]})"},
+    {"+/int*4", R"({"+":[{"var":"i"},{"var":"j"},{"var":"i"},{"var":"j"}]})"},
+    {"cat/string,string", R"({"cat":[{"var":"s"},{"var":"t"}]})"},
+    {"cat/string,int,double", R"({"cat":[{"var":"s"},{"var":"i"},{"var":"d"}]})"},
+    {"merge/array,array", R"({"merge":[{"var":"a"},{"var":"sa"}]})"},
+    {"merge/array,int", R"({"merge":[{"var":"a"},{"var":"i"}]})"},
+    {"membership/string,string", R"({"membership":["pl",{"var":"s"}]})"},
+    {"map/array", R"({"map":[{"var":"a"},{"*":[{"var":""},2]}]})"},
+    {"filter/array", R"({"filter":[{"var":"a"},{">":[{"var":""},4]}]})"},
+    {"reduce/array",
+     R"({"reduce":[{"var":"a"},{"+":[{"var":"current"},{"var":"accumulator"}]},0]})"},
+    {"reduce/array,cat",
+     R"({"reduce":[{"var":"sa"},{"cat":[{"var":"accumulator"},{"var":"current"}]},""]})"},
+    {"all/array", R"({"all":[{"var":"a"},{">":[{"var":""},0]}]})"},
+    {"none/array", R"({"none":[{"var":"a"},{">":[{"var":""},9]}]})"},
+    {"some/array", R"({"some":[{"var":"a"},{"==":[{"var":""},8]}]})"},
+    {"var/name", R"({"var":"i"})"},
+    {"var/path", R"({"var":"rec.tags.1"})"},
+    {"var/default", R"({"var":["nope",0]})"},
+    {"missing/present", R"({"missing":["i","s","rec.name"]})"},
+    {"missing/absent", R"({"missing":["x","y","z"]})"},
+    {"missing_some/array", R"({"missing_some":[1,["x","s","i"]]})"},
+#if WITH_JSON_LOGIC_CPP_EXTENSIONS
+    {"regex/string", R"({"regex":["^a.*e$",{"var":"s"}]})"},
+#endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
+    // log is omitted, as it would measure the output stream
+};
+
+void add_rule(std::vector<jsonlogic_bench::benchmark> &benchmarks,
+              std::string name, const std::string &rule,
+              const jsonlogic::variable_accessor &vars) {
+  auto logic = std::make_shared<jsonlogic::logic_details>(
+      jsonlogic::create_logic(bjsn::parse(rule)));
+
+  benchmarks.push_back(
+      {std::move(name), [logic, vars](std::size_t n) -> void {
+         for (std::size_t i = 0; i < n; ++i) {
+           jsonlogic::any_expr res =
+               jsonlogic::apply(logic->synatx_tree(), vars);
+
+           jsonlogic_bench::keep(res);
+         }
+       }});
+}
+
+void setup(std::vector<jsonlogic_bench::benchmark> &benchmarks) {
+  const jsonlogic::variable_accessor vars =
+      jsonlogic::data_accessor(bjsn::parse(data_text));
+
+  auto addOperator = [&](const char *op, const char *const(&operands)[2]) {
+    add_rule(benchmarks, std::string{op} + "/" + operands[0],
+             std::string{R"({")"} + op + R"(":)" + operands[1] + "}", vars);
+  };
+
+  for (const char *op : comparison_operators)
+    for (const auto &operands : comparison_operands)
+      addOperator(op, operands);
+
+  for (const char *op : arithmetic_operators)
+    for (const auto &operands : arithmetic_operands)
+      addOperator(op, operands);
+
+  for (const char *op : {"!", "!!"})
+    for (const auto &operands : unary_operands)
+      addOperator(op, operands);
+
+  for (const auto &[name, rule] : shaped_rules)
+    add_rule(benchmarks, name, rule, vars);
+}
+
+jsonlogic_bench::suite_registrar registration{"operators", setup};
+
+} // namespace
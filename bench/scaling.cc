@@ -0,0 +1,265 @@
+// sweeps the shape parameters of generated corpora and reports how
+//   compile and evaluation time and memory scale.
+//
+// usage: jsonlogic_scaling [options] [parameter..]
+//   parameters: depth fanout variables array_length width (default: all)
+//   options:
+//     --seed n         seed of the generated corpora (default: 1)
+//     --rules n        number of rules per corpus (default: 64)
+//     --steps n        number of values per parameter (default: 6)
+//     --corpus dir     writes each generated corpus to dir
+//     --gnuplot prefix writes prefix.csv and a gnuplot script prefix.gp
+//                      instead of printing the csv table
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "bench.hpp"
+#include "generator.hpp"
+#include "jsonlogic/logic.hpp"
+
+#include <boost/json/src.hpp>
+
+namespace bjsn = boost::json;
+namespace jb = jsonlogic_bench;
+
+namespace {
+
+/// a shape parameter and the sequence of its values in a sweep
+struct sweep {
+  const char *name;
+  std::size_t jb::corpus_shape::*param;
+  std::size_t first;
+  std::size_t factor;
+  std::size_t increment;
+};
+
+// the number of nodes grows exponentially with depth, so depth
+// increases linearly.
+const sweep sweeps[] = {
+    {"depth", &jb::corpus_shape::depth, 1, 1, 1},
+    {"fanout", &jb::corpus_shape::fanout, 1, 2, 0},
+    {"variables", &jb::corpus_shape::variables, 1, 2, 0},
+    {"array_length", &jb::corpus_shape::array_length, 4, 4, 0},
+    {"width", &jb::corpus_shape::width, 4, 4, 0},
+};
+
+const char *const csv_header =
+    "parameter,value,rules,nodes_per_rule,compile_ns_per_rule,"
+    "compile_bytes_per_rule,retained_bytes_per_rule,apply_ns_per_rule,"
+    "apply_allocs_per_rule,apply_bytes_per_rule,errors";
+
+constexpr std::chrono::milliseconds min_apply_time{100};
+
+/// counts the operator nodes and values of a rule
+std::size_t count_nodes(const bjsn::value &rule) {
+  std::size_t res = 1;
+
+  if (const bjsn::object *obj = rule.if_object()) {
+    for (const auto &entry : *obj)
+      res += count_nodes(entry.value());
+  } else if (const bjsn::array *arr = rule.if_array()) {
+    res = 0;
+
+    for (const bjsn::value &elem : *arr)
+      res += count_nodes(elem);
+  }
+
+  return res;
+}
+
+/// compiles and evaluates \ref corp and writes one csv line to \ref os
+void measure(std::ostream &os, const char *param, std::size_t value,
+             const jb::corpus &corp) {
+  using clock = std::chrono::steady_clock;
+
+  const std::size_t numrules = corp.rules.size();
+  std::size_t nodes = 0;
+
+  for (const bjsn::value &rule : corp.rules)
+    nodes += count_nodes(rule);
+
+  std::vector<jsonlogic::logic_details> compiled;
+
+  compiled.reserve(numrules);
+
+  const jb::allocation_counts beforeCompile = jb::allocations();
+  const clock::time_point startCompile = clock::now();
+
+  for (const bjsn::value &rule : corp.rules)
+    compiled.push_back(jsonlogic::create_logic(rule));
+
+  const std::chrono::nanoseconds compileTime = clock::now() - startCompile;
+  const jb::allocation_counts afterCompile = jb::allocations();
+
+  const jsonlogic::variable_accessor vars = jsonlogic::data_accessor(corp.data);
+  std::size_t errors = 0;
+  std::size_t rounds = 0;
+  std::chrono::nanoseconds applyTime{};
+  const jb::allocation_counts beforeApply = jb::allocations();
+
+  // repeats the evaluation of all rules until the time is measurable
+  while (applyTime < min_apply_time) {
+    const clock::time_point start = clock::now();
+
+    for (const jsonlogic::logic_details &logic : compiled) {
+      try {
+        jsonlogic::any_expr res = jsonlogic::apply(logic.synatx_tree(), vars);
+
+        jb::keep(res);
+      } catch (const std::exception &) {
+        ++errors;
+      }
+    }
+
+    applyTime += clock::now() - start;
+    ++rounds;
+  }
+
+  const jb::allocation_counts afterApply = jb::allocations();
+  const double rules = double(numrules);
+  const double evals = rules * rounds;
+
+  os << param << ',' << value << ',' << numrules << ',' << nodes / rules
+     << ',' << compileTime.count() / rules << ','
+     << (afterCompile.bytes - beforeCompile.bytes) / rules << ','
+     << (afterCompile.live - beforeCompile.live) / rules << ','
+     << applyTime.count() / evals << ','
+     << (afterApply.allocs - beforeApply.allocs) / evals << ','
+     << (afterApply.bytes - beforeApply.bytes) / evals << ','
+     << errors / rounds << std::endl;
+}
+
+void write_corpus(const std::string &dir, const char *param,
+                  std::size_t value, const jb::corpus_shape &shape,
+                  const jb::corpus &corp) {
+  bjsn::array rules;
+
+  for (const bjsn::value &rule : corp.rules)
+    rules.push_back(rule);
+
+  bjsn::object out{{"shape", jb::to_json(shape)},
+                   {"rules", std::move(rules)},
+                   {"data", corp.data}};
+
+  std::ofstream file{dir + "/" + param + "-" + std::to_string(value) +
+                     ".json"};
+
+  file << out << std::endl;
+}
+
+/// writes a gnuplot script that plots time and memory over each parameter
+void write_gnuplot(std::ostream &os, const std::string &prefix,
+                   const std::vector<const sweep *> &selected) {
+  os << "set datafile separator ','\n"
+     << "set terminal pngcairo size 960,540\n"
+     << "set logscale y\n"
+     << "set ylabel 'ns per rule'\n"
+     << "set y2label 'bytes per rule'\n"
+     << "set logscale y2\n"
+     << "set y2tics\n"
+     << "set key left top\n";
+
+  for (const sweep *sw : selected) {
+    const std::string sel =
+        "(stringcolumn(1) eq '" + std::string{sw->name} + "' ? $";
+
+    os << "set output '" << prefix << "-" << sw->name << ".png'\n"
+       << "set xlabel '" << sw->name << "'\n"
+       << "plot '" << prefix << ".csv' using 2:" << sel
+       << "5 : NaN) with linespoints title 'compile',\\\n"
+       << "  '' using 2:" << sel
+       << "8 : NaN) with linespoints title 'apply',\\\n"
+       << "  '' using 2:" << sel
+       << "7 : NaN) axes x1y2 with linespoints title 'retained',\\\n"
+       << "  '' using 2:" << sel
+       << "10 : NaN) axes x1y2 with linespoints title 'apply bytes'\n";
+  }
+}
+
+} // namespace
+
+int main(int argc, const char **argv) {
+  jb::corpus_shape baseline;
+  std::size_t steps = 6;
+  std::string corpusDir;
+  std::string plotPrefix;
+  std::vector<const sweep *> selected;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool hasValue = (i + 1 < argc);
+
+    if (arg == "--seed" && hasValue)
+      baseline.seed = std::stoull(argv[++i]);
+    else if (arg == "--rules" && hasValue)
+      baseline.rules = std::stoull(argv[++i]);
+    else if (arg == "--steps" && hasValue)
+      steps = std::stoull(argv[++i]);
+    else if (arg == "--corpus" && hasValue)
+      corpusDir = argv[++i];
+    else if (arg == "--gnuplot" && hasValue)
+      plotPrefix = argv[++i];
+    else {
+      auto pos = std::find_if(
+          std::begin(sweeps), std::end(sweeps),
+          [&arg](const sweep &sw) -> bool { return arg == sw.name; });
+
+      if (pos == std::end(sweeps)) {
+        std::cerr << "unknown argument: " << arg << std::endl;
+        return 1;
+      }
+
+      selected.push_back(&*pos);
+    }
+  }
+
+  if (selected.empty())
+    for (const sweep &sw : sweeps)
+      selected.push_back(&sw);
+
+  std::ofstream csvFile;
+
+  if (!plotPrefix.empty())
+    csvFile.open(plotPrefix + ".csv");
+
+  std::ostream &csv = plotPrefix.empty() ? std::cout : csvFile;
+
+  csv << csv_header << std::endl;
+
+  for (const sweep *sw : selected) {
+    std::size_t value = sw->first;
+
+    for (std::size_t step = 0; step < steps; ++step) {
+      jb::corpus_shape shape = baseline;
+
+      shape.*(sw->param) = value;
+
+      // all variables need a field in the record
+      shape.width = std::max(shape.width, shape.variables);
+
+      const jb::corpus corp = jb::generate_corpus(shape);
+
+      if (!corpusDir.empty())
+        write_corpus(corpusDir, sw->name, value, shape, corp);
+
+      measure(csv, sw->name, value, corp);
+      value = value * sw->factor + sw->increment;
+    }
+  }
+
+  if (!plotPrefix.empty()) {
+    std::ofstream script{plotPrefix + ".gp"};
+
+    write_gnuplot(script, plotPrefix, selected);
+  }
+
+  return 0;
+}
@@ -0,0 +1,104 @@
+// compares loading rules from json text with loading them from a snapshot
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/json.hpp>
+
+#include "bench.hpp"
+#include "jsonlogic/logic.hpp"
+
+namespace bjsn = boost::json;
+
+namespace {
+
+constexpr std::size_t NUM_RULES = 1024;
+
+/// a rule of about \ref width comparisons
+std::string make_rule_text(std::size_t width, std::size_t seed) {
+  bjsn::array terms;
+
+  for (std::size_t i = 0; i < width; ++i) {
+    const std::string field = "field" + std::to_string((seed + i) % 32);
+
+    terms.push_back(bjsn::parse(R"({"and":[{">=":[{"var":")" + field +
+                                R"("},)" + std::to_string(i) + R"(]},)" +
+                                R"({"!=":[{"var":"tag"},"t)" +
+                                std::to_string(seed % 8) + R"("]}]})"));
+  }
+
+  return bjsn::serialize(bjsn::object{{"or", std::move(terms)}});
+}
+
+struct startup_data {
+  std::vector<std::string> texts;
+  std::string image;
+  std::filesystem::path file;
+
+  ~startup_data() {
+    std::error_code ec;
+
+    std::filesystem::remove(file, ec);
+  }
+};
+
+void setup(std::vector<jsonlogic_bench::benchmark> &benchmarks) {
+  auto data = std::make_shared<startup_data>();
+  std::vector<jsonlogic::logic_details> rules;
+
+  for (std::size_t i = 0; i < NUM_RULES; ++i) {
+    data->texts.push_back(make_rule_text(1 + i % 16, i));
+    rules.push_back(jsonlogic::create_logic(bjsn::parse(data->texts.back())));
+  }
+
+  std::stringstream os;
+
+  jsonlogic::write_snapshot(os, rules.data(), rules.size());
+  data->image = os.str();
+  data->file = std::filesystem::temp_directory_path() /
+               "jsonlogic_bench_startup.snapshot";
+
+  std::ofstream(data->file, std::ios::binary) << data->image;
+
+  const std::string suffix = "/rules=" + std::to_string(NUM_RULES);
+
+  // one operation loads all rules
+  benchmarks.push_back({"json" + suffix, [data](std::size_t n) -> void {
+                          for (std::size_t i = 0; i < n; ++i) {
+                            for (const std::string &text : data->texts) {
+                              jsonlogic::logic_details logic =
+                                  jsonlogic::create_logic(bjsn::parse(text));
+
+                              jsonlogic_bench::keep(logic);
+                            }
+                          }
+                        }});
+
+  benchmarks.push_back(
+      {"snapshot/memory" + suffix, [data](std::size_t n) -> void {
+         for (std::size_t i = 0; i < n; ++i) {
+           jsonlogic::snapshot snap(data->image.data(), data->image.size());
+           std::vector<jsonlogic::logic_details> logic = snap.rules();
+
+           jsonlogic_bench::keep(logic);
+         }
+       }});
+
+  benchmarks.push_back(
+      {"snapshot/mmap" + suffix, [data](std::size_t n) -> void {
+         for (std::size_t i = 0; i < n; ++i) {
+           jsonlogic::snapshot snap(data->file.string());
+           std::vector<jsonlogic::logic_details> logic = snap.rules();
+
+           jsonlogic_bench::keep(logic);
+         }
+       }});
+}
+
+jsonlogic_bench::suite_registrar registration{"startup", setup};
+
+} // namespace
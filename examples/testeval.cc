@@ -1,5 +1,6 @@
 
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
@@ -95,6 +96,326 @@ bool endsWith(const std::string &str, const std::string &suffix) {
           std::equal(suffix.rbegin(), suffix.rend(), str.rbegin()));
 }
 
+bool hasTruthValue(const jsonlogic::any_expr &val) {
+  try {
+    jsonlogic::truthy(val);
+  } catch (...) {
+    return false;
+  }
+
+  return true;
+}
+
+/// tests whether \ref lhs and \ref rhs print the same
+bool sameResult(jsonlogic::any_expr &lhs, jsonlogic::any_expr &rhs) {
+  // e.g., reduce over a missing array has no result
+  if (!lhs || !rhs)
+    return !lhs == !rhs;
+
+  std::stringstream lhsStream;
+  std::stringstream rhsStream;
+
+  lhsStream << lhs;
+  rhsStream << rhs;
+
+  return lhsStream.str() == rhsStream.str();
+}
+
+/// evaluates \ref rule after a round trip through a snapshot
+bool snapshotAgrees(const bjsn::value &rule, const bjsn::value &dat,
+                    jsonlogic::any_expr &res) {
+  std::stringstream buf;
+  jsonlogic::logic_details logic = jsonlogic::create_logic(rule);
+
+  jsonlogic::write_snapshot(buf, &logic, 1);
+
+  const std::string data = buf.str();
+  jsonlogic::snapshot snap(data.data(), data.size());
+  jsonlogic::logic_details loaded = snap.rule(0);
+  jsonlogic::any_expr other =
+      jsonlogic::apply(loaded.synatx_tree(), jsonlogic::data_accessor(dat));
+
+  return sameResult(res, other) &&
+         loaded.variable_names() == logic.variable_names() &&
+         loaded.has_computed_variable_names() ==
+             logic.has_computed_variable_names();
+}
+
+/// FNV-1a hash, as used for snapshot checksums
+std::uint64_t snapshotChecksum(const char *data, std::size_t len) {
+  std::uint64_t h = 0xcbf29ce484222325;
+
+  for (const char *lim = data + len; data != lim; ++data)
+    h = (h ^ std::uint8_t(*data)) * 0x100000001b3;
+
+  return h;
+}
+
+/// tests that corrupted snapshots of \ref rule fail to load with an error
+/// \details
+///    each four byte window behind the header is overwritten with a huge
+///    count, and the checksum is recomputed, so that the damage reaches
+///    the decoder. In addition, \ref rule is nested deeper than the
+///    decoder accepts.
+bool corruptSnapshotsRejected(const bjsn::value &rule) {
+  // the header holds magic, version, byte order, payload size, and checksum
+  constexpr std::size_t HEADER_SIZE = 32;
+  constexpr std::size_t CHECKSUM_POS = 24;
+  constexpr int TOO_DEEP = 1025;
+
+  auto loadFails = [](const std::string &image) -> bool {
+    try {
+      jsonlogic::snapshot snap(image.data(), image.size());
+
+      snap.rules();
+    } catch (const std::runtime_error &) {
+      return true;
+    }
+
+    return false;
+  };
+
+  auto imageOf = [](const bjsn::value &n) -> std::string {
+    std::stringstream buf;
+    jsonlogic::logic_details logic = jsonlogic::create_logic(n);
+
+    jsonlogic::write_snapshot(buf, &logic, 1);
+    return buf.str();
+  };
+
+  const std::string image = imageOf(rule);
+
+  try {
+    for (std::size_t pos = HEADER_SIZE; pos + 4 <= image.size(); ++pos) {
+      std::string corrupt = image;
+
+      corrupt.replace(pos, 4, 4, '\xff');
+
+      const std::uint64_t checksum = snapshotChecksum(
+          corrupt.data() + HEADER_SIZE, corrupt.size() - HEADER_SIZE);
+
+      std::memcpy(&corrupt[CHECKSUM_POS], &checksum, sizeof(checksum));
+
+      // a corruption may also result in a different, but valid tree
+      loadFails(corrupt);
+    }
+
+    bjsn::value deep = rule;
+
+    for (int i = 0; i < TOO_DEEP; ++i) {
+      bjsn::array args;
+      bjsn::object outer;
+
+      args.push_back(std::move(deep));
+      outer["!"] = std::move(args);
+      deep = std::move(outer);
+    }
+
+    return loadFails(imageOf(deep));
+  } catch (...) {
+    return false;
+  }
+}
+
+/// evaluates a cached \ref rule twice
+bool cacheAgrees(const bjsn::value &rule, const bjsn::value &dat,
+                 jsonlogic::any_expr &res) {
+  jsonlogic::rule_cache cache;
+  std::shared_ptr<const jsonlogic::logic_details> logic = cache.get(rule);
+
+  if (cache.get(rule) != logic)
+    return false;
+
+  const jsonlogic::rule_cache::statistics stats = cache.stats();
+
+  if (stats.hits != 1 || stats.misses != 1 || stats.entries != 1)
+    return false;
+
+  // a cached syntax tree must remain intact across evaluations
+  for (int i = 0; i < 2; ++i) {
+    jsonlogic::any_expr other =
+        jsonlogic::apply(logic->synatx_tree(), jsonlogic::data_accessor(dat));
+
+    if (!sameResult(res, other))
+      return false;
+  }
+
+  return true;
+}
+
+/// evaluates \ref rule incrementally, reporting each variable as changed,
+///   and then once more after removing all fields of the record.
+bool incrementalAgrees(const bjsn::value &rule, const bjsn::value &dat,
+                       jsonlogic::any_expr &res) {
+  jsonlogic::logic_details logic = jsonlogic::create_logic(rule);
+  jsonlogic::incremental_evaluator inc{logic};
+  jsonlogic::variable_accessor vars = jsonlogic::data_accessor(dat);
+
+  auto agrees = [&]() -> bool {
+    jsonlogic::any_expr other = inc.evaluate(vars);
+
+    return sameResult(res, other);
+  };
+
+  if (!agrees() || !agrees())
+    return false;
+
+  for (const bjsn::string &name : logic.variable_names()) {
+    inc.changed(name);
+
+    if (!agrees())
+      return false;
+  }
+
+  const bjsn::object *record = dat.if_object();
+
+  if (record == nullptr)
+    return true;
+
+  // removes all fields of the record and reports them by their keys
+  const bjsn::value empty = bjsn::object{};
+  jsonlogic::variable_accessor emptyVars = jsonlogic::data_accessor(empty);
+  jsonlogic::any_expr expected;
+
+  try {
+    expected = jsonlogic::apply(logic.synatx_tree(), emptyVars);
+  } catch (...) {
+    return true; // the rule requires some of the fields
+  }
+
+  for (const bjsn::key_value_pair &el : *record)
+    inc.changed(el.key());
+
+  jsonlogic::any_expr other = inc.evaluate(emptyVars);
+
+  return sameResult(expected, other);
+}
+
+/// evaluates \ref rule with a trace sink and checks that the trace
+///   starts and ends at the root and that node entries and exits match.
+bool traceAgrees(const bjsn::value &rule, const bjsn::value &dat,
+                 jsonlogic::any_expr &res) {
+  using jsonlogic::trace_event;
+
+  jsonlogic::logic_details logic = jsonlogic::create_logic(rule);
+  jsonlogic::trace_buffer sink{1 << 16};
+  jsonlogic::any_expr other = jsonlogic::apply(
+      logic.synatx_tree(), jsonlogic::data_accessor(dat), &sink);
+  std::vector<jsonlogic::trace_record> records;
+
+  sink.drain(records);
+
+  const void *root = logic.synatx_tree().get();
+  std::size_t open = 0;
+
+  for (const jsonlogic::trace_record &rec : records) {
+    if (rec.event == trace_event::enter)
+      ++open;
+    else if (rec.event == trace_event::exit && open-- == 0)
+      return false;
+  }
+
+  return sameResult(res, other) && sink.dropped() == 0 &&
+         open == 0 && records.size() >= 2 && records.front().node == root &&
+         records.back().node == root &&
+         records.back().event == trace_event::exit;
+}
+
+/// evaluates \ref rule in a boolean context often enough that adaptive
+///   ordering samples and reorders its operands.
+bool adaptiveAgrees(const bjsn::value &rule, const bjsn::value &dat,
+                    jsonlogic::any_expr &res) {
+  jsonlogic::logic_options opts;
+
+  opts.adaptive_order = true;
+
+  jsonlogic::logic_details logic = jsonlogic::create_logic(rule, opts);
+  jsonlogic::variable_accessor vars = jsonlogic::data_accessor(dat);
+  const bool expected = jsonlogic::truthy(res);
+
+  for (int i = 0; i < 2048; ++i)
+    if (jsonlogic::matches(logic.synatx_tree(), vars) != expected)
+      return false;
+
+  return true;
+}
+
+/// evaluates \ref rule often enough that adaptive ordering settles, and
+///   tests that a traced evaluation then reads the variables \ref reads
+///   in this order.
+/// \details
+///    the rule is compiled without static reordering, so that only the
+///    learned order can differ from left to right.
+bool adaptiveReadsAgree(const bjsn::value &rule, const bjsn::value &dat,
+                        const bjsn::array &reads) {
+  jsonlogic::logic_options opts;
+
+  opts.reorder_operands = false;
+  opts.adaptive_order = true;
+
+  jsonlogic::logic_details logic = jsonlogic::create_logic(rule, opts);
+  jsonlogic::variable_accessor vars = jsonlogic::data_accessor(dat);
+
+  for (int i = 0; i < 4096; ++i)
+    jsonlogic::matches(logic.synatx_tree(), vars);
+
+  jsonlogic::trace_buffer sink;
+  std::vector<jsonlogic::trace_record> records;
+  bjsn::array names;
+
+  jsonlogic::matches(logic.synatx_tree(), vars, &sink);
+  sink.drain(records);
+
+  for (const jsonlogic::trace_record &rec : records)
+    if (rec.event == jsonlogic::trace_event::variable && rec.detail >= 0)
+      names.push_back(logic.variable_names().at(rec.detail));
+
+  return names == reads;
+}
+
+/// tests that evaluating \ref rule in a boolean context throws, also after
+///   adaptive ordering had a chance to reorder the operands.
+bool matchesThrows(const bjsn::value &rule, const bjsn::value &dat) {
+  jsonlogic::logic_options opts;
+
+  opts.adaptive_order = true;
+
+  jsonlogic::logic_details logic = jsonlogic::create_logic(rule, opts);
+  jsonlogic::variable_accessor vars = jsonlogic::data_accessor(dat);
+
+  for (int i = 0; i < 2048; ++i) {
+    try {
+      jsonlogic::matches(logic.synatx_tree(), vars);
+      return false;
+    } catch (...) {
+    }
+  }
+
+  try {
+    jsonlogic::matches(rule, dat);
+  } catch (...) {
+    return true;
+  }
+
+  return false;
+}
+
+#if WITH_JSON_LOGIC_CPP_PROFILER
+/// evaluates \ref rule under a profiler
+bool profileAgrees(const bjsn::value &rule, const bjsn::value &dat,
+                   jsonlogic::any_expr &res) {
+  jsonlogic::logic_details logic = jsonlogic::create_logic(rule);
+  jsonlogic::profiler prof{logic};
+  jsonlogic::any_expr other =
+      jsonlogic::apply(logic.synatx_tree(), jsonlogic::data_accessor(dat));
+
+  // an operator at the root is evaluated exactly once
+  const std::uint64_t expected = rule.is_object() ? 1 : 0;
+
+  return sameResult(res, other) && prof.total().evaluations == expected;
+}
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
+
 int main(int argc, const char **argv) {
   constexpr bool MATCH = false;
 
@@ -142,6 +463,74 @@ int main(int argc, const char **argv) {
   try {
     jsonlogic::any_expr res = jsonlogic::apply(rule, dat);
 
+    // cross-check the boolean evaluation path
+    if (hasTruthValue(res) &&
+        jsonlogic::truthy(res) != jsonlogic::matches(rule, dat)) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "matches and truthy(apply) disagree" << std::endl;
+    }
+
+    if (!snapshotAgrees(rule, dat, res)) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "rule loaded from snapshot disagrees" << std::endl;
+    }
+
+    if (!corruptSnapshotsRejected(rule)) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "corrupted snapshot was not rejected" << std::endl;
+    }
+
+    if (!cacheAgrees(rule, dat, res)) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "cached rule disagrees" << std::endl;
+    }
+
+    if (!incrementalAgrees(rule, dat, res)) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "incremental evaluation disagrees" << std::endl;
+    }
+
+    if (!traceAgrees(rule, dat, res)) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "traced evaluation disagrees" << std::endl;
+    }
+
+    if (hasTruthValue(res) && !adaptiveAgrees(rule, dat, res)) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "adaptively ordered evaluation disagrees" << std::endl;
+    }
+
+    if (const bjsn::value *reads = allobj.if_contains("adaptive_reads");
+        reads && !adaptiveReadsAgree(rule, dat, reads->as_array())) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "adaptive order was not learned" << std::endl;
+    }
+
+#if WITH_JSON_LOGIC_CPP_PROFILER
+    if (!profileAgrees(rule, dat, res)) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "profiled evaluation disagrees" << std::endl;
+    }
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
+
     if (verbose)
       std::cerr << res << std::endl;
 
@@ -154,7 +543,7 @@ int main(int argc, const char **argv) {
 
       if (verbose)
         std::cerr << allobj["expected"] << std::endl;
-    } else if (hasExpected) {
+    } else if (hasExpected && (errorCode == 0)) {
       std::stringstream expStream;
       std::stringstream resStream;
 
@@ -162,6 +551,20 @@ int main(int argc, const char **argv) {
       resStream << res;
       errorCode = expStream.str() != resStream.str();
 
+      // cross-check the direct serialization paths
+      std::string resText;
+
+      jsonlogic::serialize(res, resText);
+
+      if (bjsn::serialize(bjsn::parse(resText)) != expStream.str() ||
+          bjsn::serialize(jsonlogic::to_json(res)) != resStream.str()) {
+        errorCode = 1;
+
+        if (verbose)
+          std::cerr << "serialize or to_json disagree: " << resText
+                    << std::endl;
+      }
+
       if (verbose && errorCode)
         std::cerr << "test failed: "
                   << "\n  exp: " << expStream.str()
@@ -176,6 +579,14 @@ int main(int argc, const char **argv) {
     if (verbose)
       std::cerr << "caught error: " << ex.what() << std::endl;
 
+    // operand reordering must not hide errors
+    if (!matchesThrows(rule, dat)) {
+      errorCode = 1;
+
+      if (verbose)
+        std::cerr << "matches did not throw" << std::endl;
+    }
+
     if (genExpected)
       allobj.erase("expected");
     else if (hasExpected)
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory>
 
 namespace jsonlogic {
@@ -14,6 +15,13 @@ struct expr {
 
   virtual void accept(visitor &) = 0;
 
+  /// nodes are allocated from the scratch arena of an active
+  ///   evaluation_context, or from the heap otherwise.
+  /// \{
+  static void *operator new(std::size_t sz);
+  static void operator delete(void *p) noexcept;
+  /// \}
+
 private:
   expr(expr &&) = delete;
   expr(const expr &) = delete;
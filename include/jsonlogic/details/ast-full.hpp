@@ -1,5 +1,10 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include <boost/json.hpp>
 
 #include "ast-core.hpp"
@@ -39,6 +44,18 @@ struct oper : expr, private std::vector<any_expr> {
   expr &operand(int n) const;
 
   virtual int num_evaluated_operands() const;
+
+  enum : std::uint32_t { NO_MEMO_SLOT = std::uint32_t(-1) };
+
+  /// the position of the node's result in the memo of an incremental
+  ///   evaluator, or NO_MEMO_SLOT if it is recomputed in every evaluation
+  /// \{
+  std::uint32_t memo_slot() const { return memoslot; }
+  void memo_slot(std::uint32_t slot) { memoslot = slot; }
+  /// \}
+
+private:
+  std::uint32_t memoslot = NO_MEMO_SLOT;
 };
 
 // defines operators that have an upper bound on how many
@@ -116,17 +133,67 @@ struct logical_not_not : oper_n<1> {
 };
 
 // n-ary
-struct logical_and : oper {
+/// observed outcomes and costs of the operands of and and or
+struct operand_statistics;
+
+/// the common base of and and or
+/// \details
+///   in a boolean context, where the deciding operand's value is not
+///   observable, the operands are tested in test_order, or in the order
+///   maintained by the operand statistics if present.
+struct logical_nary : oper {
+  logical_nary();
+  ~logical_nary();
+
+  /// the positions of the operands in the order they are tested;
+  ///   empty if they are tested from left to right.
+  const std::vector<std::uint32_t> &test_order() const { return order; }
+  void test_order(std::vector<std::uint32_t> ord) { order = std::move(ord); }
+
+  /// the statistics of adaptive ordering, or nullptr
+  operand_statistics *statistics() const { return stats.get(); }
+  void statistics(std::unique_ptr<operand_statistics> s);
+
+private:
+  std::vector<std::uint32_t> order;
+  std::unique_ptr<operand_statistics> stats;
+};
+
+struct logical_and : logical_nary {
   void accept(visitor &) final;
 };
 
-struct logical_or : oper {
+/// an index that selects among conditions comparing a common subject
+///   with distinct constants
+struct equality_dispatch;
+
+struct logical_or : logical_nary {
+  logical_or();
+  ~logical_or();
+
   void accept(visitor &) final;
+
+  /// the index over the operands, or nullptr
+  const equality_dispatch *dispatch() const { return index.get(); }
+  void dispatch(std::unique_ptr<equality_dispatch> idx);
+
+private:
+  std::unique_ptr<equality_dispatch> index;
 };
 
 // control structure
 struct if_expr : oper {
+  if_expr();
+  ~if_expr();
+
   void accept(visitor &) final;
+
+  /// the index over the conditions, or nullptr
+  const equality_dispatch *dispatch() const { return index.get(); }
+  void dispatch(std::unique_ptr<equality_dispatch> idx);
+
+private:
+  std::unique_ptr<equality_dispatch> index;
 };
 
 // n-ary arithmetic
@@ -191,7 +258,22 @@ struct map : oper_n<2> {
 };
 
 struct reduce : oper_n<3> {
+  /// how the body reads the variables current and accumulator
+  enum binding : unsigned {
+    copies = 0,            ///< each read copies the variable
+    moves_current = 1,     ///< current is read at most once
+    moves_accumulator = 2, ///< accumulator is read at most once
+    folds = 4 ///< the body is {op:[accumulator, current]} (or reversed),
+              ///  where op is one of +, *, min, max
+  };
+
   void accept(visitor &) final;
+
+  void bindings(unsigned val) { binds = val; }
+  unsigned bindings() const { return binds; }
+
+private:
+  unsigned binds = copies;
 };
 
 struct filter : oper_n<2> {
@@ -294,30 +376,73 @@ struct real_value : value_generic<double> {
   void accept(visitor &) final;
 };
 
+/// the numeric interpretation of a string literal
+struct numeric_string;
+
 struct string_value : value_generic<boost::json::string> {
   using base = value_generic<boost::json::string>;
-  using base::base;
+
+  explicit string_value(boost::json::string str);
+  ~string_value();
 
   void accept(visitor &) final;
-};
 
-struct object_value : expr, private std::map<boost::json::string, any_expr> {
-  using base = std::map<boost::json::string, any_expr>;
-  using base::base;
+  /// the numeric interpretation of a literal that is compared with or
+  ///   added to numbers, or nullptr
+  const numeric_string *number() const { return num.get(); }
+  void number(std::unique_ptr<numeric_string> conv);
 
+private:
+  std::unique_ptr<numeric_string> num;
+};
+
+/// an object value
+/// \details
+///   members are stored in a vector sorted by key. Objects with more than
+///   HASH_THRESHOLD members in addition maintain an open-addressing
+///   hash index, so that lookups do not need to search the vector.
+struct object_value : expr {
+  using value_type = std::pair<boost::json::string, any_expr>;
+  using container_type = std::vector<value_type>;
+  using iterator = container_type::iterator;
+  using const_iterator = container_type::const_iterator;
+
+  enum { HASH_THRESHOLD = 16 };
+
+  object_value() = default;
   ~object_value() = default;
 
-  using base::begin;
-  using base::const_iterator;
-  using base::end;
-  using base::find;
-  using base::insert;
-  using base::iterator;
-  using base::value_type;
+  iterator begin() { return elems.begin(); }
+  iterator end() { return elems.end(); }
+  const_iterator begin() const { return elems.begin(); }
+  const_iterator end() const { return elems.end(); }
+  std::size_t size() const { return elems.size(); }
+
+  /// returns the member with key \p key, or end() if none exists
+  /// \{
+  iterator find(boost::json::string_view key);
+  const_iterator find(boost::json::string_view key) const;
+  /// \}
 
-  base &elements() { return *this; }
+  /// inserts \p el, unless a member with the same key exists
+  std::pair<iterator, bool> insert(value_type el);
+
+  /// replaces all members with \p members
+  /// \pre the keys in members are unique
+  void set_elements(container_type &&members);
+
+  const container_type &elements() const { return elems; }
 
   void accept(visitor &) final;
+
+private:
+  container_type elems;
+  std::vector<std::uint32_t> index; ///< 0 is empty, otherwise position+1
+
+  std::size_t lower_bound(boost::json::string_view key) const;
+  std::size_t lookup(boost::json::string_view key) const;
+  void build_index();
+  void index_member(std::size_t pos);
 };
 
 // logger
@@ -325,6 +450,19 @@ struct log : oper_n<1> {
   void accept(visitor &) final;
 };
 
+/// wraps an occurrence of a pure subexpression that appears several times
+///   in a rule. Occurrences with the same slot compute the same value,
+///   which is evaluated at most once per evaluation.
+struct shared_subexpr : oper_n<1> {
+  void accept(visitor &) final;
+
+  void slot(int val) { idx = val; }
+  int slot() const { return idx; }
+
+private:
+  int idx = 0;
+};
+
 // error node
 struct error : expr {
   void accept(visitor &) final;
@@ -377,6 +515,7 @@ struct visitor {
   virtual void visit(missing &) = 0;
   virtual void visit(missing_some &) = 0;
   virtual void visit(log &) = 0;
+  virtual void visit(shared_subexpr &) = 0;
 
   // control structure
   virtual void visit(if_expr &) = 0;
@@ -459,6 +598,7 @@ struct generic_dispatcher : visitor {
   void visit(missing &n) final { res = apply(n, &n); }
   void visit(missing_some &n) final { res = apply(n, &n); }
   void visit(log &n) final { res = apply(n, &n); }
+  void visit(shared_subexpr &n) final { res = apply(n, &n); }
 
   // control structure
   void visit(if_expr &n) final { res = apply(n, &n); }
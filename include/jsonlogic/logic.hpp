@@ -1,6 +1,15 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <boost/json.hpp>
 
 #include "details/ast-core.hpp"
@@ -48,6 +57,181 @@ struct logic_details
 ///   on variables inside the jsonlogic expression.
 logic_details create_logic(boost::json::value n);
 
+/// options that change how a rule is compiled
+struct logic_options {
+  /// compiles log operations into their operand, so that evaluating
+  ///   the rule neither formats nor writes log output.
+  bool strip_log = false;
+
+  /// lets and and or test their operands in order of estimated cost and
+  ///   selectivity, where only their truthiness is used (e.g., in
+  ///   matches). The value returned by apply is not affected.
+  bool reorder_operands = true;
+
+  /// samples the outcome and evaluation time of the operands of and and
+  ///   or in boolean contexts, and periodically reorders them so that
+  ///   cheap operands that usually decide are tested first.
+  /// \details
+  ///    the statistics are shared by all threads that evaluate the rule.
+  ///    Applies to and and or with at most 16 operands.
+  bool adaptive_order = false;
+};
+
+/// interprets the json object \ref n as a jsonlogic expression
+///   according to \ref opts.
+logic_details create_logic(boost::json::value n, const logic_options &opts);
+
+/// makes \ref alias an alternative name for the operator \ref name
+/// \param  alias a name that is not a built-in operator
+/// \param  name  a built-in or previously registered operator
+/// \throw  std::logic_error if \ref alias is a built-in operator, or if
+///         \ref name is unknown
+/// \details
+///    built-in operators are resolved through a compile-time perfect hash,
+///    registered aliases are checked when that lookup fails.
+void register_operator_alias(boost::json::string_view alias,
+                             boost::json::string_view name);
+
+/// returns the names of the built-in operators, in dispatch table order
+/// \details
+///    registered aliases are not included.
+std::vector<boost::json::string_view> builtin_operator_names();
+
+/// statistics collected when a rule is compiled
+struct compile_statistics {
+  /// time to compile the rule
+  std::chrono::nanoseconds time{};
+
+  /// estimated memory used by the syntax tree and the variable names
+  std::size_t bytes = 0;
+
+  /// the exception thrown by the compilation, if the rule is invalid
+  std::exception_ptr error;
+};
+
+/// compiles the \ref num rules starting at \ref rules in parallel
+/// \param  rules       the first rule
+/// \param  num         number of rules
+/// \param  stats       if not nullptr, receives compile statistics per rule
+/// \param  num_threads number of threads; 0 uses the hardware concurrency
+/// \return the compiled rules, in the same order as \ref rules
+/// \details
+///    a rule that cannot be compiled results in an empty syntax tree.
+///    The error is reported through \ref stats.
+std::vector<logic_details>
+create_logic(const boost::json::value *rules, std::size_t num,
+             std::vector<compile_statistics> *stats = nullptr,
+             unsigned num_threads = 0);
+
+//
+// API to store and load compiled rules
+
+/// writes \ref num compiled rules to \ref os in a binary snapshot format
+/// \details
+///    a snapshot stores the syntax trees together with the variable names
+///    and the variable slot numbers, so loading it neither parses json
+///    nor resolves operator names. Rules with an empty syntax tree
+///    (e.g., rules that failed in bulk compilation) are preserved as such.
+///    Snapshots are only portable across platforms with the same byte
+///    order.
+void write_snapshot(std::ostream &os, const logic_details *rules,
+                    std::size_t num);
+
+/// a read-only view of a snapshot
+/// \details
+///    the snapshot's version and checksum are validated on construction.
+///    Rules are accessed randomly through an offset table, and each
+///    rule is rebuilt in a single pass over the snapshot data.
+struct snapshot {
+  /// memory-maps the snapshot file \ref filename
+  /// \throw std::runtime_error if the file cannot be mapped or is invalid
+  explicit snapshot(const std::string &filename);
+
+  /// uses the snapshot in \ref data
+  /// \pre   \ref data outlives this object
+  /// \throw std::runtime_error if the data is not a valid snapshot
+  snapshot(const char *data, std::size_t len);
+
+  ~snapshot();
+
+  /// returns the number of rules
+  std::size_t size() const { return num; }
+
+  /// rebuilds the rule at position \ref idx
+  /// \throw std::runtime_error if the rule data is inconsistent, or if the
+  ///        syntax tree is nested more than 1024 levels deep
+  logic_details rule(std::size_t idx) const;
+
+  /// rebuilds all rules
+  /// \throw std::runtime_error if any rule cannot be rebuilt
+  std::vector<logic_details> rules() const;
+
+private:
+  const char *base = nullptr;
+  std::size_t sz = 0;
+  bool mapped = false;
+  std::size_t num = 0;
+  const char *index = nullptr; ///< offsets of the rules
+
+  void validate();
+
+  snapshot(const snapshot &) = delete;
+  snapshot &operator=(const snapshot &) = delete;
+};
+
+/// a thread-safe, size-bounded cache of compiled rules
+/// \details
+///    rules are keyed by a structural hash of their json representation.
+///    The cache is divided by hash into independently locked shards, each
+///    with an equal share of the memory limit. When the estimated memory
+///    of the rules in a shard exceeds its share, the least recently used
+///    rules of the shard are evicted.
+struct rule_cache {
+  /// counters and memory use of a cache
+  struct statistics {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t bytes = 0; ///< estimated memory of the cached entries
+  };
+
+  /// creates a cache that uses at most \ref max_bytes
+  explicit rule_cache(std::size_t max_bytes = std::size_t(16) << 20);
+  ~rule_cache();
+
+  /// returns the compiled rule for \ref rule
+  /// \details
+  ///    compiles \ref rule on a miss. A rule whose size exceeds the share
+  ///    of its shard is compiled but not cached.
+  /// \throw the exceptions of create_logic
+  std::shared_ptr<const logic_details> get(const boost::json::value &rule);
+
+  /// returns the current statistics
+  statistics stats() const;
+
+  /// sets the memory limit, evicting entries as needed
+  void max_bytes(std::size_t limit);
+  std::size_t max_bytes() const;
+
+  /// removes all entries; does not reset the counters
+  void clear();
+
+private:
+  struct impl;
+
+  std::unique_ptr<impl> pimpl;
+
+  rule_cache(const rule_cache &) = delete;
+  rule_cache &operator=(const rule_cache &) = delete;
+};
+
+/// sets the cache used by apply(rule, data) and matches(rule, data)
+/// \param cache the rule cache; nullptr disables caching (the default)
+/// \details
+///    the previous cache is released once no running call uses it.
+void use_rule_cache(std::shared_ptr<rule_cache> cache);
+
 //
 // API to evaluate/apply an expression
 
@@ -63,6 +247,32 @@ logic_details create_logic(boost::json::value n);
 using variable_accessor =
     std::function<any_expr(const boost::json::value &, int)>;
 
+/// Type for a callback function to test whether variables exist in the
+///   context, without retrieving their values
+/// \param  keys  json values describing the variables; elements that do
+///                not describe a variable are passed as null
+/// \param  num   the number of keys
+/// \param  found an array of num elements; found[i] is set to true if the
+///                variable keys[i] exists, and to false otherwise
+using variable_probe =
+    std::function<void(const boost::json::value *, std::size_t, bool *)>;
+
+/// a variable accessor that also answers existence queries
+/// \details
+///    a probing_accessor can be passed wherever a variable_accessor is
+///    expected. missing and missing_some test all of their variables
+///    with a single call to probe. Other accessors are tested by
+///    retrieving each variable, where a variable exists unless the
+///    accessor throws.
+struct probing_accessor {
+  variable_accessor lookup;
+  variable_probe probe;
+
+  any_expr operator()(const boost::json::value &key, int idx) const {
+    return lookup(key, idx);
+  }
+};
+
 /// evaluates \ref exp and uses \ref vars to query variables from
 ///   the context.
 /// \param  exp  a jsonlogic expression
@@ -76,6 +286,304 @@ any_expr apply(const any_expr &exp, const variable_accessor &vars);
 any_expr apply(const any_expr &exp);
 /// \}
 
+/// an evaluation context owns a scratch arena for temporary values
+/// \details
+///    expression nodes and strings that are created while an expression
+///    is evaluated within the context are allocated from a monotonic
+///    arena. The arena is released wholesale by release(), typically
+///    after each record.
+///    A context must not be used by multiple threads at the same time.
+struct evaluation_context {
+  /// \param initial_size the size of the first arena block
+  explicit evaluation_context(std::size_t initial_size = 4096);
+
+  /// frees all memory allocated since the last release
+  /// \pre no values allocated from the arena are referenced
+  void release();
+
+  /// returns the storage of the arena
+  boost::json::storage_ptr storage();
+
+private:
+  boost::json::monotonic_resource arena;
+
+  evaluation_context(const evaluation_context &) = delete;
+  evaluation_context &operator=(const evaluation_context &) = delete;
+};
+
+/// describes where the result of an evaluation within an
+///   evaluation_context is allocated.
+enum class result_storage {
+  heap, ///< the result is copied out of the arena
+  arena ///< the result remains valid until the context is released
+};
+
+/// evaluates \ref exp within the scratch arena of \ref ctx
+/// \param  exp     a jsonlogic expression
+/// \param  vars    a variable accessor to retrieve variables from the context
+/// \param  ctx     the evaluation context providing the scratch arena
+/// \param  storage the location of the result value
+/// \return a jsonlogic value
+any_expr apply(const any_expr &exp, const variable_accessor &vars,
+               evaluation_context &ctx,
+               result_storage storage = result_storage::heap);
+
+/// evaluates a rule repeatedly on a record that changes between evaluations
+/// \details
+///    the evaluator keeps the results of the operator nodes (except for
+///    var) from the previous evaluation, together with the variable slots
+///    each subtree depends on. After some variables are reported as
+///    changed, only the nodes on the paths from those variables to the
+///    root are recomputed, and unaffected subtrees reuse their cached
+///    results.
+///    Subtrees that use computed variable names, missing, missing_some,
+///    or log are recomputed in every evaluation.
+struct incremental_evaluator {
+  /// \pre \ref logic outlives this object
+  explicit incremental_evaluator(const logic_details &logic);
+  ~incremental_evaluator();
+
+  /// evaluates the rule, reusing the results that are still valid
+  /// \param vars the variable accessor; slot numbers refer to
+  ///        logic.variable_names().
+  any_expr evaluate(const variable_accessor &vars);
+
+  /// reports that the variable with slot number \ref slot changed
+  void changed(int slot);
+
+  /// reports that the variable \ref name changed
+  /// \details
+  ///    a change of "a" also affects "a.b" and vice versa.
+  void changed(boost::json::string_view name);
+
+  /// discards all cached results
+  void invalidate();
+
+  /// returns the number of memoized nodes recomputed and reused by the
+  ///   last evaluation
+  /// \{
+  std::size_t recomputed() const;
+  std::size_t reused() const;
+  /// \}
+
+private:
+  struct impl;
+
+  std::unique_ptr<impl> pimpl;
+
+  incremental_evaluator(const incremental_evaluator &) = delete;
+  incremental_evaluator &operator=(const incremental_evaluator &) = delete;
+};
+
+#if WITH_JSON_LOGIC_CPP_PROFILER
+/// records per-node statistics of all evaluations of a rule
+/// \details
+///    while a profiler exists, evaluations of its rule on the constructing
+///    thread are profiled, regardless of the function used (apply, matches,
+///    incremental_evaluator). Profilers nest; the innermost is active.
+///    Available when the library and its users are compiled with
+///    WITH_JSON_LOGIC_CPP_PROFILER; otherwise the evaluator contains no
+///    profiling code.
+struct profiler {
+  /// statistics of a single operator node
+  struct counters {
+    std::uint64_t evaluations = 0;
+    std::chrono::nanoseconds inclusive{}; ///< including operands
+    std::chrono::nanoseconds exclusive{}; ///< excluding operands
+    std::uint64_t allocations = 0; ///< nodes created, excluding operands
+    std::uint64_t exceptions = 0;  ///< thrown or caught by the node
+  };
+
+  /// \pre \ref logic outlives this object
+  explicit profiler(const logic_details &logic);
+  ~profiler();
+
+  /// returns a copy of the rule, where each operator object has an
+  ///   additional member "profile" holding its counters.
+  boost::json::value annotated() const;
+
+  /// writes the exclusive time in nanoseconds per call path in the
+  ///   folded stack format of flame graph tools.
+  void write_folded(std::ostream &os) const;
+
+  /// returns the counters of the root node
+  counters total() const;
+
+  /// resets all counters
+  void reset();
+
+  struct impl;
+
+private:
+  std::unique_ptr<impl> pimpl;
+
+  profiler(const profiler &) = delete;
+  profiler &operator=(const profiler &) = delete;
+};
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
+
+//
+// tracing
+
+/// the kinds of events that the evaluator reports to a trace sink
+enum class trace_event : std::uint8_t {
+  enter,        ///< the evaluation of a node starts
+  exit,         ///< the evaluation of a node ends; carries the result
+  variable,     ///< a variable was read; carries the resolved value
+  short_circuit ///< and, or, if decided; detail is the deciding operand
+};
+
+/// the type of the value carried by a trace record
+enum class trace_value : std::uint8_t {
+  none, ///< no value (e.g., enter, or exit by exception)
+  null,
+  boolean,
+  integer,
+  unsigned_integer,
+  real,
+  string,
+  array,
+  object
+};
+
+/// a fixed size binary trace record
+struct trace_record {
+  std::uint64_t time; ///< steady clock time in nanoseconds
+  const void *node;   ///< identifies the expression node
+  trace_event event;
+  trace_value type;
+  std::uint16_t length; ///< number of characters stored in text
+  std::int32_t detail;  ///< the variable slot, or the deciding operand
+
+  union {
+    bool boolean;
+    std::int64_t integer;
+    std::uint64_t unsigned_integer;
+    double real;
+    std::uint64_t size; ///< size of strings, arrays, and objects
+  } value;
+
+  char text[32]; ///< prefix of a string value, not zero-terminated
+};
+
+/// receives the events of traced evaluations
+/// \details
+///    record is called on the evaluating thread.
+struct trace_sink {
+  virtual ~trace_sink() = default;
+  virtual void record(const trace_record &rec) = 0;
+};
+
+/// a trace sink that stores records in lock-free per-thread ring buffers
+/// \details
+///    each evaluating thread writes to its own buffer without
+///    synchronization with other producers. When a buffer is full,
+///    new records are dropped and counted. drain can be called
+///    concurrently from a consumer thread.
+struct trace_buffer : trace_sink {
+  /// \param capacity the number of records per thread; rounded up to
+  ///        a power of two.
+  explicit trace_buffer(std::size_t capacity = 4096);
+  ~trace_buffer();
+
+  void record(const trace_record &rec) final;
+
+  /// appends all buffered records to \ref out and removes them from
+  ///   the buffers; records of a thread remain in order.
+  /// \return the number of appended records
+  std::size_t drain(std::vector<trace_record> &out);
+
+  /// returns the number of records dropped because a buffer was full
+  std::uint64_t dropped() const;
+
+  struct impl;
+
+private:
+  std::unique_ptr<impl> pimpl;
+
+  trace_buffer(const trace_buffer &) = delete;
+  trace_buffer &operator=(const trace_buffer &) = delete;
+};
+
+/// evaluates \ref exp and reports evaluation events to \ref sink
+/// \param  exp  a jsonlogic expression
+/// \param  vars a variable accessor to retrieve variables from the context
+/// \param  sink the trace sink of a sampled evaluation, or nullptr
+/// \details
+///    the sink is selected per evaluation (e.g., sampled ? &buf : nullptr).
+///    Without a sink, the evaluation is not traced and equals
+///    apply(exp, vars) and matches(exp, vars) respectively.
+/// \{
+any_expr apply(const any_expr &exp, const variable_accessor &vars,
+               trace_sink *sink);
+bool matches(const any_expr &exp, const variable_accessor &vars,
+             trace_sink *sink);
+/// \}
+
+//
+// logging
+
+/// receives the output of log operations
+/// \details
+///    write is called on the evaluating thread, possibly by several
+///    threads at the same time.
+struct log_sink {
+  virtual ~log_sink() = default;
+
+  /// \param line the logged value as json text, without line terminator
+  virtual void write(boost::json::string_view line) = 0;
+};
+
+/// sets the sink of log operations for all evaluations
+/// \param sink the log sink; nullptr restores the default, which writes
+///        each line to std::cerr.
+/// \details
+///    the previous sink is released once no running log operation uses it.
+void use_log_sink(std::shared_ptr<log_sink> sink);
+
+/// options of an async_log_sink
+struct async_log_options {
+  /// a thread hands its buffer to the writer when it exceeds this size
+  std::size_t batch_bytes = std::size_t(64) << 10;
+
+  /// the maximum time a line waits in a buffer
+  std::chrono::milliseconds interval{100};
+
+  /// the number of lines accepted per second; 0 means unlimited
+  std::uint64_t max_lines_per_second = 0;
+};
+
+/// a log sink that collects lines in per-thread buffers and passes them
+///   in batches to a writer, which runs on a background thread.
+/// \details
+///    logging threads do not synchronize with each other. Lines of a
+///    thread remain in order; lines of different threads are not
+///    interleaved within a line. Lines beyond the rate limit are
+///    dropped and counted. The destructor writes all buffered lines.
+struct async_log_sink : log_sink {
+  /// receives a batch of lines, each terminated by a newline
+  using writer = std::function<void(boost::json::string_view batch)>;
+
+  explicit async_log_sink(writer out, async_log_options opts = {});
+  ~async_log_sink();
+
+  void write(boost::json::string_view line) final;
+
+  /// passes all buffered lines to the writer and waits until it returns
+  void flush();
+
+  /// returns the number of lines dropped by the rate limit
+  std::uint64_t dropped() const;
+
+  struct impl;
+
+private:
+  std::unique_ptr<impl> pimpl;
+
+  async_log_sink(const async_log_sink &) = delete;
+  async_log_sink &operator=(const async_log_sink &) = delete;
+};
+
 /// evaluates the rule \ref rule with the provided data \ref data.
 /// \param  rule a jsonlogic expression
 /// \param  data a json object containing data that the jsonlogic expression
@@ -84,10 +592,28 @@ any_expr apply(const any_expr &exp);
 /// \details
 ///    converts rule to a jsonlogic expression and creates a variable_accessor
 ///    to query variables from data, before calling apply() on jsonlogic
-///    expression.
+///    expression. The compiled rule is taken from the rule cache, if one
+///    was set with use_rule_cache().
 any_expr apply(boost::json::value rule, boost::json::value data);
 
+/// evaluates \ref exp in a boolean context and returns its truthiness.
+/// \param  exp  a jsonlogic expression
+/// \param  vars a variable accessor to retrieve variables from the context
+/// \return truthy(apply(exp, vars))
+/// \details
+///    logical operators (and, or, !, !!), conditionals (if), comparisons,
+///    and quantifiers (all, none, some) propagate truthiness directly.
+///    Thus, no result values are materialized for predicate rules.
+bool matches(const any_expr &exp, const variable_accessor &vars);
+
+/// evaluates the rule \ref rule with the provided data \ref data
+///   in a boolean context.
+/// \return truthy(apply(rule, data))
+bool matches(boost::json::value rule, boost::json::value data);
+
 /// creates a variable accessor to access data in \ref data.
+/// \details
+///    the accessor is a probing_accessor.
 variable_accessor data_accessor(boost::json::value data);
 
 //
@@ -103,18 +629,32 @@ any_expr to_expr(std::uint64_t val);
 any_expr to_expr(double val);
 any_expr to_expr(boost::json::string val);
 any_expr to_expr(const boost::json::array &val);
+any_expr to_expr(const boost::json::object &val);
 /// \}
 
 /// creates a value representation for \ref n in jsonlogic form.
-/// \param  n any boost::json type, except for boost::json::object
+/// \param  n any boost::json type
 /// \return a value in jsonlogic form
-/// \throw  an std::logic_error if \ref n contains a boost::json::object
+/// \details
+///    the members of objects are stored and printed in key order,
+///    not in the order of \ref n.
 /// \post   any_expr != nullptr
 any_expr to_expr(const boost::json::value &n);
 
 /// creates a json representation from \ref e
-// \todo ...
-boost::json::value to_json(const any_expr &e);
+/// \param  e  a jsonlogic value
+/// \param  sp the storage used for the json value and its elements
+/// \pre    e must be a value
+boost::json::value to_json(const any_expr &e, boost::json::storage_ptr sp = {});
+
+/// appends a json representation of \ref e to \ref out
+/// \param  e   a jsonlogic value
+/// \param  out a caller provided buffer, which may be reused across calls
+/// \pre    e must be a value
+/// \details
+///    writes the json text directly into \ref out, without constructing
+///    an intermediate boost::json::value or going through iostreams.
+void serialize(const any_expr &e, std::string &out);
 
 /// returns true if \ref el is truthy
 /// \details
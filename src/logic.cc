@@ -1,12 +1,31 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
 #include <exception>
 #include <iostream>
 #include <limits>
+#include <list>
+#include <mutex>
+#include <new>
 #include <numeric>
 #include <regex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <boost/json.hpp>
 
 #include "jsonlogic/details/ast-full.hpp"
@@ -80,12 +99,91 @@ template <class T> T &down_cast(expr &e) {
 
   throw_type_error();
 }
+
+//
+// scratch arena
+
+/// the arena of the evaluation context that is active on this thread
+thread_local json::memory_resource *scratch_arena = nullptr;
+
+/// redirects allocations of expression nodes and strings to \p arena
+///   for the lifetime of the scope object.
+/// \details a nullptr arena suspends an outer scope.
+struct scratch_scope {
+  explicit scratch_scope(json::memory_resource *arena) : prev(scratch_arena) {
+    scratch_arena = arena;
+  }
+
+  ~scratch_scope() { scratch_arena = prev; }
+
+private:
+  json::memory_resource *prev;
+
+  scratch_scope(const scratch_scope &) = delete;
+  scratch_scope &operator=(const scratch_scope &) = delete;
+};
+
+/// returns the storage for strings created during evaluation
+json::storage_ptr scratch_storage() {
+  if (scratch_arena) {
+    CXX_UNLIKELY;
+    return json::storage_ptr(scratch_arena);
+  }
+
+  return json::storage_ptr();
+}
+
+/// creates a string using the scratch storage
+json::string scratch_string(json::string_view str) {
+  return json::string(str, scratch_storage());
+}
+
+/// nodes on the heap are aligned to NODE_ALIGNMENT; nodes in a scratch
+///   arena are placed ARENA_NODE_OFFSET bytes past such a boundary, so that
+///   their address tells them apart without a header.
+/// \{
+constexpr std::size_t ARENA_NODE_OFFSET = alignof(expr);
+constexpr std::size_t NODE_ALIGNMENT = 2 * ARENA_NODE_OFFSET;
+/// \}
+
+static_assert(alignof(real_value) <= ARENA_NODE_OFFSET &&
+                  alignof(string_value) <= ARENA_NODE_OFFSET &&
+                  alignof(object_value) <= ARENA_NODE_OFFSET &&
+                  alignof(array) <= ARENA_NODE_OFFSET,
+              "expression nodes are aligned as expr");
+
+#if WITH_JSON_LOGIC_CPP_PROFILER
+/// counts the expression nodes created on this thread
+thread_local std::uint64_t node_allocations = 0;
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
 } // namespace
 
 //
 // foundation classes
 // \{
 
+// allocation functions
+void *expr::operator new(std::size_t sz) {
+#if WITH_JSON_LOGIC_CPP_PROFILER
+  ++node_allocations;
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
+
+  if (scratch_arena) {
+    CXX_UNLIKELY;
+    void *mem = scratch_arena->allocate(ARENA_NODE_OFFSET + sz, NODE_ALIGNMENT);
+
+    return static_cast<char *>(mem) + ARENA_NODE_OFFSET;
+  }
+
+  return ::operator new(sz, std::align_val_t{NODE_ALIGNMENT});
+}
+
+void expr::operator delete(void *p) noexcept {
+  // arena memory is released wholesale by the evaluation context
+  if (reinterpret_cast<std::uintptr_t>(p) % NODE_ALIGNMENT == 0)
+    ::operator delete(p, std::align_val_t{NODE_ALIGNMENT});
+}
+
 // accept implementations
 void equal::accept(visitor &v) { v.visit(*this); }
 void strict_equal::accept(visitor &v) { v.visit(*this); }
@@ -121,6 +219,7 @@ void var::accept(visitor &v) { v.visit(*this); }
 void missing::accept(visitor &v) { v.visit(*this); }
 void missing_some::accept(visitor &v) { v.visit(*this); }
 void log::accept(visitor &v) { v.visit(*this); }
+void shared_subexpr::accept(visitor &v) { v.visit(*this); }
 void if_expr::accept(visitor &v) { v.visit(*this); }
 
 void null_value::accept(visitor &v) { v.visit(*this); }
@@ -137,6 +236,174 @@ void error::accept(visitor &v) { v.visit(*this); }
 void regex_match::accept(visitor &v) { v.visit(*this); }
 #endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
 
+// adaptive operand order
+
+/// the outcomes and evaluation times of the operands of an and or or node
+///   observed in sampled evaluations, together with the test order
+///   derived from them.
+/// \details
+///   the test order is packed into a single word (4 bits per position),
+///   so that evaluations read and the reordering thread replaces it
+///   atomically. The counters are updated without locks; concurrent
+///   updates during a reordering may get lost, which only delays
+///   adaptation. Operands that may throw keep their positions, so that
+///   the operands behind them cannot decide the node before they raise
+///   their errors.
+struct operand_statistics {
+  /// the largest number of operands whose order can be packed
+  static constexpr std::size_t MAX_OPERANDS = 16;
+
+  /// a sample is taken every SAMPLE_PERIOD evaluations of the node
+  static constexpr std::uint32_t SAMPLE_PERIOD = 16;
+
+  /// the order is recomputed every REORDER_PERIOD samples
+  static constexpr std::uint64_t REORDER_PERIOD = 64;
+
+  struct counters {
+    std::atomic<std::uint64_t> decisive{0};    ///< decided the node
+    std::atomic<std::uint64_t> nanoseconds{0}; ///< total evaluation time
+  };
+
+  /// \param ord the initial test order; empty for left to right
+  /// \param fixed a bit mask of the operands that keep their positions
+  operand_statistics(std::size_t num, const std::vector<std::uint32_t> &ord,
+                     std::uint32_t fixed)
+      : fixed(fixed), operands(num) {
+    std::uint64_t packed = 0;
+
+    for (std::size_t i = 0; i < num; ++i)
+      packed |= std::uint64_t(ord.empty() ? i : ord[i]) << (4 * i);
+
+    order.store(packed, std::memory_order_relaxed);
+  }
+
+  std::size_t size() const { return operands.size(); }
+
+  /// returns the bit mask of operands that keep their positions
+  std::uint32_t fixed_operands() const { return fixed; }
+
+  /// tests whether operand \p pos keeps its position
+  bool is_fixed(std::size_t pos) const { return (fixed >> pos) & 1; }
+
+  /// returns the packed test order
+  std::uint64_t test_order() const {
+    return order.load(std::memory_order_acquire);
+  }
+
+  /// returns the operand position at index \p i of a packed order
+  static std::uint32_t position(std::uint64_t packed, std::size_t i) {
+    return (packed >> (4 * i)) & 0xf;
+  }
+
+  /// counts an evaluation and returns true if it is to be sampled
+  /// \details
+  ///   each node counts its own evaluations, so that the sampling of a
+  ///   node does not depend on how many other adaptive nodes a rule
+  ///   evaluates in between.
+  bool sample_due() {
+    const std::uint32_t num =
+        evaluations.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    return num % SAMPLE_PERIOD == 0;
+  }
+
+  /// records the outcome of operand \p pos in a sampled evaluation
+  void record(std::size_t pos, bool decided, std::uint64_t ns) {
+    counters &cnt = operands[pos];
+
+    if (decided)
+      cnt.decisive.fetch_add(1, std::memory_order_relaxed);
+
+    cnt.nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  /// completes a sampled evaluation and periodically reorders the operands
+  void completed() {
+    const std::uint64_t num =
+        samples.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    if (num % REORDER_PERIOD == 0)
+      reorder();
+  }
+
+private:
+  /// sorts the operands by time per decision and halves the counters, so
+  ///   that older samples weigh less.
+  void reorder() {
+    const std::size_t num = operands.size();
+    std::array<double, MAX_OPERANDS> rank;
+    std::array<std::uint32_t, MAX_OPERANDS> ord;
+
+    for (std::size_t i = 0; i < num; ++i) {
+      counters &cnt = operands[i];
+      const std::uint64_t decisive = cnt.decisive.load(std::memory_order_relaxed);
+      const std::uint64_t ns = cnt.nanoseconds.load(std::memory_order_relaxed);
+
+      // an operand that never decided is ranked as deciding in 1% of tests
+      rank[i] = double(ns) / std::max(double(decisive), REORDER_PERIOD * 0.01);
+      ord[i] = std::uint32_t(i);
+
+      cnt.decisive.store(decisive / 2, std::memory_order_relaxed);
+      cnt.nanoseconds.store(ns / 2, std::memory_order_relaxed);
+    }
+
+    // sorts the runs between fixed operands
+    for (std::size_t aa = 0; aa < num;) {
+      std::size_t zz = aa;
+
+      while (zz < num && !is_fixed(zz))
+        ++zz;
+
+      std::stable_sort(ord.begin() + aa, ord.begin() + zz,
+                       [&rank](std::uint32_t lhs, std::uint32_t rhs) -> bool {
+                         return rank[lhs] < rank[rhs];
+                       });
+      aa = zz + 1;
+    }
+
+    std::uint64_t packed = 0;
+
+    for (std::size_t i = 0; i < num; ++i)
+      packed |= std::uint64_t(ord[i]) << (4 * i);
+
+    order.store(packed, std::memory_order_release);
+  }
+
+  std::atomic<std::uint64_t> order{0};
+  std::atomic<std::uint32_t> evaluations{0};
+  std::atomic<std::uint64_t> samples{0};
+  const std::uint32_t fixed;
+  std::vector<counters> operands;
+};
+
+logical_nary::logical_nary() = default;
+logical_nary::~logical_nary() = default;
+
+void logical_nary::statistics(std::unique_ptr<operand_statistics> s) {
+  stats = std::move(s);
+}
+
+namespace {
+/// returns the order in which the operands of \p n are currently tested
+std::vector<std::uint32_t> current_test_order(const logical_nary &n) {
+  const operand_statistics *stats = n.statistics();
+
+  if (stats == nullptr)
+    return n.test_order();
+
+  const std::uint64_t packed = stats->test_order();
+  std::vector<std::uint32_t> res;
+
+  for (std::size_t i = 0; i < stats->size(); ++i)
+    res.push_back(operand_statistics::position(packed, i));
+
+  if (std::is_sorted(res.begin(), res.end()))
+    res.clear();
+
+  return res;
+}
+} // namespace
+
 // to_json implementations
 template <class T> json::value value_generic<T>::to_json() const {
   return value();
@@ -144,6 +411,436 @@ template <class T> json::value value_generic<T>::to_json() const {
 
 json::value null_value::to_json() const { return value(); }
 
+// object_value implementation
+namespace {
+std::string_view key_view(json::string_view key) {
+  return {key.data(), key.size()};
+}
+
+std::size_t key_hash(json::string_view key) {
+  return std::hash<std::string_view>{}(key_view(key));
+}
+} // namespace
+
+std::size_t object_value::lower_bound(json::string_view key) const {
+  auto pos = std::lower_bound(
+      elems.begin(), elems.end(), key_view(key),
+      [](const value_type &el, std::string_view k) -> bool {
+        return key_view(el.first) < k;
+      });
+
+  return std::distance(elems.begin(), pos);
+}
+
+std::size_t object_value::lookup(json::string_view key) const {
+  if (index.empty()) {
+    const std::size_t pos = lower_bound(key);
+
+    if ((pos < elems.size()) && (key_view(elems[pos].first) == key_view(key)))
+      return pos;
+
+    return elems.size();
+  }
+
+  const std::size_t mask = index.size() - 1;
+
+  for (std::size_t slot = key_hash(key) & mask; index[slot] != 0;
+       slot = (slot + 1) & mask) {
+    const std::size_t pos = index[slot] - 1;
+
+    if (key_view(elems[pos].first) == key_view(key))
+      return pos;
+  }
+
+  return elems.size();
+}
+
+void object_value::build_index() {
+  index.clear();
+
+  if (elems.size() <= HASH_THRESHOLD)
+    return;
+
+  // keep the load factor at or below 0.5
+  std::size_t capacity = 2 * HASH_THRESHOLD;
+
+  while (capacity < 2 * elems.size())
+    capacity *= 2;
+
+  index.resize(capacity, 0);
+
+  for (std::size_t pos = 0; pos < elems.size(); ++pos)
+    index_member(pos);
+}
+
+void object_value::index_member(std::size_t pos) {
+  const std::size_t mask = index.size() - 1;
+  std::size_t slot = key_hash(elems[pos].first) & mask;
+
+  while (index[slot] != 0)
+    slot = (slot + 1) & mask;
+
+  index[slot] = pos + 1;
+}
+
+object_value::iterator object_value::find(json::string_view key) {
+  return elems.begin() + lookup(key);
+}
+
+object_value::const_iterator object_value::find(json::string_view key) const {
+  return elems.begin() + lookup(key);
+}
+
+std::pair<object_value::iterator, bool> object_value::insert(value_type el) {
+  const std::size_t pos = lower_bound(el.first);
+
+  if ((pos < elems.size()) && (elems[pos].first == el.first))
+    return {elems.begin() + pos, false};
+
+  elems.insert(elems.begin() + pos, std::move(el));
+
+  if (index.empty() || (index.size() < 2 * elems.size())) {
+    // the index is created or grown when it would exceed its load factor
+    build_index();
+  } else {
+    // otherwise, shift the positions behind the new member
+    for (std::uint32_t &entry : index)
+      if (entry > pos)
+        ++entry;
+
+    index_member(pos);
+  }
+
+  return {elems.begin() + pos, true};
+}
+
+void object_value::set_elements(container_type &&members) {
+  elems.swap(members);
+
+  std::sort(elems.begin(), elems.end(),
+            [](const value_type &lhs, const value_type &rhs) -> bool {
+              return key_view(lhs.first) < key_view(rhs.first);
+            });
+
+  build_index();
+}
+
+// equality dispatch
+
+/// an index from the constants of conditions {"==": [subject, constant]}
+///   to the positions of these conditions in an if or or.
+/// \details
+///   all indexed conditions compare the same pure subject with string
+///   constants or with integer constants. A subject of the same type as the
+///   constants selects its condition with a hash lookup. Loose equality
+///   converts subjects of other types, so that they are compared by
+///   evaluating the conditions as written.
+struct equality_dispatch {
+  /// a constant and the position of its condition
+  struct entry {
+    const value_base *key;
+    std::uint32_t pos;
+  };
+
+  /// returned by find if no condition holds
+  static constexpr std::uint32_t NO_MATCH =
+      std::numeric_limits<std::uint32_t>::max();
+
+  /// returned by find if the conditions need to be evaluated
+  static constexpr std::uint32_t UNINDEXED = NO_MATCH - 1;
+
+  /// \param subj    the subject in the first condition
+  /// \param strings true if the constants are string_value, false if they
+  ///        are int_value.
+  /// \param keys    the constants in condition order
+  equality_dispatch(expr &subj, bool strings, const std::vector<entry> &keys);
+
+  /// the subject, which is evaluated once to select a condition
+  expr &subject() const { return *subjexpr; }
+
+  /// returns the position of the first condition that holds for the value
+  ///   \p val of the subject, NO_MATCH, or UNINDEXED.
+  std::uint32_t find(expr &val) const;
+
+private:
+  expr *subjexpr;
+  bool strings; ///< the constants are strings, otherwise integers
+  std::vector<entry> slots; ///< open addressing; key is nullptr if empty
+
+  json::string_view string_key(const value_base &key) const {
+    return static_cast<const string_value &>(key).value();
+  }
+
+  std::int64_t integer_key(const value_base &key) const {
+    return static_cast<const int_value &>(key).value();
+  }
+
+  /// returns the position of the first entry with hash \p h whose key
+  ///   satisfies \p pred, or NO_MATCH.
+  template <class predicate_t>
+  std::uint32_t probe(std::size_t h, predicate_t pred) const;
+};
+
+equality_dispatch::equality_dispatch(expr &subj, bool strs,
+                                     const std::vector<entry> &keys)
+    : subjexpr(&subj), strings(strs) {
+  // keep the load factor at or below 0.5
+  std::size_t capacity = 8;
+
+  while (capacity < 2 * keys.size())
+    capacity *= 2;
+
+  slots.resize(capacity, entry{nullptr, 0});
+
+  for (const entry &el : keys) {
+    const std::size_t h =
+        strings ? key_hash(string_key(*el.key))
+                : std::hash<std::int64_t>{}(integer_key(*el.key));
+    auto sameKey = [this, &el](const value_base &other) -> bool {
+      return strings ? string_key(other) == string_key(*el.key)
+                     : integer_key(other) == integer_key(*el.key);
+    };
+
+    // a repeated constant never selects its later condition
+    if (probe(h, sameKey) != NO_MATCH)
+      continue;
+
+    std::size_t slot = h & (capacity - 1);
+
+    while (slots[slot].key)
+      slot = (slot + 1) & (capacity - 1);
+
+    slots[slot] = el;
+  }
+}
+
+template <class predicate_t>
+std::uint32_t equality_dispatch::probe(std::size_t h, predicate_t pred) const {
+  const std::size_t mask = slots.size() - 1;
+
+  for (std::size_t slot = h & mask; slots[slot].key; slot = (slot + 1) & mask)
+    if (pred(*slots[slot].key))
+      return slots[slot].pos;
+
+  return NO_MATCH;
+}
+
+std::uint32_t equality_dispatch::find(expr &val) const {
+  if (strings) {
+    string_value *str = may_down_cast<string_value>(val);
+
+    if (str == nullptr)
+      return UNINDEXED;
+
+    return probe(key_hash(str->value()),
+                 [this, str](const value_base &key) -> bool {
+                   return string_key(key) == str->value();
+                 });
+  }
+
+  std::int64_t num = 0;
+
+  if (int_value *ival = may_down_cast<int_value>(val)) {
+    num = ival->value();
+  } else if (unsigned_int_value *uval = may_down_cast<unsigned_int_value>(val);
+             uval && uval->value() <= std::uint64_t(
+                         std::numeric_limits<std::int64_t>::max())) {
+    num = uval->value();
+  } else {
+    return UNINDEXED;
+  }
+
+  return probe(std::hash<std::int64_t>{}(num),
+               [this, num](const value_base &key) -> bool {
+                 return integer_key(key) == num;
+               });
+}
+
+logical_or::logical_or() = default;
+logical_or::~logical_or() = default;
+
+void logical_or::dispatch(std::unique_ptr<equality_dispatch> idx) {
+  index = std::move(idx);
+}
+
+if_expr::if_expr() = default;
+if_expr::~if_expr() = default;
+
+void if_expr::dispatch(std::unique_ptr<equality_dispatch> idx) {
+  index = std::move(idx);
+}
+
+// numeric strings
+
+namespace {
+/// the outcome of converting a string to a number
+enum class number_parse { ok, invalid, out_of_range };
+
+/// returns the first character after leading whitespace
+const char *skip_space(const char *first, const char *last) {
+  while (first != last &&
+         (*first == ' ' || (*first >= '\t' && *first <= '\r')))
+    ++first;
+
+  return first;
+}
+
+number_parse parse_status(std::errc ec) {
+  if (ec == std::errc{})
+    return number_parse::ok;
+
+  if (ec == std::errc::result_out_of_range)
+    return number_parse::out_of_range;
+
+  return number_parse::invalid;
+}
+
+bool hex_digit(const char *pos, const char *last) {
+  return pos < last && std::isxdigit(static_cast<unsigned char>(*pos));
+}
+
+/// converts the number at the start of \p str to \p res
+/// \details
+///    accepts what std::stoll, std::stoull, and std::stod accept in the
+///    "C" locale: leading whitespace, a sign, and trailing characters
+///    that are not part of the number. std::stoull negates negative
+///    numbers, std::stod rejects subnormal results. Parsing stops at the
+///    first null character, as it does for a C string.
+/// \{
+number_parse parse_number(json::string_view str, std::int64_t &res) {
+  const char *last = str.data() + str.size();
+  const char *first = skip_space(str.data(), last);
+
+  // from_chars accepts a minus sign, but no plus sign
+  if (first != last && *first == '+') {
+    ++first;
+
+    if (first != last && *first == '-')
+      return number_parse::invalid;
+  }
+
+  return parse_status(std::from_chars(first, last, res).ec);
+}
+
+number_parse parse_number(json::string_view str, std::uint64_t &res) {
+  const char *last = str.data() + str.size();
+  const char *first = skip_space(str.data(), last);
+  const bool negative = (first != last && *first == '-');
+
+  if (first != last && (*first == '+' || *first == '-'))
+    ++first;
+
+  const number_parse status = parse_status(std::from_chars(first, last, res).ec);
+
+  if (negative)
+    res = -res;
+
+  return status;
+}
+
+number_parse parse_number(json::string_view str, double &res) {
+  const char *last = str.data() + str.size();
+  const char *first = skip_space(str.data(), last);
+  const bool negative = (first != last && *first == '-');
+
+  if (first != last && (*first == '+' || *first == '-'))
+    ++first;
+
+  if (first != last && (*first == '+' || *first == '-'))
+    return number_parse::invalid;
+
+  std::from_chars_result num{first, std::errc::invalid_argument};
+
+  // hexadecimal floating point numbers, e.g., 0x1.8p3
+  if (last - first > 2 && first[0] == '0' &&
+      (first[1] == 'x' || first[1] == 'X') &&
+      (hex_digit(first + 2, last) ||
+       (first[2] == '.' && hex_digit(first + 3, last)))) {
+    CXX_UNLIKELY;
+    num = std::from_chars(first + 2, last, res, std::chars_format::hex);
+  }
+
+  if (num.ec == std::errc::invalid_argument)
+    num = std::from_chars(first, last, res);
+
+  if (num.ec == std::errc{} && std::fpclassify(res) == FP_SUBNORMAL)
+    return number_parse::out_of_range;
+
+  if (negative)
+    res = -res;
+
+  return parse_status(num.ec);
+}
+/// \}
+
+/// reports a failed conversion as std::stoll and friends do
+CXX_NORETURN
+void throw_number_error(number_parse status) {
+  if (status == number_parse::out_of_range)
+    throw std::out_of_range{"jsonlogic - number out of range"};
+
+  throw std::invalid_argument{"jsonlogic - not a number"};
+}
+
+/// returns the number at the start of \p str
+/// \throws std::invalid_argument or std::out_of_range
+template <class T> T parse_number(json::string_view str) {
+  T res{};
+
+  if (const number_parse status = parse_number(str, res);
+      status != number_parse::ok) {
+    CXX_UNLIKELY;
+    throw_number_error(status);
+  }
+
+  return res;
+}
+} // namespace
+
+/// the numeric interpretations of a string literal, converted once
+///   when the rule is compiled.
+/// \details
+///    a conversion that fails is reported by as() as parse_number
+///    would report it.
+struct numeric_string {
+  explicit numeric_string(json::string_view str)
+      : ival(), uval(), dval(), istatus(parse_number(str, ival)),
+        ustatus(parse_number(str, uval)), dstatus(parse_number(str, dval)) {}
+
+  /// returns the interpretation as number of the type of the argument
+  /// \{
+  std::int64_t as(const std::int64_t &) const { return checked(ival, istatus); }
+  std::uint64_t as(const std::uint64_t &) const {
+    return checked(uval, ustatus);
+  }
+  double as(const double &) const { return checked(dval, dstatus); }
+  /// \}
+
+private:
+  std::int64_t ival;
+  std::uint64_t uval;
+  double dval;
+  number_parse istatus;
+  number_parse ustatus;
+  number_parse dstatus;
+
+  template <class T> static T checked(T val, number_parse status) {
+    if (status != number_parse::ok) {
+      CXX_UNLIKELY;
+      throw_number_error(status);
+    }
+
+    return val;
+  }
+};
+
+string_value::string_value(json::string str) : base(std::move(str)) {}
+string_value::~string_value() = default;
+
+void string_value::number(std::unique_ptr<numeric_string> conv) {
+  num = std::move(conv);
+}
+
 // num_evaluated_operands implementations
 int oper::num_evaluated_operands() const { return size(); }
 
@@ -187,6 +884,7 @@ struct forwarding_visitor : visitor {
   void visit(missing &n) override { visit(up_cast<oper>(n)); }
   void visit(missing_some &n) override { visit(up_cast<oper>(n)); }
   void visit(log &n) override { visit(up_cast<oper>(n)); }
+  void visit(shared_subexpr &n) override { visit(up_cast<oper>(n)); }
 
   void visit(if_expr &n) override { visit(up_cast<expr>(n)); }
 
@@ -217,7 +915,8 @@ struct variable_map {
   bool hasComputedVariables() const { return hasComputed; }
 
 private:
-  using container_type = std::map<json::string, int>;
+  // keys refer to the names stored in the var nodes
+  using container_type = std::unordered_map<std::string_view, int>;
 
   container_type mapping = {};
   bool hasComputed = false;
@@ -225,8 +924,8 @@ private:
 
 void variable_map::insert(var &var) {
   try {
-    any_expr &arg = var.back();
-    string_value &str = down_cast<string_value>(*arg);
+    // the first operand names the variable, a second one is its default
+    string_value &str = down_cast<string_value>(var.operand(0));
     const bool comp = (str.value().find('.') != json::string::npos &&
                        str.value().find('[') != json::string::npos);
 
@@ -235,7 +934,9 @@ void variable_map::insert(var &var) {
     } else if (str.value() !=
                "") // do nothing for free variables membership "lambdas"
     {
-      auto [pos, success] = mapping.emplace(str.value(), mapping.size());
+      const json::string &name = str.value();
+      auto [pos, success] = mapping.emplace(
+          std::string_view{name.data(), name.size()}, mapping.size());
 
       var.num(pos->second);
     }
@@ -250,19 +951,21 @@ std::vector<json::string> variable_map::to_vector() const {
   res.resize(mapping.size());
 
   for (const container_type::value_type &el : mapping)
-    res.at(el.second) = el.first;
+    res.at(el.second) = json::string(el.first.data(), el.first.size());
 
   return res;
 }
 
 /// translates all children
 /// \{
-oper::container_type translate_children(json::array &children, variable_map &);
+oper::container_type translate_children(const json::array &children,
+                                        variable_map &);
 
-oper::container_type translate_children(json::value &n, variable_map &);
+oper::container_type translate_children(const json::value &n, variable_map &);
 /// \}
 
-template <class ExprT> ExprT &mkOperator_(json::object &n, variable_map &m) {
+template <class ExprT>
+ExprT &mkOperator_(const json::object &n, variable_map &m) {
   assert(n.size() == 1);
 
   ExprT &res = deref(new ExprT);
@@ -271,18 +974,19 @@ template <class ExprT> ExprT &mkOperator_(json::object &n, variable_map &m) {
   return res;
 }
 
-template <class ExprT> expr &mk_operator(json::object &n, variable_map &m) {
+template <class ExprT>
+expr &mk_operator(const json::object &n, variable_map &m) {
   return mkOperator_<ExprT>(n, m);
 }
 
-expr &mk_variable(json::object &n, variable_map &m) {
+expr &mk_variable(const json::object &n, variable_map &m) {
   var &v = mkOperator_<var>(n, m);
 
   m.insert(v);
   return v;
 }
 
-array &mk_array(json::array &children, variable_map &m) {
+array &mk_array(const json::array &children, variable_map &m) {
   array &res = deref(new array);
 
   res.set_operands(translate_children(children, m));
@@ -295,19 +999,14 @@ template <class value_t> value_t &mk_value(typename value_t::value_type n) {
 
 null_value &mk_null_value() { return deref(new null_value); }
 
-using dispatch_table =
-    std::map<json::string, expr &(*)(json::object &, variable_map &)>;
+using operator_builder = expr &(*)(const json::object &, variable_map &);
 
-dispatch_table::const_iterator lookup(const dispatch_table &m,
-                                      const json::object &op) {
-  if (op.size() != 1)
-    return m.end();
-
-  return m.find(op.begin()->key());
-}
+struct operator_entry {
+  std::string_view name;
+  operator_builder build = nullptr;
+};
 
-any_expr translate_internal(json::value n, variable_map &varmap) {
-  static const dispatch_table dt = {
+constexpr operator_entry builtin_operators[] = {
     {"==", &mk_operator<equal>},
     {"===", &mk_operator<strict_equal>},
     {"!=", &mk_operator<not_equal>},
@@ -345,24 +1044,140 @@ any_expr translate_internal(json::value n, variable_map &varmap) {
     /// extensions
     {"regex", &mk_operator<regex_match>},
 #endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
-  };
+};
 
-  expr *res = nullptr;
+constexpr std::size_t OPERATOR_TABLE_SIZE = 128;
 
-  switch (n.kind()) {
-  case json::kind::object: {
-    json::object &obj = n.get_object();
-    dispatch_table::const_iterator pos = lookup(dt, obj);
+static_assert(std::size(builtin_operators) <= OPERATOR_TABLE_SIZE / 3,
+              "increase OPERATOR_TABLE_SIZE");
 
-    if (pos != dt.end()) {
-      CXX_LIKELY;
-      res = &pos->second(obj, varmap);
-    } else {
-      // does jsonlogic support value objects?
-      unsupported();
-    }
+/// hashes the length and the first, middle, and last character of \p name
+constexpr std::size_t operator_hash(std::string_view name,
+                                    std::uint32_t seed) {
+  constexpr std::uint32_t prime = 0x01000193;
 
-    break;
+  std::uint32_t h = seed ^ std::uint32_t(name.size());
+
+  if (!name.empty()) {
+    h = (h * prime) ^ std::uint8_t(name.front());
+    h = (h * prime) ^ std::uint8_t(name[name.size() / 2]);
+    h = (h * prime) ^ std::uint8_t(name.back());
+  }
+
+  return (h ^ (h >> 15)) % OPERATOR_TABLE_SIZE;
+}
+
+constexpr bool is_perfect_hash(std::uint32_t seed) {
+  bool used[OPERATOR_TABLE_SIZE] = {};
+
+  for (const operator_entry &op : builtin_operators) {
+    const std::size_t slot = operator_hash(op.name, seed);
+
+    if (used[slot])
+      return false;
+
+    used[slot] = true;
+  }
+
+  return true;
+}
+
+constexpr std::uint32_t MAX_OPERATOR_SEED = 1 << 12;
+
+constexpr std::uint32_t find_operator_seed() {
+  std::uint32_t seed = 0;
+
+  while ((seed < MAX_OPERATOR_SEED) && !is_perfect_hash(seed))
+    ++seed;
+
+  return seed;
+}
+
+constexpr std::uint32_t OPERATOR_SEED = find_operator_seed();
+
+static_assert(OPERATOR_SEED < MAX_OPERATOR_SEED,
+              "no collision free hash for the built-in operators");
+
+using operator_table = std::array<operator_entry, OPERATOR_TABLE_SIZE>;
+
+constexpr operator_table make_operator_table() {
+  operator_table res{};
+
+  for (const operator_entry &op : builtin_operators)
+    res[operator_hash(op.name, OPERATOR_SEED)] = op;
+
+  return res;
+}
+
+constexpr operator_table builtin_operator_table = make_operator_table();
+
+/// operators registered at runtime
+struct registered_operators {
+  std::shared_mutex guard;
+  std::unordered_map<std::string, operator_builder> builders;
+  std::atomic<bool> empty = true;
+};
+
+registered_operators &runtime_operators() {
+  static registered_operators ops;
+
+  return ops;
+}
+
+operator_builder find_builtin_operator(std::string_view name) {
+  const operator_entry &entry =
+      builtin_operator_table[operator_hash(name, OPERATOR_SEED)];
+
+  if (entry.name == name) {
+    CXX_LIKELY;
+    return entry.build;
+  }
+
+  return nullptr;
+}
+
+operator_builder find_operator(json::string_view opname) {
+  const std::string_view name{opname.data(), opname.size()};
+
+  if (operator_builder builtin = find_builtin_operator(name)) {
+    CXX_LIKELY;
+    return builtin;
+  }
+
+  registered_operators &ops = runtime_operators();
+
+  if (ops.empty.load(std::memory_order_acquire))
+    return nullptr;
+
+  std::shared_lock lock{ops.guard};
+  auto pos = ops.builders.find(std::string{name});
+
+  return pos != ops.builders.end() ? pos->second : nullptr;
+}
+
+operator_builder lookup(const json::object &op) {
+  if (op.size() != 1)
+    return nullptr;
+
+  return find_operator(op.begin()->key());
+}
+
+any_expr translate_internal(const json::value &n, variable_map &varmap) {
+  expr *res = nullptr;
+
+  switch (n.kind()) {
+  case json::kind::object: {
+    const json::object &obj = n.get_object();
+
+    if (operator_builder build = lookup(obj)) {
+      CXX_LIKELY;
+      res = &build(obj, varmap);
+    } else {
+      // does jsonlogic support value objects?
+      unsupported();
+    }
+
+    break;
   }
 
   case json::kind::array: {
@@ -372,7 +1187,7 @@ any_expr translate_internal(json::value n, variable_map &varmap) {
   }
 
   case json::kind::string: {
-    res = &mk_value<string_value>(std::move(n.get_string()));
+    res = &mk_value<string_value>(n.get_string());
     break;
   }
 
@@ -408,20 +1223,21 @@ any_expr translate_internal(json::value n, variable_map &varmap) {
   return any_expr(res);
 }
 
-oper::container_type translate_children(json::array &children,
+oper::container_type translate_children(const json::array &children,
                                         variable_map &varmap) {
   oper::container_type res;
 
   res.reserve(children.size());
 
-  for (json::value &elem : children)
+  for (const json::value &elem : children)
     res.emplace_back(translate_internal(elem, varmap));
 
   return res;
 }
 
-oper::container_type translate_children(json::value &n, variable_map &varmap) {
-  if (json::array *arr = n.if_array()) {
+oper::container_type translate_children(const json::value &n,
+                                        variable_map &varmap) {
+  if (const json::array *arr = n.if_array()) {
     CXX_LIKELY;
     return translate_children(*arr, varmap);
   }
@@ -431,2225 +1247,5927 @@ oper::container_type translate_children(json::value &n, variable_map &varmap) {
   res.emplace_back(translate_internal(n, varmap));
   return res;
 }
-} // namespace
-
-logic_details create_logic(json::value n) {
-  variable_map varmap;
-  any_expr node = translate_internal(std::move(n), varmap);
-  bool hasComputedVariables = varmap.hasComputedVariables();
 
-  return {std::move(node), varmap.to_vector(), hasComputedVariables};
-}
+/// wraps duplicated pure subexpressions in shared_subexpr nodes
+void share_common_subexpressions(any_expr &root);
 
-//
-// to value_base conversion
+/// indexes the conditions of \p n, if they compare a common subject with
+///   distinct constants.
+/// \{
+void index_equality_ladder(if_expr &n);
+void index_equality_ladder(logical_or &n);
+/// \}
 
-any_expr to_expr(std::nullptr_t) { return any_expr(new null_value); }
-any_expr to_expr(bool val) { return any_expr(new bool_value(val)); }
-any_expr to_expr(std::int64_t val) { return any_expr(new int_value(val)); }
-any_expr to_expr(std::uint64_t val) {
-  return any_expr(new unsigned_int_value(val));
-}
-any_expr to_expr(double val) { return any_expr(new real_value(val)); }
-any_expr to_expr(json::string val) {
-  return any_expr(new string_value(std::move(val)));
-}
+/// indexes the if and or nodes in the rule that select among equality tests
+void index_equality_ladders(any_expr &root);
 
-any_expr to_expr(const json::array &val) {
-  oper::container_type elems;
+/// attaches numeric interpretations to the string literals among the
+///   operands of \p n, if \p n compares or combines numbers.
+void convert_numeric_literals(oper &n);
 
-  std::transform(val.begin(), val.end(), std::back_inserter(elems),
-                 [](const json::value &el) -> any_expr { return to_expr(el); });
+/// converts the string literals in the rule that meet numbers
+void convert_numeric_literals(any_expr &root);
 
-  array &arr = deref(new array);
+/// determines how the body of \p n reads the variables current and
+///   accumulator.
+void bind_reduction_variables(reduce &n);
 
-  arr.set_operands(std::move(elems));
-  return any_expr(&arr);
-}
+/// binds the variables of the reductions in the rule
+void bind_reduction_variables(any_expr &root);
 
-any_expr to_expr(const json::value &n) {
-  any_expr res;
+/// sets the test order of the and and or nodes in the rule, and attaches
+///   operand statistics if \p opts asks for adaptive ordering.
+void order_logical_operands(any_expr &root, const logic_options &opts);
 
-  switch (n.kind()) {
-  case json::kind::string: {
-    res = to_expr(n.get_string());
-    break;
-  }
+/// numbers the operator nodes in the rule whose results an incremental
+///   evaluator keeps between evaluations.
+void number_memoized_nodes(any_expr &root);
 
-  case json::kind::int64: {
-    res = to_expr(n.get_int64());
-    break;
-  }
+/// replaces log operations by their operand
+void strip_log_operations(any_expr &n) {
+  oper *op = may_down_cast<oper>(deref(n.get()));
 
-  case json::kind::uint64: {
-    res = to_expr(n.get_uint64());
-    break;
-  }
+  if (op == nullptr)
+    return;
 
-  case json::kind::double_: {
-    res = to_expr(n.get_double());
-    break;
-  }
+  for (any_expr &sub : op->operands())
+    strip_log_operations(sub);
 
-  case json::kind::bool_: {
-    res = to_expr(n.get_bool());
-    break;
-  }
+  if (may_down_cast<log>(*op) && op->size() == 1) {
+    any_expr arg = std::move(op->operands().front());
 
-  case json::kind::null: {
-    res = to_expr(nullptr);
-    break;
+    n = std::move(arg);
   }
+}
 
-  case json::kind::array: {
-    res = to_expr(n.get_array());
-    break;
-  }
+logic_details translate_rule(const json::value &n,
+                             const logic_options &opts = {}) {
+  // the syntax tree must not be allocated in a scratch arena
+  scratch_scope heap{nullptr};
+  variable_map varmap;
+  any_expr node = translate_internal(n, varmap);
 
-  default:
-    unsupported();
-  }
+  if (opts.strip_log)
+    strip_log_operations(node);
 
-  assert(res.get());
-  return res;
-}
+  share_common_subexpressions(node);
+  index_equality_ladders(node);
+  convert_numeric_literals(node);
+  bind_reduction_variables(node);
 
-namespace {
+  if (opts.reorder_operands || opts.adaptive_order)
+    order_logical_operands(node, opts);
 
-//
-// coercion functions
+  number_memoized_nodes(node);
 
-struct internal_coercion_error {};
-struct not_int64_error : internal_coercion_error {};
-struct not_uint64_error : internal_coercion_error {};
-struct unpacked_array_req : internal_coercion_error {};
+  bool hasComputedVariables = varmap.hasComputedVariables();
 
-/// conversion to int64
-/// \{
-inline std::int64_t to_concrete(std::int64_t v, const std::int64_t &) {
-  return v;
-}
-inline std::int64_t to_concrete(const json::string &str, const std::int64_t &) {
-  return std::stoll(std::string{str.c_str()});
-}
-inline std::int64_t to_concrete(double v, const std::int64_t &) { return v; }
-inline std::int64_t to_concrete(bool v, const std::int64_t &) { return v; }
-inline std::int64_t to_concrete(std::nullptr_t, const std::int64_t &) {
-  return 0;
+  return {std::move(node), varmap.to_vector(), hasComputedVariables};
 }
 
-inline std::int64_t to_concrete(std::uint64_t v, const std::int64_t &) {
-  if (v > std::uint64_t(std::numeric_limits<std::int64_t>::max())) {
-    CXX_UNLIKELY;
-    throw not_int64_error{};
+/// returns the allocated size of a node
+struct node_size {
+  template <class expr_t> std::size_t operator()(expr_t &node) const {
+    return sizeof(node);
   }
+};
 
-  return v;
-}
-/// \}
+/// estimates the memory used by the subtree rooted in \p n
+std::size_t memory_footprint(expr &n) {
+  // strings up to this size are stored in the string object
+  constexpr std::size_t small_string = sizeof(json::string);
 
-/// conversion to uint64
-/// \{
-inline std::uint64_t to_concrete(std::uint64_t v, const std::uint64_t &) {
-  return v;
-}
-inline std::uint64_t to_concrete(const json::string &str,
-                                 const std::uint64_t &) {
-  return std::stoull(std::string{str.c_str()});
-}
-inline std::uint64_t to_concrete(double v, const std::uint64_t &) { return v; }
-inline std::uint64_t to_concrete(bool v, const std::uint64_t &) { return v; }
-inline std::uint64_t to_concrete(std::nullptr_t, const std::uint64_t &) {
-  return 0;
-}
+  std::size_t res = generic_visit(node_size{}, &n);
 
-inline std::uint64_t to_concrete(std::int64_t v, const std::uint64_t &) {
-  if (v < 0) {
-    CXX_UNLIKELY;
-    throw not_uint64_error{};
+  if (oper *op = may_down_cast<oper>(n)) {
+    res += op->operands().capacity() * sizeof(any_expr);
+
+    if (logical_nary *logop = may_down_cast<logical_nary>(n)) {
+      res += logop->test_order().capacity() * sizeof(std::uint32_t);
+
+      if (operand_statistics *stats = logop->statistics())
+        res += sizeof(operand_statistics) +
+               stats->size() * sizeof(operand_statistics::counters);
+    }
+
+    for (any_expr &sub : op->operands())
+      res += memory_footprint(deref(sub));
+  } else if (string_value *str = may_down_cast<string_value>(n)) {
+    if (str->value().capacity() >= small_string)
+      res += str->value().capacity() + 1;
+
+    if (str->number())
+      res += sizeof(numeric_string);
   }
 
-  return v;
+  return res;
 }
-/// \}
+} // namespace
 
-/// conversion to double
-/// \{
-inline double to_concrete(const json::string &str, const double &) {
-  return std::stod(std::string{str.c_str()});
-}
-inline double to_concrete(std::int64_t v, const double &) { return v; }
-inline double to_concrete(std::uint64_t v, const double &) { return v; }
-inline double to_concrete(double v, const double &) { return v; }
-inline double to_concrete(bool v, const double &) { return v; }
-inline double to_concrete(std::nullptr_t, const double &) { return 0; }
-/// \}
+logic_details create_logic(json::value n) { return translate_rule(n); }
 
-/// conversion to string
-/// \{
-template <class Val>
-inline json::string to_concrete(Val v, const json::string &) {
-  return json::string{std::to_string(v)};
+logic_details create_logic(json::value n, const logic_options &opts) {
+  return translate_rule(n, opts);
 }
 
-inline json::string to_concrete(bool v, const json::string &) {
-  return json::string{v ? "true" : "false"};
-}
-inline json::string to_concrete(const json::string &s, const json::string &) {
-  return s;
-}
-inline json::string to_concrete(std::nullptr_t, const json::string &) {
-  return json::string{"null"};
-}
-/// \}
+void register_operator_alias(json::string_view alias, json::string_view name) {
+  const std::string_view key{alias.data(), alias.size()};
 
-/// conversion to boolean
-///   implements truthy, falsy as described by https://jsonlogic.com/truthy.html
-/// \{
-inline bool to_concrete(bool v, const bool &) { return v; }
-inline bool to_concrete(std::int64_t v, const bool &) { return v; }
-inline bool to_concrete(std::uint64_t v, const bool &) { return v; }
-inline bool to_concrete(double v, const bool &) { return v; }
-inline bool to_concrete(const json::string &v, const bool &) {
-  return v.size() != 0;
+  if (find_builtin_operator(key))
+    throw std::logic_error{"jsonlogic - cannot redefine a built-in operator"};
+
+  operator_builder build = find_operator(name);
+
+  if (build == nullptr)
+    throw std::logic_error{"jsonlogic - unknown operator"};
+
+  registered_operators &ops = runtime_operators();
+  std::unique_lock lock{ops.guard};
+
+  ops.builders[std::string{key}] = build;
+  ops.empty.store(false, std::memory_order_release);
 }
-inline bool to_concrete(std::nullptr_t, const bool &) { return false; }
 
-// \todo logical_not sure if conversions from arrays to values should be
-// supported like this
-inline bool to_concrete(const array &v, const bool &) {
-  return v.num_evaluated_operands();
+std::vector<json::string_view> builtin_operator_names() {
+  std::vector<json::string_view> res;
+
+  res.reserve(std::size(builtin_operators));
+
+  for (const operator_entry &op : builtin_operators)
+    res.emplace_back(op.name.data(), op.name.size());
+
+  return res;
 }
-/// \}
 
-struct comparison_operator_base {
-  enum {
-    defined_for_string = true,
-    defined_for_real = true,
-    defined_for_integer = true,
-    defined_for_boolean = true,
-    defined_for_null = true,
-    defined_for_array = true
-  };
+//
+// bulk compilation
 
-  using result_type = bool;
-};
+std::vector<logic_details>
+create_logic(const json::value *rules, std::size_t num,
+             std::vector<compile_statistics> *stats, unsigned num_threads) {
+  std::vector<logic_details> res(num);
+  std::atomic<std::size_t> next{0};
 
-/// \brief a strict equality operator operates on operands of the same
-///        type. The operation on two different types returns false.
-///        NO type coercion is performed.
-struct strict_equality_operator : comparison_operator_base {
-  std::tuple<bool, bool> coerce(array *, array *) {
-    return {true, false}; // arrays are never equal
+  if (stats) {
+    stats->clear();
+    stats->resize(num);
   }
 
-  template <class LhsT, class RhsT>
-  std::tuple<LhsT, RhsT> coerce(LhsT *lv, RhsT *rv) {
-    return {std::move(*lv), std::move(*rv)};
-  }
+  auto compile = [&]() -> void {
+    for (std::size_t i = next++; i < num; i = next++) {
+      using clock = std::chrono::steady_clock;
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
-                                                    std::nullptr_t) {
-    return {nullptr, nullptr}; // two null pointers are equal
-  }
+      const clock::time_point start = clock::now();
+      std::exception_ptr error;
 
-  template <class LhsT>
-  std::tuple<LhsT, std::nullptr_t> coerce(LhsT *lv, std::nullptr_t) {
-    return {std::move(*lv), nullptr};
-  }
+      try {
+        res[i] = translate_rule(rules[i]);
+      } catch (...) {
+        error = std::current_exception();
+      }
 
-  template <class RhsT>
-  std::tuple<std::nullptr_t, RhsT> coerce(std::nullptr_t, RhsT *rv) {
-    return {nullptr, std::move(*rv)};
-  }
-};
+      if (stats) {
+        compile_statistics &stat = (*stats)[i];
 
-struct numeric_binary_operator_base {
-  std::tuple<double, double> coerce(double *lv, double *rv) {
-    return {*lv, *rv};
-  }
+        stat.time = clock::now() - start;
+        stat.error = std::move(error);
 
-  std::tuple<double, double> coerce(double *lv, std::int64_t *rv) {
-    return {*lv, to_concrete(*rv, *lv)};
-  }
+        if (!stat.error) {
+          const logic_details &logic = res[i];
 
-  std::tuple<double, double> coerce(double *lv, std::uint64_t *rv) {
-    return {*lv, to_concrete(*rv, *lv)};
-  }
+          stat.bytes = memory_footprint(deref(logic.synatx_tree().get()));
 
-  std::tuple<double, double> coerce(std::int64_t *lv, double *rv) {
-    return {to_concrete(*lv, *rv), *rv};
-  }
+          for (const json::string &name : logic.variable_names())
+            stat.bytes += sizeof(name) + name.capacity();
+        }
+      }
+    }
+  };
 
-  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv,
-                                                std::int64_t *rv) {
-    return {*lv, *rv};
-  }
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
 
-  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv,
-                                                std::uint64_t *rv) {
-    return {*lv, to_concrete(*rv, *lv)};
-  }
+  num_threads = std::min<std::size_t>(num_threads, num);
 
-  std::tuple<double, double> coerce(std::uint64_t *lv, double *rv) {
-    return {to_concrete(*lv, *rv), *rv};
-  }
+  std::vector<std::thread> workers;
 
-  std::tuple<std::int64_t, std::int64_t> coerce(std::uint64_t *lv,
-                                                std::int64_t *rv) {
-    return {to_concrete(*lv, *rv), *rv};
-  }
+  // the calling thread participates in the compilation
+  for (unsigned i = 1; i < num_threads; ++i)
+    workers.emplace_back(compile);
 
-  std::tuple<std::uint64_t, std::uint64_t> coerce(std::uint64_t *lv,
-                                                  std::uint64_t *rv) {
-    return {*lv, *rv};
-  }
-};
+  compile();
 
-/// \brief an equality operator compares two values. if_expr the
-///        values have a different type, type coercion is performed
-///        on one of the operands.
-struct relational_operator_base : numeric_binary_operator_base {
-  using numeric_binary_operator_base::coerce;
+  for (std::thread &worker : workers)
+    worker.join();
 
-  std::tuple<double, double> coerce(double *lv, json::string *rv) {
-    return {*lv, to_concrete(*rv, *lv)};
-  }
+  return res;
+}
 
-  std::tuple<double, double> coerce(double *lv, bool *rv) {
-    return {*lv, to_concrete(*rv, *lv)};
-  }
+//
+// snapshots
 
-  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv,
-                                                json::string *rv) {
-    return {*lv, to_concrete(*rv, *lv)};
-  }
+namespace {
 
-  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv, bool *rv) {
-    return {*lv, to_concrete(*rv, *lv)};
-  }
+/// node types in snapshots; the tag of a type is its position + 1
+/// \note types must only be appended, otherwise SNAPSHOT_VERSION changes
+using snapshot_node_types =
+    std::tuple<equal, strict_equal, not_equal, strict_not_equal, less,
+               greater, less_or_equal, greater_or_equal, logical_and,
+               logical_or, logical_not, logical_not_not, if_expr, add,
+               subtract, multiply, divide, modulo, min, max, map, reduce,
+               filter, all, none, some, array, merge, cat, substr, membership,
+               var, missing, missing_some, log, null_value, bool_value,
+               int_value, unsigned_int_value, real_value, string_value,
+               object_value, error, shared_subexpr
+#if WITH_JSON_LOGIC_CPP_EXTENSIONS
+               ,
+               regex_match
+#endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
+               >;
 
-  std::tuple<std::uint64_t, std::uint64_t> coerce(std::uint64_t *lv,
-                                                  json::string *rv) {
-    return {*lv, to_concrete(*rv, *lv)};
-  }
+constexpr char SNAPSHOT_MAGIC[8] = {'J', 'S', 'N', 'L', 'O', 'G', 'I', 'C'};
+constexpr std::uint32_t SNAPSHOT_VERSION = 3;
+constexpr std::uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
 
-  std::tuple<std::uint64_t, std::uint64_t> coerce(std::uint64_t *lv, bool *rv) {
-    return {*lv, to_concrete(*rv, *lv)};
-  }
+/// tag of an empty syntax tree (i.e., a rule that failed to compile)
+constexpr std::uint8_t EMPTY_TREE_TAG = 0;
 
-  std::tuple<double, double> coerce(json::string *lv, double *rv) {
-    return {to_concrete(*lv, *rv), *rv};
-  }
+/// maximum nesting depth of syntax trees loaded from a snapshot
+constexpr unsigned MAX_SNAPSHOT_DEPTH = 1024;
 
-  std::tuple<double, double> coerce(bool *lv, double *rv) {
-    return {to_concrete(*lv, *rv), *rv};
-  }
+struct snapshot_header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint64_t payload_size;
+  std::uint64_t checksum;
+};
 
-  std::tuple<std::int64_t, std::int64_t> coerce(json::string *lv,
-                                                std::int64_t *rv) {
-    return {to_concrete(*lv, *rv), *rv};
-  }
+/// FNV-1a hash of the snapshot payload
+std::uint64_t snapshot_checksum(const char *data, std::size_t len) {
+  std::uint64_t h = 0xcbf29ce484222325;
 
-  std::tuple<std::int64_t, std::int64_t> coerce(bool *lv, std::int64_t *rv) {
-    return {to_concrete(*lv, *rv), *rv};
-  }
+  for (const char *lim = data + len; data != lim; ++data)
+    h = (h ^ std::uint8_t(*data)) * 0x100000001b3;
 
-  std::tuple<std::uint64_t, std::uint64_t> coerce(json::string *lv,
-                                                  std::uint64_t *rv) {
-    return {to_concrete(*lv, *rv), *rv};
-  }
+  return h;
+}
 
-  std::tuple<std::uint64_t, std::uint64_t> coerce(bool *lv, std::uint64_t *rv) {
-    return {to_concrete(*lv, *rv), *rv};
-  }
+template <class T, class... node_types>
+constexpr std::uint8_t node_tag(std::tuple<node_types...> *) {
+  constexpr bool same[] = {std::is_same<T, node_types>::value...};
 
-  std::tuple<bool, bool> coerce(json::string *, bool *rv) {
-    // strings and boolean are never equal
-    return {!*rv, *rv};
-  }
+  for (std::size_t i = 0; i < sizeof...(node_types); ++i)
+    if (same[i])
+      return i + 1;
 
-  std::tuple<bool, bool> coerce(bool *lv, json::string *) {
-    // strings and boolean are never equal
-    return {*lv, !*lv};
+  return EMPTY_TREE_TAG;
+}
+
+template <class T> constexpr std::uint8_t node_tag() {
+  constexpr std::uint8_t tag =
+      node_tag<T>(static_cast<snapshot_node_types *>(nullptr));
+
+  static_assert(tag != EMPTY_TREE_TAG, "node type missing in snapshots");
+  return tag;
+}
+
+struct snapshot_writer {
+  std::string *out;
+
+  template <class T> void put(const T &val) const {
+    out->append(reinterpret_cast<const char *>(&val), sizeof(val));
   }
 
-  std::tuple<json::string, json::string> coerce(json::string *lv,
-                                                json::string *rv) {
-    return {std::move(*lv), std::move(*rv)};
+  void put(json::string_view str) const {
+    put(std::uint32_t(str.size()));
+    out->append(str.data(), str.size());
   }
 
-  std::tuple<bool, bool> coerce(bool *lv, bool *rv) { return {*lv, *rv}; }
-};
+  void put_node(const any_expr &n) const {
+    if (!n) {
+      put(EMPTY_TREE_TAG);
+      return;
+    }
 
-struct equality_operator : relational_operator_base, comparison_operator_base {
-  using relational_operator_base::coerce;
+    generic_visit(*this, n.get());
+  }
 
-  // due to special conversion rules, the coercion function may just produce
-  //   the result instead of just unpacking and coercing values.
+  template <class expr_t> bool operator()(expr_t &n) const {
+    put(node_tag<expr_t>());
 
-  std::tuple<bool, bool> coerce(array *, array *) {
-    return {true, false}; // arrays are never equal
-  }
+    if constexpr (std::is_base_of<oper, expr_t>::value) {
+      if constexpr (std::is_same<expr_t, var>::value)
+        put(std::int32_t(n.num()));
 
-  template <class T> std::tuple<bool, bool> coerce(T *lv, array *rv) {
-    // an array may be compared to a value_base
-    //   (1) *lv == arr[0], iff the array has exactly one element
-    if (rv->num_evaluated_operands() == 1)
-      throw unpacked_array_req{};
+      if constexpr (std::is_same<expr_t, shared_subexpr>::value)
+        put(std::int32_t(n.slot()));
 
-    //   (2) or if [] and *lv converts to false
-    if (rv->num_evaluated_operands() > 1)
-      return {false, true};
+      if constexpr (std::is_base_of<logical_nary, expr_t>::value) {
+        // an adaptively learned order is stored as the static order
+        const std::vector<std::uint32_t> order = current_test_order(n);
 
-    const bool convToFalse = to_concrete(*lv, false) == false;
+        put(std::uint32_t(order.size()));
 
-    return {convToFalse, true /* zero elements */};
-  }
+        for (std::uint32_t pos : order)
+          put(pos);
+      }
 
-  template <class T> std::tuple<bool, bool> coerce(array *lv, T *rv) {
-    // see comments membership coerce(T*,array*)
-    if (lv->num_evaluated_operands() == 1)
-      throw unpacked_array_req{};
+      put(std::uint32_t(n.size()));
 
-    if (lv->num_evaluated_operands() > 1)
-      return {false, true};
+      for (const any_expr &sub : n.operands())
+        put_node(sub);
+    } else if constexpr (std::is_same<expr_t, object_value>::value) {
+      put(std::uint32_t(n.size()));
 
-    const bool convToFalse = to_concrete(*rv, false) == false;
+      for (const object_value::value_type &el : n) {
+        put(json::string_view(el.first));
+        put_node(el.second);
+      }
+    } else if constexpr (std::is_same<expr_t, string_value>::value) {
+      put(json::string_view(n.value()));
+    } else if constexpr (std::is_same<expr_t, bool_value>::value) {
+      put(std::uint8_t(n.value()));
+    } else if constexpr (std::is_base_of<value_base, expr_t>::value &&
+                         !std::is_same<expr_t, null_value>::value) {
+      put(n.value());
+    }
 
-    return {true /* zero elements */, convToFalse};
+    return true;
   }
+};
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
-                                                    std::nullptr_t) {
-    return {nullptr, nullptr}; // two null pointers are equal
-  }
+struct snapshot_reader {
+  const char *pos;
+  const char *lim;
+  unsigned depth = 0;
+  std::int32_t num_shared = 0; ///< shared_subexpr nodes of the rule
+  std::int32_t max_slot = -1;  ///< largest slot of the rule
 
-  template <class T> std::tuple<bool, bool> coerce(T *, std::nullptr_t) {
-    return {false, true}; // null pointer is only equal to itself
+  CXX_NORETURN
+  static void corrupted() {
+    throw std::runtime_error{"jsonlogic - corrupted snapshot"};
   }
 
-  template <class T> std::tuple<bool, bool> coerce(std::nullptr_t, T *) {
-    return {true, false}; // null pointer is only equal to itself
+  template <class T> T get() {
+    T res;
+
+    if (std::size_t(lim - pos) < sizeof(res))
+      corrupted();
+
+    std::memcpy(&res, pos, sizeof(res));
+    pos += sizeof(res);
+    return res;
   }
 
-  std::tuple<bool, bool> coerce(array *, std::nullptr_t) {
-    return {true, false}; // null pointer is only equal to itself
+  json::string_view get_string() {
+    const std::uint32_t len = get<std::uint32_t>();
+
+    if (std::size_t(lim - pos) < len)
+      corrupted();
+
+    json::string_view res{pos, len};
+
+    pos += len;
+    return res;
   }
 
-  std::tuple<bool, bool> coerce(std::nullptr_t, array *) {
-    return {true, false}; // null pointer is only equal to itself
+  /// reads the number of items that follow
+  /// \param minsize the minimal encoded size of an item
+  std::uint32_t get_count(std::size_t minsize) {
+    const std::uint32_t num = get<std::uint32_t>();
+
+    if (std::size_t(lim - pos) / minsize < num)
+      corrupted();
+
+    return num;
   }
+
+  any_expr get_node();
 };
 
-struct relational_operator : relational_operator_base,
-                             comparison_operator_base {
-  using relational_operator_base::coerce;
+template <class expr_t> any_expr decode_node(snapshot_reader &rd) {
+  if constexpr (std::is_base_of<oper, expr_t>::value) {
+    int num = var::computed;
 
-  std::tuple<array *, array *> coerce(array *lv, array *rv) { return {lv, rv}; }
+    if constexpr (std::is_same<expr_t, var>::value ||
+                  std::is_same<expr_t, shared_subexpr>::value)
+      num = rd.get<std::int32_t>();
 
-  template <class T> std::tuple<bool, bool> coerce(T *lv, array *rv) {
-    // an array may be equal to another value_base if
-    //   (1) *lv == arr[0], iff the array has exactly one element
-    if (rv->num_evaluated_operands() == 1)
-      throw unpacked_array_req{};
+    // slots index the results of an evaluation; see read_rule
+    if constexpr (std::is_same<expr_t, shared_subexpr>::value) {
+      if (num < 0)
+        snapshot_reader::corrupted();
 
-    //   (2) or if [] and *lv converts to false
-    if (rv->num_evaluated_operands() > 1)
-      return {false, true};
+      ++rd.num_shared;
+      rd.max_slot = std::max(rd.max_slot, num);
+    }
 
-    const bool convToTrue = to_concrete(*lv, true) == true;
+    std::vector<std::uint32_t> order;
 
-    return {convToTrue, false /* zero elements */};
-  }
+    if constexpr (std::is_base_of<logical_nary, expr_t>::value) {
+      order.resize(rd.get_count(sizeof(std::uint32_t)));
 
-  template <class T> std::tuple<bool, bool> coerce(array *lv, T *rv) {
-    // see comments membership coerce(T*,array*)
-    if (lv->num_evaluated_operands() == 1)
-      throw unpacked_array_req{};
+      for (std::uint32_t &pos : order)
+        pos = rd.get<std::uint32_t>();
+    }
 
-    if (lv->num_evaluated_operands() > 1)
-      return {false, true};
+    // each operand is encoded by at least its tag
+    oper::container_type operands(rd.get_count(sizeof(std::uint8_t)));
 
-    const bool convToTrue = to_concrete(*rv, true) == true;
+    for (any_expr &sub : operands)
+      sub = rd.get_node();
 
-    return {false /* zero elements */, convToTrue};
-  }
+    if constexpr (std::is_base_of<logical_nary, expr_t>::value) {
+      if (!order.empty() && order.size() != operands.size())
+        snapshot_reader::corrupted();
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
-                                                    std::nullptr_t) {
-    return {nullptr, nullptr}; // two null pointers are equal
-  }
+      // a duplicated position would skip another operand
+      std::vector<bool> seen(order.size(), false);
 
-  std::tuple<bool, bool> coerce(bool *lv, std::nullptr_t) {
-    return {*lv, false}; // null pointer -> false
-  }
+      for (std::uint32_t pos : order) {
+        if (pos >= operands.size() || seen[pos])
+          snapshot_reader::corrupted();
 
-  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv,
-                                                std::nullptr_t) {
-    return {*lv, 0}; // null pointer -> 0
-  }
+        seen[pos] = true;
+      }
+    }
 
-  std::tuple<std::uint64_t, std::uint64_t> coerce(std::uint64_t *lv,
-                                                  std::nullptr_t) {
-    return {*lv, 0}; // null pointer -> 0
-  }
+    expr_t &res = deref(new expr_t);
+    any_expr node(&res);
 
-  std::tuple<double, double> coerce(double *lv, std::nullptr_t) {
-    return {*lv, 0}; // null pointer -> 0.0
-  }
+    if constexpr (std::is_base_of<logical_nary, expr_t>::value)
+      res.test_order(std::move(order));
 
-  std::tuple<json::string, std::nullptr_t> coerce(json::string *lv,
-                                                  std::nullptr_t) {
-    return {std::move(*lv), nullptr}; // requires special handling
-  }
+    if constexpr (std::is_same<expr_t, var>::value)
+      res.num(num);
 
-  std::tuple<bool, bool> coerce(std::nullptr_t, bool *rv) {
-    return {false, *rv}; // null pointer -> false
-  }
+    if constexpr (std::is_same<expr_t, shared_subexpr>::value)
+      res.slot(num);
 
-  std::tuple<std::int64_t, std::int64_t> coerce(std::nullptr_t,
-                                                std::int64_t *rv) {
-    return {0, *rv}; // null pointer -> 0
-  }
+    res.set_operands(std::move(operands));
 
-  std::tuple<std::uint64_t, std::uint64_t> coerce(std::nullptr_t,
-                                                  std::uint64_t *rv) {
-    return {0, *rv}; // null pointer -> 0
-  }
+    if constexpr (std::is_same<expr_t, if_expr>::value ||
+                  std::is_same<expr_t, logical_or>::value)
+      index_equality_ladder(res);
 
-  std::tuple<double, double> coerce(std::nullptr_t, double *rv) {
-    return {0, *rv}; // null pointer -> 0
-  }
+    convert_numeric_literals(res);
 
-  std::tuple<std::nullptr_t, json::string> coerce(std::nullptr_t,
-                                                  json::string *rv) {
-    return {nullptr, std::move(*rv)}; // requires special handling
-  }
-};
-// @}
+    if constexpr (std::is_same<expr_t, reduce>::value)
+      bind_reduction_variables(res);
 
-// Arith
-struct arithmetic_operator : numeric_binary_operator_base {
-  enum {
-    defined_for_string = false,
-    defined_for_real = true,
-    defined_for_integer = true,
-    defined_for_boolean = false,
-    defined_for_null = true,
-    defined_for_array = false
-  };
+    return node;
+  } else if constexpr (std::is_same<expr_t, object_value>::value) {
+    // each member is encoded by at least its key length and value tag
+    object_value::container_type elems(
+        rd.get_count(sizeof(std::uint32_t) + sizeof(std::uint8_t)));
 
-  using result_type = any_expr;
+    for (object_value::value_type &el : elems) {
+      el.first = rd.get_string();
+      el.second = rd.get_node();
+    }
 
-  using numeric_binary_operator_base::coerce;
+    object_value &res = deref(new object_value);
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(double *, std::nullptr_t) {
-    return {nullptr, nullptr};
+    res.set_elements(std::move(elems));
+    return any_expr(&res);
+  } else if constexpr (std::is_same<expr_t, string_value>::value) {
+    return any_expr(new string_value(json::string(rd.get_string())));
+  } else if constexpr (std::is_same<expr_t, bool_value>::value) {
+    return any_expr(new bool_value(rd.get<std::uint8_t>() != 0));
+  } else if constexpr (std::is_same<expr_t, null_value>::value ||
+                       std::is_same<expr_t, error>::value) {
+    return any_expr(new expr_t);
+  } else {
+    return any_expr(new expr_t(rd.get<typename expr_t::value_type>()));
   }
+}
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::int64_t *,
-                                                    std::nullptr_t) {
-    return {nullptr, nullptr};
-  }
+using node_decoder = any_expr (*)(snapshot_reader &);
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::uint64_t *,
-                                                    std::nullptr_t) {
-    return {nullptr, nullptr};
-  }
+template <class... node_types>
+constexpr std::array<node_decoder, sizeof...(node_types)>
+make_node_decoders(std::tuple<node_types...> *) {
+  return {&decode_node<node_types>...};
+}
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t, double *) {
-    return {nullptr, nullptr};
-  }
+constexpr auto node_decoders =
+    make_node_decoders(static_cast<snapshot_node_types *>(nullptr));
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
-                                                    std::int64_t *) {
-    return {nullptr, nullptr};
-  }
+any_expr snapshot_reader::get_node() {
+  const std::uint8_t tag = get<std::uint8_t>();
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
-                                                    std::uint64_t *) {
-    return {nullptr, nullptr};
-  }
+  if (tag == EMPTY_TREE_TAG)
+    return nullptr;
 
-  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
-                                                    std::nullptr_t) {
-    return {nullptr, nullptr};
-  }
-};
+  if (tag > node_decoders.size() || depth == MAX_SNAPSHOT_DEPTH)
+    corrupted();
 
-struct integer_arithmetic_operator : arithmetic_operator {
-  enum {
-    defined_for_string = false,
-    defined_for_real = false,
-    defined_for_integer = true,
-    defined_for_boolean = false,
-    defined_for_null = false,
-    defined_for_array = false
-  };
+  ++depth;
+  any_expr res = node_decoders[tag - 1](*this);
+  --depth;
 
-  using arithmetic_operator::coerce;
-};
+  return res;
+}
 
-struct string_operator {
-  enum {
-    defined_for_string = true,
-    defined_for_real = false,
-    defined_for_integer = false,
-    defined_for_boolean = false,
-    defined_for_null = false,
-    defined_for_array = false
-  };
+void write_rule(const snapshot_writer &wr, const logic_details &rule) {
+  wr.put(std::uint8_t(rule.has_computed_variable_names()));
+  wr.put(std::uint32_t(rule.variable_names().size()));
 
-  using result_type = any_expr;
+  for (const json::string &name : rule.variable_names())
+    wr.put(json::string_view(name));
 
-  std::tuple<json::string, json::string> coerce(json::string *lv,
-                                                json::string *rv) {
-    return {std::move(*lv), std::move(*rv)};
-  }
-};
+  wr.put_node(rule.synatx_tree());
+}
 
-struct array_operator {
-  enum {
-    defined_for_string = false,
-    defined_for_real = false,
-    defined_for_integer = false,
-    defined_for_boolean = false,
-    defined_for_null = false,
-    defined_for_array = true
-  };
+logic_details read_rule(snapshot_reader &rd) {
+  const bool hasComputedVariables = rd.get<std::uint8_t>() != 0;
+  std::vector<json::string> names(rd.get_count(sizeof(std::uint32_t)));
 
-  using result_type = any_expr;
+  for (json::string &name : names)
+    name = rd.get_string();
 
-  std::tuple<array *, array *> coerce(array *lv, array *rv) { return {lv, rv}; }
-};
+  rd.num_shared = 0;
+  rd.max_slot = -1;
 
-/*
-  any_expr convert(any_expr val, ...)
-  {
-    return val;
-  }
-*/
+  any_expr node = rd.get_node();
 
-any_expr convert(any_expr val, const arithmetic_operator &) {
-  struct arithmetic_converter : forwarding_visitor {
-    explicit arithmetic_converter(any_expr val) : res(std::move(val)) {}
+  // slots are numbered from 0 and each is used by at least two nodes
+  if (rd.max_slot >= rd.num_shared)
+    snapshot_reader::corrupted();
 
-    void visit(expr &) final { throw_type_error(); }
+  if (node)
+    number_memoized_nodes(node);
 
-    // defined for the following types
-    void visit(int_value &) final {}
-    void visit(unsigned_int_value &) final {}
-    void visit(real_value &) final {}
-    void visit(null_value &) final {}
+  return {std::move(node), std::move(names), hasComputedVariables};
+}
+} // namespace
 
-    // need to convert values
-    void visit(string_value &el) final {
-      double dd = to_concrete(el.value(), double{});
-      std::int64_t ii = to_concrete(el.value(), std::int64_t{});
-      // uint?
+void write_snapshot(std::ostream &os, const logic_details *rules,
+                    std::size_t num) {
+  std::string payload;
+  std::vector<std::uint64_t> offsets;
+  snapshot_writer wr{&payload};
 
-      res = (dd != ii) ? to_expr(dd) : to_expr(ii);
-    }
+  offsets.reserve(num);
 
-    void visit(bool_value &) final {
-      // \todo correct?
-      res = to_expr(nullptr);
-    }
+  for (std::size_t i = 0; i < num; ++i) {
+    offsets.push_back(payload.size());
+    write_rule(wr, rules[i]);
+  }
 
-    any_expr result() && { return std::move(res); }
+  std::string index;
+  snapshot_writer idx{&index};
 
-  private:
-    any_expr res;
-  };
+  idx.put(std::uint64_t(num));
 
-  expr *node = val.get();
-  arithmetic_converter conv{std::move(val)};
+  for (std::uint64_t ofs : offsets)
+    idx.put(ofs);
 
-  node->accept(conv);
-  return std::move(conv).result();
-}
+  payload.insert(0, index);
 
-/*
-  any_expr convert(any_expr val, const integer_arithmetic_operator&)
-  {
-    struct integer_arithmetic_converter : forwarding_visitor
-    {
-        explicit
-        integer_arithmetic_converter(any_expr val)
-        : res(std::move(val))
-        {}
+  snapshot_header hdr;
 
-        void visit(expr&)               final { throw_type_error(); }
+  std::memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+  hdr.version = SNAPSHOT_VERSION;
+  hdr.byte_order = SNAPSHOT_BYTE_ORDER;
+  hdr.payload_size = payload.size();
+  hdr.checksum = snapshot_checksum(payload.data(), payload.size());
 
-        // defined for the following types
-        void visit(int_value&)          final {}
-        void visit(unsigned_int_value&) final {}
+  os.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+  os.write(payload.data(), payload.size());
+}
 
-        // need to convert values
-        void visit(string_value& el) final
-        {
-          res = to_expr(to_concrete(el.value(), std::int64_t{}));
-        }
+snapshot::snapshot(const char *data, std::size_t len) : base(data), sz(len) {
+  validate();
+}
 
-        void visit(bool_value& el) final
-        {
-          res = to_expr(to_concrete(el.value(), std::int64_t{}));
-        }
+snapshot::snapshot(const std::string &filename) {
+  const int fd = ::open(filename.c_str(), O_RDONLY);
 
-        void visit(real_value& el) final
-        {
-          res = to_expr(to_concrete(el.value(), std::int64_t{}));
-        }
+  if (fd < 0)
+    throw std::runtime_error{"jsonlogic - unable to open snapshot"};
 
-        void visit(null_value&) final
-        {
-          res = to_expr(std::int64_t{0});
-        }
+  struct stat info;
+  void *mem = MAP_FAILED;
 
-        any_expr result() && { return std::move(res); }
+  if (::fstat(fd, &info) == 0 && info.st_size > 0)
+    mem = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-      private:
-        any_expr res;
-    };
+  ::close(fd);
 
-    expr*                        node = val.get();
-    integer_arithmetic_converter conv{std::move(val)};
+  if (mem == MAP_FAILED)
+    throw std::runtime_error{"jsonlogic - unable to map snapshot"};
 
-    node->accept(conv);
-    return std::move(conv).result();
-  }
-*/
+  base = static_cast<const char *>(mem);
+  sz = info.st_size;
+  mapped = true;
 
-any_expr convert(any_expr val, const string_operator &) {
-  struct string_converter : forwarding_visitor {
-    explicit string_converter(any_expr val) : res(std::move(val)) {}
+  try {
+    validate();
+  } catch (...) {
+    ::munmap(const_cast<char *>(base), sz);
+    throw;
+  }
+}
 
-    void visit(expr &) final { throw_type_error(); }
+snapshot::~snapshot() {
+  if (mapped)
+    ::munmap(const_cast<char *>(base), sz);
+}
 
-    // defined for the following types
-    void visit(string_value &) final {}
+void snapshot::validate() {
+  snapshot_header hdr;
 
-    // need to convert values
-    void visit(bool_value &el) final {
-      res = to_expr(to_concrete(el.value(), json::string{}));
-    }
+  if (sz < sizeof(hdr))
+    snapshot_reader::corrupted();
 
-    void visit(int_value &el) final {
-      res = to_expr(to_concrete(el.value(), json::string{}));
-    }
+  std::memcpy(&hdr, base, sizeof(hdr));
 
-    void visit(unsigned_int_value &el) final {
-      res = to_expr(to_concrete(el.value(), json::string{}));
-    }
+  if (std::memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0)
+    throw std::runtime_error{"jsonlogic - not a snapshot"};
 
-    void visit(real_value &el) final {
-      res = to_expr(to_concrete(el.value(), json::string{}));
-    }
+  if (hdr.version != SNAPSHOT_VERSION || hdr.byte_order != SNAPSHOT_BYTE_ORDER)
+    throw std::runtime_error{"jsonlogic - incompatible snapshot"};
 
-    void visit(null_value &el) final {
-      res = to_expr(to_concrete(el.value(), json::string{}));
-    }
+  if (hdr.payload_size != sz - sizeof(hdr) ||
+      hdr.checksum != snapshot_checksum(base + sizeof(hdr), hdr.payload_size))
+    snapshot_reader::corrupted();
 
-    any_expr result() && { return std::move(res); }
+  snapshot_reader rd{base + sizeof(hdr), base + sz};
 
-  private:
-    any_expr res;
-  };
+  num = rd.get<std::uint64_t>();
 
-  expr *node = val.get();
-  string_converter conv{std::move(val)};
+  if (num > std::size_t(rd.lim - rd.pos) / sizeof(std::uint64_t))
+    snapshot_reader::corrupted();
 
-  node->accept(conv);
-  return std::move(conv).result();
+  index = rd.pos;
 }
 
-any_expr convert(any_expr val, const array_operator &) {
-  struct array_converter : forwarding_visitor {
-    explicit array_converter(any_expr val) : val(std::move(val)) {}
+logic_details snapshot::rule(std::size_t idx) const {
+  if (idx >= num)
+    throw std::out_of_range{"jsonlogic - snapshot rule index"};
 
-    void visit(expr &) final { throw_type_error(); }
+  // the syntax tree must not be allocated in a scratch arena
+  scratch_scope heap{nullptr};
+  // offsets are relative to the first rule, which follows the offset table
+  const char *first = index + num * sizeof(std::uint64_t);
+  std::uint64_t ofs;
 
-    // moves res into
-    void to_array() {
-      array &arr = deref(new array);
-      oper::container_type operands;
+  std::memcpy(&ofs, index + idx * sizeof(ofs), sizeof(ofs));
 
-      operands.emplace_back(&arr);
+  if (ofs > std::uint64_t(base + sz - first))
+    snapshot_reader::corrupted();
 
-      // swap the operand and result
-      std::swap(operands.back(), val);
+  snapshot_reader rd{first + ofs, base + sz};
 
-      // then set the operands
-      arr.set_operands(std::move(operands));
-    }
+  return read_rule(rd);
+}
 
-    // defined for the following types
-    void visit(array &) final {}
+std::vector<logic_details> snapshot::rules() const {
+  std::vector<logic_details> res;
 
-    // need to move value_base to new array
-    void visit(string_value &) final { to_array(); }
-    void visit(bool_value &) final { to_array(); }
-    void visit(int_value &) final { to_array(); }
-    void visit(unsigned_int_value &) final { to_array(); }
-    void visit(real_value &) final { to_array(); }
-    void visit(null_value &) final { to_array(); }
+  res.reserve(num);
 
-    any_expr result() && { return std::move(val); }
+  for (std::size_t i = 0; i < num; ++i)
+    res.push_back(rule(i));
 
-  private:
-    any_expr val;
-  };
+  return res;
+}
 
-  expr *node = val.get();
-  array_converter conv{std::move(val)};
+//
+// rule cache
 
-  node->accept(conv);
-  return std::move(conv).result();
+namespace {
+
+std::size_t hash_combine(std::size_t seed, std::size_t val) {
+  return seed ^ (val + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
 }
 
-template <class value_t> struct unpacker : forwarding_visitor {
-  void assign(value_t &lhs, const value_t &val) { lhs = val; }
+/// hashes the structure and the values of \p n
+/// \details
+///    object members are combined independent of their order, as
+///    same_rule ignores the member order.
+std::size_t structural_hash(const json::value &n) {
+  std::size_t res = std::size_t(n.kind());
 
-  template <class U> void assign(value_t &lhs, const U &val) {
-    lhs = to_concrete(val, lhs);
-  }
+  switch (n.kind()) {
+  case json::kind::object: {
+    std::size_t members = 0;
 
-  CXX_NORETURN
-  void visit(expr &) final { throw_type_error(); }
+    for (const json::key_value_pair &el : n.get_object())
+      members += hash_combine(key_hash(el.key()), structural_hash(el.value()));
 
-  // defined for the following types
-  void visit(string_value &el) final { assign(res, el.value()); }
+    return hash_combine(res, members);
+  }
 
-  // need to convert values
-  void visit(bool_value &el) final { assign(res, el.value()); }
+  case json::kind::array: {
+    for (const json::value &el : n.get_array())
+      res = hash_combine(res, structural_hash(el));
 
-  void visit(int_value &el) final { assign(res, el.value()); }
+    return res;
+  }
 
-  void visit(unsigned_int_value &el) final { assign(res, el.value()); }
+  case json::kind::string:
+    return hash_combine(res, key_hash(n.get_string()));
 
-  void visit(real_value &el) final { assign(res, el.value()); }
+  case json::kind::int64:
+    return hash_combine(res, std::hash<std::int64_t>{}(n.get_int64()));
 
-  void visit(null_value &el) final { assign(res, el.value()); }
+  case json::kind::uint64:
+    return hash_combine(res, std::hash<std::uint64_t>{}(n.get_uint64()));
 
-  void visit(array &el) final {
-    if constexpr (std::is_same<value_t, bool>::value) {
-      CXX_LIKELY;
-      return assign(res, el);
-    }
+  case json::kind::double_:
+    return hash_combine(res, std::hash<double>{}(n.get_double()));
 
-    throw_type_error();
+  case json::kind::bool_:
+    return hash_combine(res, n.get_bool());
+
+  default:
+    return res;
   }
+}
 
-  value_t result() && { return std::move(res); }
+/// compares two rules; unlike json::value::operator==, numbers of
+///   different kinds are distinct, as they translate to different nodes.
+bool same_rule(const json::value &lhs, const json::value &rhs) {
+  if (lhs.kind() != rhs.kind())
+    return false;
 
-private:
-  value_t res;
-};
+  switch (lhs.kind()) {
+  case json::kind::object: {
+    const json::object &lobj = lhs.get_object();
+    const json::object &robj = rhs.get_object();
 
-template <class T> T unpack_value(expr &expr) {
-  unpacker<T> unpack;
+    if (lobj.size() != robj.size())
+      return false;
 
-  expr.accept(unpack);
-  return std::move(unpack).result();
-}
+    return std::all_of(lobj.begin(), lobj.end(),
+                       [&robj](const json::key_value_pair &el) -> bool {
+                         const json::value *other = robj.if_contains(el.key());
 
-template <class T> T unpack_value(const any_expr &el) {
-  return unpack_value<T>(*el);
-}
+                         return other && same_rule(el.value(), *other);
+                       });
+  }
 
-template <class T> T unpack_value(any_expr &&el) {
-  return unpack_value<T>(*el);
-}
+  case json::kind::array: {
+    const json::array &larr = lhs.get_array();
+    const json::array &rarr = rhs.get_array();
 
-//
-// Json Logic - truthy/falsy
-bool truthy(expr &el) { return unpack_value<bool>(el); }
-bool truthy(any_expr &&el) { return unpack_value<bool>(std::move(el)); }
-bool falsy(expr &el) { return !truthy(el); }
-// bool falsy(any_expr&& el)  { return !truthy(std::move(el)); }
-} // namespace
+    return std::equal(larr.begin(), larr.end(), rarr.begin(), rarr.end(),
+                      same_rule);
+  }
 
-bool truthy(const any_expr &el) { return unpack_value<bool>(el); }
-bool falsy(const any_expr &el) { return !truthy(el); }
+  default:
+    return lhs == rhs;
+  }
+}
 
-//
-// cloning
+/// estimates the memory used by the json value \p n
+std::size_t json_footprint(const json::value &n) {
+  std::size_t res = sizeof(n);
 
-namespace {
-any_expr clone_expr(const any_expr &expr);
+  if (const json::object *obj = n.if_object()) {
+    for (const json::key_value_pair &el : *obj)
+      res += sizeof(el) + el.key().size() + json_footprint(el.value());
+  } else if (const json::array *arr = n.if_array()) {
+    for (const json::value &el : *arr)
+      res += json_footprint(el);
+  } else if (const json::string *str = n.if_string()) {
+    res += str->size();
+  }
 
-struct expr_cloner {
-  /// init functions that set up children
-  /// \{
-  expr &init(const oper &, oper &) const;
-  expr &init(const object_value &, object_value &) const;
-  /// \}
+  return res;
+}
 
-  /// function family for type specific cloning
-  /// \param  n       the original node
-  /// \param  unnamed a tag parameter to summarily handle groups of types
-  /// \return the cloned node
-  /// \{
-  CXX_NORETURN
-  expr &clone(const expr &, const expr &) const { unsupported(); }
+/// a process-wide setting that is read by every call and rarely replaced
+/// \details
+///    each thread keeps a weak reference, tagged with the version it was
+///    taken from, so that reading takes no lock. A replaced object is
+///    released as soon as no call uses it any longer. There must be at
+///    most one setting of each type T.
+template <class T> struct shared_setting {
+  /// replaces the setting
+  void set(std::shared_ptr<T> obj) {
+    {
+      std::lock_guard<std::mutex> lock{guard};
 
-  expr &clone(const error &, const error &) const { return deref(new error); }
+      current.swap(obj);
+      version.fetch_add(1, std::memory_order_release);
+    }
 
-  template <class value_t>
-  expr &clone(const value_t &n, const value_base &) const {
-    return deref(new value_t(n.value()));
+    // the previous setting is released outside the lock
   }
 
-  template <class oper_t> expr &clone(const oper_t &n, const oper &) const {
-    return init(n, deref(new oper_t));
-  }
+  /// returns the setting, or nullptr
+  std::shared_ptr<T> get() {
+    struct thread_view {
+      std::uint64_t version = 0;
+      std::weak_ptr<T> obj;
+    };
 
-  expr &clone(const object_value &n, const object_value &) const {
-    return init(n, deref(new object_value));
-  }
-  /// \}
+    thread_local thread_view view;
+    const std::uint64_t latest = version.load(std::memory_order_acquire);
 
-  template <class expr_t> expr *operator()(expr_t &n) { return &clone(n, n); }
-};
+    if (view.version != latest) {
+      CXX_UNLIKELY;
+      std::lock_guard<std::mutex> lock{guard};
 
-expr &expr_cloner::init(const oper &src, oper &tgt) const {
-  oper::container_type children;
+      view.obj = current;
+      view.version = latest;
+    }
 
-  std::transform(src.operands().begin(), src.operands().end(),
-                 std::back_inserter(children),
-                 [](const any_expr &e) -> any_expr { return clone_expr(e); });
+    return view.obj.lock();
+  }
 
-  tgt.set_operands(std::move(children));
-  return tgt;
-}
+private:
+  std::mutex guard;
+  std::shared_ptr<T> current;
 
-expr &expr_cloner::init(const object_value &src, object_value &tgt) const {
-  std::transform(
-      src.begin(), src.end(), std::inserter(tgt.elements(), tgt.end()),
-      [](const object_value::value_type &entry) -> object_value::value_type {
-        return {entry.first, clone_expr(entry.second)};
-      });
+  /// incremented by set; invalidates the per-thread references
+  std::atomic<std::uint64_t> version{1};
+};
 
-  return tgt;
-}
+shared_setting<rule_cache> active_rule_cache;
+} // namespace
 
-any_expr clone_expr(const any_expr &exp) {
-  return any_expr(generic_visit(expr_cloner{}, exp.get()));
-}
+struct rule_cache::impl {
+  struct entry {
+    std::size_t hash;
+    std::size_t bytes;
+    json::value rule;
+    std::shared_ptr<const logic_details> logic;
+  };
 
-template <class expr_t, class fn_t, class alt_fn_t>
-auto with_type(expr *e, fn_t fn, alt_fn_t altfn) -> decltype(altfn()) {
-  if (e == nullptr) {
-    CXX_UNLIKELY;
-    return altfn();
-  }
+  // most recently used entries are at the front
+  using lru_list = std::list<entry>;
 
-  expr_t *casted = may_down_cast<expr_t>(*e);
+  /// a part of the cache with its own lock and its share of the limit
+  struct shard {
+    std::mutex guard;
+    lru_list entries;
+    std::unordered_multimap<std::size_t, lru_list::iterator> index;
+    std::size_t limit = 0;
+    statistics stats;
 
-  return casted ? fn(*casted) : altfn();
-}
+    /// returns the cached rule, or nullptr
+    std::shared_ptr<const logic_details> find(std::size_t hash,
+                                              const json::value &rule);
 
-//
-// binary operator - double dispatch pattern
+    /// evicts least recently used entries until the shard fits its limit
+    void shrink();
+  };
 
-template <class binary_op_t, class lhs_value_t>
-struct binary_operator_visitor_2 : forwarding_visitor {
-  using result_type = typename binary_op_t::result_type;
+  // rules are distributed over the shards by hash, so that concurrent
+  //   lookups of different rules rarely wait for each other.
+  enum { NUM_SHARDS = 16 };
 
-  binary_operator_visitor_2(lhs_value_t lval, binary_op_t oper)
-      : lv(lval), op(oper), res() {}
+  std::array<shard, NUM_SHARDS> shards;
+  std::size_t limit = 0; ///< guarded by the locks of all shards
 
-  template <class rhs_value_t> void calc(rhs_value_t rv) {
-    auto [ll, rr] = op.coerce(lv, rv);
+  explicit impl(std::size_t max_bytes) { set_limit(max_bytes); }
 
-    res = op(std::move(ll), std::move(rr));
-  }
+  shard &shard_of(std::size_t hash) { return shards[hash % NUM_SHARDS]; }
 
-  void visit(expr &) final { throw_type_error(); }
+  void set_limit(std::size_t max_bytes) {
+    for (shard &part : shards)
+      part.guard.lock();
 
-  void visit(string_value &n) final {
-    if constexpr (binary_op_t::defined_for_string)
-      return calc(&n.value());
+    limit = max_bytes;
 
-    throw_type_error();
+    for (shard &part : shards) {
+      part.limit = max_bytes / NUM_SHARDS;
+      part.shrink();
+      part.guard.unlock();
+    }
   }
+};
 
-  void visit(null_value &) final {
-    if constexpr (binary_op_t::defined_for_null)
-      return calc(nullptr);
+std::shared_ptr<const logic_details>
+rule_cache::impl::shard::find(std::size_t hash, const json::value &rule) {
+  auto [aa, zz] = index.equal_range(hash);
 
-    throw_type_error();
+  for (; aa != zz; ++aa) {
+    if (same_rule(aa->second->rule, rule)) {
+      entries.splice(entries.begin(), entries, aa->second);
+      return aa->second->logic;
+    }
   }
 
-  void visit(bool_value &n) final {
-    if constexpr (binary_op_t::defined_for_boolean)
-      return calc(&n.value());
+  return nullptr;
+}
 
-    throw_type_error();
-  }
+void rule_cache::impl::shard::shrink() {
+  while (stats.bytes > limit) {
+    assert(!entries.empty());
 
-  void visit(int_value &n) final {
-    if constexpr (binary_op_t::defined_for_integer) {
-      try {
-        return calc(&n.value());
-      } catch (const not_int64_error &ex) {
-        if (n.value() < 0) {
-          CXX_UNLIKELY;
-          throw std::range_error{
-              "unable to consolidate uint>max(int) with int<0"};
-        }
-      }
+    const entry &victim = entries.back();
+    auto [aa, zz] = index.equal_range(victim.hash);
 
-      std::uint64_t alt = n.value();
-      return calc(&alt);
+    while (aa->second != std::prev(entries.end())) {
+      assert(aa != zz);
+      ++aa;
     }
 
-    throw_type_error();
+    index.erase(aa);
+    stats.bytes -= victim.bytes;
+    --stats.entries;
+    ++stats.evictions;
+    entries.pop_back();
   }
+}
 
-  void visit(unsigned_int_value &n) final {
-    if constexpr (binary_op_t::defined_for_integer) {
-      try {
-        return calc(&n.value());
-      } catch (const not_uint64_error &ex) {
-        if (n.value() > std::uint64_t(std::numeric_limits<std::int64_t>::max)) {
-          CXX_UNLIKELY;
-          throw std::range_error{
-              "unable to consolidate int<0 with uint>max(int)"};
-        }
-      }
+rule_cache::rule_cache(std::size_t max_bytes) : pimpl(new impl{max_bytes}) {}
 
-      std::int64_t alt = n.value();
-      return calc(&alt);
+rule_cache::~rule_cache() = default;
+
+std::shared_ptr<const logic_details>
+rule_cache::get(const json::value &rule) {
+  const std::size_t hash = structural_hash(rule);
+  impl::shard &part = pimpl->shard_of(hash);
+
+  {
+    std::lock_guard<std::mutex> lock{part.guard};
+
+    if (std::shared_ptr<const logic_details> logic = part.find(hash, rule)) {
+      ++part.stats.hits;
+      return logic;
     }
 
-    throw_type_error();
+    ++part.stats.misses;
   }
 
-  void visit(real_value &n) final {
-    if constexpr (binary_op_t::defined_for_real)
-      return calc(&n.value());
+  // compile outside the lock; concurrent misses on the same rule may
+  //   compile it more than once, but only one copy is kept.
+  auto logic = std::make_shared<const logic_details>(create_logic(rule));
+  std::size_t bytes = sizeof(impl::entry) + json_footprint(rule) +
+                      memory_footprint(deref(logic->synatx_tree().get()));
 
-    throw_type_error();
-  }
+  for (const json::string &name : logic->variable_names())
+    bytes += sizeof(name) + name.capacity();
 
-  void visit(array &n) final {
-    if constexpr (binary_op_t::defined_for_array) {
-      try {
-        calc(&n);
-      } catch (const unpacked_array_req &) {
-        assert(n.num_evaluated_operands() == 1);
-        n.operand(0).accept(*this);
-      }
+  std::lock_guard<std::mutex> lock{part.guard};
 
-      return;
-    }
+  if (bytes > part.limit)
+    return logic;
 
-    throw_type_error();
-  }
+  if (std::shared_ptr<const logic_details> other = part.find(hash, rule))
+    return other;
 
-  result_type result() && { return std::move(res); }
+  part.entries.push_front({hash, bytes, rule, logic});
+  part.index.emplace(hash, part.entries.begin());
+  part.stats.bytes += bytes;
+  ++part.stats.entries;
+  part.shrink();
+  return logic;
+}
 
-private:
-  lhs_value_t lv;
-  binary_op_t op;
-  result_type res;
-};
+rule_cache::statistics rule_cache::stats() const {
+  statistics res;
 
-template <class binary_op_t>
-struct binary_operator_visitor : forwarding_visitor {
-  using result_type = typename binary_op_t::result_type;
+  for (impl::shard &part : pimpl->shards) {
+    std::lock_guard<std::mutex> lock{part.guard};
 
-  binary_operator_visitor(binary_op_t oper, any_expr &rhsarg)
-      : op(oper), rhs(rhsarg), res() {}
+    res.hits += part.stats.hits;
+    res.misses += part.stats.misses;
+    res.evictions += part.stats.evictions;
+    res.entries += part.stats.entries;
+    res.bytes += part.stats.bytes;
+  }
 
-  template <class LhsValue> void calc(LhsValue lv) {
-    using rhs_visitor = binary_operator_visitor_2<binary_op_t, LhsValue>;
+  return res;
+}
 
-    rhs_visitor vis{lv, op};
+void rule_cache::max_bytes(std::size_t limit) { pimpl->set_limit(limit); }
 
-    rhs->accept(vis);
-    res = std::move(vis).result();
-  }
+std::size_t rule_cache::max_bytes() const {
+  // any shard lock suffices to read the limit
+  std::lock_guard<std::mutex> lock{pimpl->shards[0].guard};
 
-  void visit(string_value &n) final {
-    if constexpr (binary_op_t::defined_for_string)
-      return calc(&n.value());
+  return pimpl->limit;
+}
 
-    throw_type_error();
+void rule_cache::clear() {
+  for (impl::shard &part : pimpl->shards) {
+    std::lock_guard<std::mutex> lock{part.guard};
+
+    part.index.clear();
+    part.entries.clear();
+    part.stats.bytes = 0;
+    part.stats.entries = 0;
   }
+}
 
-  void visit(null_value &) final {
-    if constexpr (binary_op_t::defined_for_null)
-      return calc(nullptr);
+void use_rule_cache(std::shared_ptr<rule_cache> cache) {
+  active_rule_cache.set(std::move(cache));
+}
 
-    throw_type_error();
-  }
+//
+// common subexpressions
 
-  void visit(bool_value &n) final {
-    if constexpr (binary_op_t::defined_for_boolean)
-      return calc(&n.value());
+namespace {
 
-    throw_type_error();
+/// returns the snapshot tag of a node, which identifies its type
+struct node_kind {
+  template <class expr_t> std::uint8_t operator()(expr_t &) const {
+    return node_tag<expr_t>();
   }
+};
 
-  void visit(int_value &n) final {
-    if constexpr (binary_op_t::defined_for_integer) {
-      try {
-        return calc(&n.value());
-      } catch (const not_int64_error &ex) {
-        if (n.value() < 0) {
-          CXX_UNLIKELY;
-          throw std::range_error{
-              "unable to consolidate int<0 with uint>max(int)"};
-        }
-      }
+/// properties of a node that matter for sharing subexpressions
+struct node_traits {
+  std::size_t hash;   ///< hash of the node type and value
+  oper *op;           ///< the node as operator, or nullptr
+  bool has_body;      ///< operand 1 is evaluated per element
+  bool pure;          ///< the node has no side effects
+  bool worth_sharing; ///< the node computes something
+};
 
-      std::uint64_t alt = n.value();
-      return calc(&alt);
-    }
+/// computes the node_traits of a node
+struct node_signature {
+  /// function family for type specific hashing
+  /// \param  n       the node
+  /// \param  unnamed a tag parameter to summarily handle groups of types
+  /// \{
+  std::size_t hash(const expr &, const expr &) const { return 0; }
 
-    throw_type_error();
+  std::size_t hash(const null_value &, const value_base &) const { return 0; }
+
+  std::size_t hash(const string_value &n, const value_base &) const {
+    return key_hash(n.value());
   }
 
-  void visit(unsigned_int_value &n) final {
-    if constexpr (binary_op_t::defined_for_integer) {
-      try {
-        return calc(&n.value());
-      } catch (const not_uint64_error &ex) {
-        if (n.value() > std::uint64_t(std::numeric_limits<std::int64_t>::max)) {
-          CXX_UNLIKELY;
-          throw std::range_error{
-              "unable to consolidate uint>max(int) with int<0"};
-        }
-      }
+  template <class value_t>
+  std::size_t hash(const value_t &n, const value_base &) const {
+    return std::hash<typename value_t::value_type>{}(n.value());
+  }
+  /// \}
 
-      std::int64_t alt = n.value();
-      return calc(&alt);
-    }
+  template <class expr_t> node_traits operator()(expr_t &n) const {
+    constexpr bool isOper = std::is_base_of<oper, expr_t>::value;
+    constexpr bool isSequence = std::is_same<expr_t, map>::value ||
+                                std::is_same<expr_t, filter>::value ||
+                                std::is_same<expr_t, reduce>::value ||
+                                std::is_same<expr_t, all>::value ||
+                                std::is_same<expr_t, none>::value ||
+                                std::is_same<expr_t, some>::value;
+    constexpr bool isPure = !std::is_same<expr_t, log>::value &&
+                            (isOper || std::is_base_of<value_base, expr_t>::value);
 
-    throw_type_error();
-  }
+    oper *op = nullptr;
 
-  void visit(real_value &n) final {
-    if constexpr (binary_op_t::defined_for_real)
-      return calc(&n.value());
+    if constexpr (isOper)
+      op = &n;
 
-    throw_type_error();
+    return {hash_combine(node_tag<expr_t>(), hash(n, n)), op, isSequence,
+            isPure, isOper && !std::is_same<expr_t, array>::value};
   }
+};
 
-  void visit(array &n) final {
-    if constexpr (binary_op_t::defined_for_array) {
-      try {
-        calc(&n);
-      } catch (const unpacked_array_req &) {
-        assert(n.num_evaluated_operands() == 1);
-        n.operand(0).accept(*this);
-      }
+/// compares two subtrees structurally
+bool same_subtree(expr &lhs, expr &rhs) {
+  if (generic_visit(node_kind{}, &lhs) != generic_visit(node_kind{}, &rhs))
+    return false;
 
-      return;
-    }
+  if (value_base *lval = may_down_cast<value_base>(lhs))
+    return same_rule(lval->to_json(), down_cast<value_base>(rhs).to_json());
 
-    throw_type_error();
-  }
+  oper *lop = may_down_cast<oper>(lhs);
 
-  result_type result() && { return std::move(res); }
+  if (lop == nullptr)
+    return false;
 
-private:
-  binary_op_t op;
-  any_expr &rhs;
-  result_type res;
-};
+  const oper::container_type &lsub = lop->operands();
+  const oper::container_type &rsub = down_cast<oper>(rhs).operands();
 
-//
-// compute and sequence functions
+  return std::equal(lsub.begin(), lsub.end(), rsub.begin(), rsub.end(),
+                    [](const any_expr &l, const any_expr &r) -> bool {
+                      return same_subtree(deref(l.get()), deref(r.get()));
+                    });
+}
 
-template <class binary_op_t>
-typename binary_op_t::result_type compute(any_expr &lhs, any_expr &rhs,
-                                          binary_op_t op) {
-  using lhs_visitor = binary_operator_visitor<binary_op_t>;
+/// returns true if the subtree in \p n has no side effects
+bool pure_subtree(expr &n) {
+  const node_traits traits = generic_visit(node_signature{}, &n);
 
-  assert(lhs.get() && rhs.get());
+  if (!traits.pure || traits.op == nullptr)
+    return traits.pure;
 
-  lhs_visitor vis{op, rhs};
+  const oper::container_type &operands = traits.op->operands();
 
-  lhs->accept(vis);
-  return std::move(vis).result();
+  return std::all_of(operands.begin(), operands.end(),
+                     [](const any_expr &sub) -> bool {
+                       return pure_subtree(deref(sub.get()));
+                     });
 }
 
-template <class binary_predicate_t>
-bool compare_sequence(array &lv, array &rv, binary_predicate_t pred) {
-  const std::size_t lsz = lv.num_evaluated_operands();
-  const std::size_t rsz = rv.num_evaluated_operands();
+/// the smallest number of conditions that are indexed
+constexpr std::size_t MIN_DISPATCH_CONDITIONS = 4;
 
-  if (lsz == 0)
-    return pred(false, rsz != 0);
+/// builds an equality dispatch over the conditions at the positions
+///   0, step, 2*step, .. < lim of \p n.
+/// \return the index, or nullptr if some condition does not compare the
+///         common subject with a string or integer constant.
+std::unique_ptr<equality_dispatch> make_equality_dispatch(oper &n, int lim,
+                                                          int step) {
+  std::vector<equality_dispatch::entry> keys;
+  expr *subject = nullptr;
+  bool strings = false;
 
-  if (rsz == 0)
-    return pred(true, false);
+  for (int pos = 0; pos < lim; pos += step) {
+    equal *cond = may_down_cast<equal>(n.operand(pos));
 
-  std::size_t const len = std::min(lsz, rsz);
-  std::size_t i = 0;
-  bool res = false;
-  bool found = false;
+    if (cond == nullptr || cond->num_evaluated_operands() != 2)
+      return nullptr;
 
-  while ((i < len) && !found) {
-    res = compute(lv.at(i), rv.at(i), pred);
+    expr *subj = &cond->operand(0);
+    value_base *key = may_down_cast<value_base>(cond->operand(1));
 
-    // res is conclusive if the reverse test yields a different result
-    found = res != compute(rv.at(i), lv.at(i), pred);
+    if (key == nullptr) {
+      subj = &cond->operand(1);
+      key = may_down_cast<value_base>(cond->operand(0));
+    }
+
+    if (key == nullptr || may_down_cast<value_base>(*subj))
+      return nullptr;
+
+    const bool isString = may_down_cast<string_value>(*key) != nullptr;
+
+    if (!isString && !may_down_cast<int_value>(*key))
+      return nullptr;
 
-    ++i;
+    if (subject == nullptr) {
+      if (!pure_subtree(*subj))
+        return nullptr;
+
+      subject = subj;
+      strings = isString;
+    } else if (isString != strings || !same_subtree(*subject, *subj)) {
+      return nullptr;
+    }
+
+    keys.push_back({key, std::uint32_t(pos)});
   }
 
-  return found ? res : pred(lsz, rsz);
-}
+  if (keys.size() < MIN_DISPATCH_CONDITIONS)
+    return nullptr;
 
-template <class binary_predicate_t>
-bool compare_sequence(array *lv, array *rv, binary_predicate_t pred) {
-  return compare_sequence(deref(lv), deref(rv), std::move(pred));
+  return std::make_unique<equality_dispatch>(*subject, strings, keys);
 }
 
-/// convenience template that only returns \p R
-/// when the types \p U and \p V mismatch.
-/// matching \p U and \p V trigger a SFINAE error to invoke
-/// the regular operator.
-/// \{
-template <class U, class V, class R>
-struct mismatched_types
-{
-  using type = R;
-};
+void index_equality_ladder(if_expr &n) {
+  n.dispatch(make_equality_dispatch(n, n.num_evaluated_operands() - 1, 2));
+}
 
-template <class T, class R>
-struct mismatched_types<T,T,R>
-{
-  // using type // triggers SFINAE exclusion
-};
-/// \}
+void index_equality_ladder(logical_or &n) {
+  n.dispatch(make_equality_dispatch(n, n.num_evaluated_operands(), 1));
+}
 
-//
-// the calc operator implementations
+void index_equality_ladders(any_expr &root) {
+  oper *op = may_down_cast<oper>(deref(root.get()));
 
-template <class> struct operator_impl {};
+  if (op == nullptr)
+    return;
 
-template <> struct operator_impl<equal> : equality_operator {
-  using equality_operator::result_type;
+  for (any_expr &sub : op->operands())
+    index_equality_ladders(sub);
 
-  template <class U, class V>
-  auto operator()(const U&, const V&) const -> typename mismatched_types<U, V, result_type>::type {
-    return false;
-  }
+  if (if_expr *cond = may_down_cast<if_expr>(*op))
+    index_equality_ladder(*cond);
+  else if (logical_or *alt = may_down_cast<logical_or>(*op))
+    index_equality_ladder(*alt);
+}
 
-  template <class T> auto operator()(const T &lhs, const T &rhs) const -> result_type {
-    return lhs == rhs;
+/// true for the operators whose operands may be strings that convert
+///   to numbers
+struct numeric_operator {
+  template <class expr_t> bool operator()(expr_t &) const {
+    return std::is_same<expr_t, equal>::value ||
+           std::is_same<expr_t, not_equal>::value ||
+           std::is_same<expr_t, less>::value ||
+           std::is_same<expr_t, greater>::value ||
+           std::is_same<expr_t, less_or_equal>::value ||
+           std::is_same<expr_t, greater_or_equal>::value ||
+           std::is_same<expr_t, add>::value ||
+           std::is_same<expr_t, multiply>::value ||
+           std::is_same<expr_t, min>::value || std::is_same<expr_t, max>::value;
   }
 };
 
-template <> struct operator_impl<not_equal> : equality_operator {
-  using equality_operator::result_type;
+void convert_numeric_literals(oper &n) {
+  if (!generic_visit(numeric_operator{}, &n))
+    return;
 
-  template <class U, class V>
-  auto operator()(const U&, const V&) const -> typename mismatched_types<U, V, result_type>::type {
-    return true;
-  }
+  for (any_expr &sub : n.operands()) {
+    string_value *str = may_down_cast<string_value>(deref(sub.get()));
 
-  template <class T> auto operator()(const T &lhs, const T &rhs) const -> result_type {
-    return lhs != rhs;
+    if (str && !str->number())
+      str->number(std::make_unique<numeric_string>(str->value()));
   }
-};
+}
 
-template <> struct operator_impl<strict_equal> : strict_equality_operator {
-  using strict_equality_operator::result_type;
+void convert_numeric_literals(any_expr &root) {
+  oper *op = may_down_cast<oper>(deref(root.get()));
 
-  template <class U, class V>
-  auto operator()(const U&, const V&) const -> typename mismatched_types<U, V, result_type>::type {
-    return false;
-  }
+  if (op == nullptr)
+    return;
 
-  template <class T> auto operator()(const T &lhs, const T &rhs) const -> result_type {
-    return lhs == rhs;
-  }
+  for (any_expr &sub : op->operands())
+    convert_numeric_literals(sub);
+
+  convert_numeric_literals(*op);
+}
+
+/// the reads of the variables of a reduction in its body
+struct reduction_reads {
+  int current = 0;
+  int accumulator = 0;
+  bool computed = false; ///< the body may read variables by computed names
 };
 
-template <> struct operator_impl<strict_not_equal> : strict_equality_operator {
-  using strict_equality_operator::result_type;
+/// returns the name of the variable \p n reads, or nullptr if it is computed
+const json::string *variable_name(var &n) {
+  if (n.size() == 0)
+    return nullptr;
 
-  template <class U, class V>
-  auto operator()(const U&, const V&) const -> typename mismatched_types<U, V, result_type>::type {
-    return true;
-  }
+  string_value *name = may_down_cast<string_value>(n.operand(0));
 
-  template <class T> auto operator()(const T &lhs, const T &rhs) const -> result_type {
-    return lhs != rhs;
-  }
-};
+  return name ? &name->value() : nullptr;
+}
 
-template <> struct operator_impl<less> : relational_operator {
-  using relational_operator::result_type;
+/// counts the reads of current and accumulator in \p n, excluding the
+///   bodies of nested sequence operations, which bind their own variables.
+void count_reduction_reads(expr &n, reduction_reads &reads) {
+  const node_traits traits = generic_visit(node_signature{}, &n);
 
-  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
-    return false;
-  }
+  if (traits.op == nullptr)
+    return;
 
-  result_type operator()(array *lv, array *rv) const {
-    return compare_sequence(lv, rv, *this);
-  }
+  if (var *v = may_down_cast<var>(n)) {
+    const json::string *name = variable_name(*v);
 
-  result_type operator()(const json::string &, std::nullptr_t) const {
-    return false;
+    if (name == nullptr)
+      reads.computed = true;
+    else if (*name == "current")
+      ++reads.current;
+    else if (*name == "accumulator")
+      ++reads.accumulator;
+  } else if (may_down_cast<missing>(n) || may_down_cast<missing_some>(n)) {
+    // missing tests variables through the same accessor
+    reads.computed = true;
   }
 
-  result_type operator()(std::nullptr_t, const json::string &) const {
-    return false;
-  }
+  oper::container_type &operands = traits.op->operands();
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    return lhs < rhs;
+  for (std::size_t i = 0; i < operands.size(); ++i)
+    if (!traits.has_body || i != 1)
+      count_reduction_reads(deref(operands[i].get()), reads);
+}
+
+/// true for the operators that a reduction folds natively
+struct folding_operator {
+  template <class expr_t> bool operator()(expr_t &) const {
+    return std::is_same<expr_t, add>::value ||
+           std::is_same<expr_t, multiply>::value ||
+           std::is_same<expr_t, min>::value || std::is_same<expr_t, max>::value;
   }
 };
 
-template <> struct operator_impl<greater> : relational_operator {
-  using relational_operator::result_type;
+/// tests if \p body combines accumulator and current with a folding operator
+bool folding_body(expr &body) {
+  oper *op = may_down_cast<oper>(body);
 
-  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
+  if (op == nullptr || op->size() != 2 ||
+      !generic_visit(folding_operator{}, op))
     return false;
-  }
 
-  result_type operator()(array *lv, array *rv) const {
-    return compare_sequence(lv, rv, *this);
-  }
+  var *lhs = may_down_cast<var>(op->operand(0));
+  var *rhs = may_down_cast<var>(op->operand(1));
 
-  result_type operator()(const json::string &, std::nullptr_t) const {
+  if (lhs == nullptr || rhs == nullptr || lhs->size() != 1 || rhs->size() != 1)
     return false;
-  }
 
-  result_type operator()(std::nullptr_t, const json::string &) const {
-    return false;
-  }
+  const json::string *lname = variable_name(*lhs);
+  const json::string *rname = variable_name(*rhs);
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    return rhs < lhs;
-  }
-};
+  return lname && rname &&
+         ((*lname == "accumulator" && *rname == "current") ||
+          (*lname == "current" && *rname == "accumulator"));
+}
 
-template <> struct operator_impl<less_or_equal> : relational_operator {
-  using relational_operator::result_type;
+void bind_reduction_variables(reduce &n) {
+  expr &body = n.operand(1);
+  reduction_reads reads;
 
-  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
-    return true;
-  }
+  count_reduction_reads(body, reads);
 
-  result_type operator()(array *lv, array *rv) const {
-    return compare_sequence(lv, rv, *this);
-  }
+  unsigned binds = reduce::copies;
 
-  result_type operator()(const json::string &lhs, std::nullptr_t) const {
-    return lhs.empty();
-  }
+  if (!reads.computed && reads.current <= 1)
+    binds |= reduce::moves_current;
 
-  result_type operator()(std::nullptr_t, const json::string &rhs) const {
-    return rhs.empty();
-  }
+  if (!reads.computed && reads.accumulator <= 1)
+    binds |= reduce::moves_accumulator;
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    return lhs <= rhs;
-  }
-};
+  if (folding_body(body))
+    binds |= reduce::folds;
 
-template <> struct operator_impl<greater_or_equal> : relational_operator {
-  using relational_operator::result_type;
+  n.bindings(binds);
+}
 
-  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
-    return true;
-  }
+void bind_reduction_variables(any_expr &root) {
+  oper *op = may_down_cast<oper>(deref(root.get()));
 
-  result_type operator()(array *lv, array *rv) const {
-    return compare_sequence(lv, rv, *this);
-  }
+  if (op == nullptr)
+    return;
 
-  result_type operator()(const json::string &lhs, std::nullptr_t) const {
-    return lhs.empty();
-  }
+  for (any_expr &sub : op->operands())
+    bind_reduction_variables(sub);
 
-  result_type operator()(std::nullptr_t, const json::string &rhs) const {
-    return rhs.empty();
-  }
+  if (reduce *red = may_down_cast<reduce>(*op))
+    bind_reduction_variables(*red);
+}
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    return rhs <= lhs;
-  }
-};
+struct subexpression_finder {
+  struct candidate {
+    any_expr *node;
+    std::size_t hash;
+  };
 
-template <> struct operator_impl<add> : arithmetic_operator {
-  using arithmetic_operator::result_type;
+  struct subtree_info {
+    std::size_t hash;
+    bool pure;
+  };
 
-  result_type operator()(std::nullptr_t, std::nullptr_t) const {
-    return to_expr(nullptr);
-  }
+  std::vector<candidate> candidates;
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    return to_expr(lhs + rhs);
-  }
+  /// hashes the subtree in \p n and records its pure operator nodes
+  /// \param shareable false within the body of sequence operations, where
+  ///        variables refer to the elements.
+  subtree_info collect(any_expr &n, bool shareable);
 };
 
-template <> struct operator_impl<subtract> : arithmetic_operator {
-  using arithmetic_operator::result_type;
+subexpression_finder::subtree_info
+subexpression_finder::collect(any_expr &n, bool shareable) {
+  const node_traits traits = generic_visit(node_signature{}, n.get());
+  subtree_info res{traits.hash, traits.pure};
 
-  result_type operator()(std::nullptr_t, std::nullptr_t) const {
-    return to_expr(nullptr);
-  }
+  if (traits.op == nullptr)
+    return res;
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    return to_expr(lhs - rhs);
-  }
-};
+  oper::container_type &operands = traits.op->operands();
 
-template <> struct operator_impl<multiply> : arithmetic_operator {
-  using arithmetic_operator::result_type;
+  for (std::size_t i = 0; i < operands.size(); ++i) {
+    const bool body = traits.has_body && (i == 1);
+    subtree_info sub = collect(operands[i], shareable && !body);
 
-  result_type operator()(std::nullptr_t, std::nullptr_t) const {
-    return to_expr(nullptr);
+    res.hash = hash_combine(res.hash, sub.hash);
+    res.pure = res.pure && sub.pure;
   }
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    return to_expr(lhs * rhs);
-  }
-};
+  if (shareable && res.pure && traits.worth_sharing)
+    candidates.push_back({&n, res.hash});
 
-template <> struct operator_impl<divide> : arithmetic_operator {
-  using arithmetic_operator::result_type;
+  return res;
+}
 
-  result_type operator()(std::nullptr_t, std::nullptr_t) const {
-    return to_expr(nullptr);
-  }
+void share_common_subexpressions(any_expr &root) {
+  subexpression_finder finder;
 
-  result_type operator()(double lhs, double rhs) const {
-    double res = lhs / rhs;
+  finder.collect(root, true);
 
-    // if (isInteger(res)) return toInt(res);
-    return to_expr(res);
-  }
+  std::vector<subexpression_finder::candidate> &cands = finder.candidates;
 
-  template <class Int_t> result_type operator()(Int_t lhs, Int_t rhs) const {
-    if (lhs % rhs)
-      return (*this)(double(lhs), double(rhs));
+  std::sort(cands.begin(), cands.end(),
+            [](const subexpression_finder::candidate &lhs,
+               const subexpression_finder::candidate &rhs) -> bool {
+              return lhs.hash < rhs.hash;
+            });
 
-    return to_expr(lhs / rhs);
-  }
-};
+  // find all groups first, as wrapping changes the compared subtrees
+  std::vector<std::vector<any_expr *>> groups;
 
-template <> struct operator_impl<modulo> : integer_arithmetic_operator {
-  using integer_arithmetic_operator::result_type;
+  for (auto aa = cands.begin(); aa != cands.end();) {
+    auto zz = std::find_if(aa, cands.end(),
+                           [hash = aa->hash](
+                               const subexpression_finder::candidate &cand)
+                               -> bool { return cand.hash != hash; });
 
-  std::nullptr_t operator()(std::nullptr_t, std::nullptr_t) const {
-    return nullptr;
-  }
+    if (std::distance(aa, zz) == 1) {
+      aa = zz;
+      continue;
+    }
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    if (rhs == 0)
-      return to_expr(nullptr);
+    std::vector<any_expr *> nodes;
 
-    return to_expr(lhs % rhs);
-  }
-};
+    std::transform(aa, zz, std::back_inserter(nodes),
+                   [](const subexpression_finder::candidate &cand)
+                       -> any_expr * { return cand.node; });
+    aa = zz;
 
-template <> struct operator_impl<min> : arithmetic_operator {
-  using arithmetic_operator::result_type;
+    while (nodes.size() > 1) {
+      std::vector<any_expr *> group;
+      expr &model = deref(nodes.front()->get());
+      auto pos = std::partition(
+          nodes.begin(), nodes.end(), [&model](any_expr *cand) -> bool {
+            return !same_subtree(model, deref(cand->get()));
+          });
 
-  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
-    return nullptr;
-  }
+      group.assign(pos, nodes.end());
+      nodes.erase(pos, nodes.end());
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    return to_expr(std::min(lhs, rhs));
+      if (group.size() > 1)
+        groups.push_back(std::move(group));
+    }
   }
-};
 
-template <> struct operator_impl<max> : arithmetic_operator {
-  using arithmetic_operator::result_type;
+  int slot = 0;
 
-  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
-    return nullptr;
-  }
+  for (std::vector<any_expr *> &group : groups) {
+    for (any_expr *node : group) {
+      shared_subexpr &wrapper = deref(new shared_subexpr);
+      oper::container_type operands;
 
-  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
-    return to_expr(std::max(lhs, rhs));
+      operands.emplace_back(std::move(*node));
+      wrapper.set_operands(std::move(operands));
+      wrapper.slot(slot);
+      node->reset(&wrapper);
+    }
+
+    ++slot;
   }
+}
+
+//
+// operand ordering
+
+/// the estimated cost and outcome of evaluating a subtree
+struct cost_estimate {
+  double cost;          ///< relative evaluation cost
+  double truth;         ///< probability that the result is truthy
+  bool pure;            ///< the subtree has no side effects
+  bool nothrow = false; ///< evaluating the subtree cannot throw
 };
 
-template <> struct operator_impl<logical_not> {
-  using result_type = bool;
+/// the number of elements assumed for sequence operations
+constexpr double ASSUMED_ELEMENTS = 16;
 
-  result_type operator()(expr &val) const { return falsy(val); }
+/// estimates the cost of a node, excluding its operands, together with
+///   the truth probability of typical uses.
+struct node_estimate {
+  template <class expr_t> cost_estimate operator()(expr_t &) const {
+#if WITH_JSON_LOGIC_CPP_EXTENSIONS
+    if constexpr (std::is_same<expr_t, regex_match>::value)
+      return {32, 0.5, true};
+#endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
+
+    if constexpr (std::is_base_of<value_base, expr_t>::value) {
+      return {0.5, 0.5, true};
+    } else if constexpr (std::is_same<expr_t, var>::value) {
+      return {4, 0.5, true};
+    } else if constexpr (std::is_same<expr_t, missing>::value ||
+                         std::is_same<expr_t, missing_some>::value) {
+      return {8, 0.5, true};
+    } else if constexpr (std::is_same<expr_t, cat>::value ||
+                         std::is_same<expr_t, merge>::value ||
+                         std::is_same<expr_t, substr>::value ||
+                         std::is_same<expr_t, membership>::value) {
+      return {4, 0.5, true};
+    } else if constexpr (std::is_same<expr_t, equal>::value ||
+                         std::is_same<expr_t, strict_equal>::value) {
+      // a value rarely equals a particular other value
+      return {1, 0.1, true};
+    } else if constexpr (std::is_same<expr_t, not_equal>::value ||
+                         std::is_same<expr_t, strict_not_equal>::value) {
+      return {1, 0.9, true};
+    } else if constexpr (std::is_same<expr_t, log>::value) {
+      return {1, 0.5, false};
+    }
+
+    return {1, 0.5, true};
+  }
 };
 
-template <> struct operator_impl<logical_not_not> {
-  using result_type = bool;
+/// tests whether evaluating a node, excluding its operands, cannot throw
+/// \details
+///   conservative; e.g., == converts mismatched values and may throw,
+///   while === compares their types first.
+struct node_nothrow {
+  template <class expr_t> bool operator()(expr_t &n) const {
+    if constexpr (std::is_base_of<value_base, expr_t>::value) {
+      return true;
+    } else if constexpr (std::is_same<expr_t, var>::value) {
+      // a failed lookup yields the default
+      return n.num_evaluated_operands() >= 1 &&
+             (may_down_cast<string_value>(n.operand(0)) ||
+              may_down_cast<int_value>(n.operand(0)));
+    } else if constexpr (std::is_same<expr_t, missing>::value) {
+      const oper::container_type &operands = n.operands();
+
+      return !operands.empty() &&
+             std::all_of(operands.begin(), operands.end(),
+                         [](const any_expr &op) -> bool {
+                           return may_down_cast<string_value>(*op) != nullptr;
+                         });
+    } else if constexpr (std::is_same<expr_t, strict_equal>::value ||
+                         std::is_same<expr_t, strict_not_equal>::value) {
+      return n.num_evaluated_operands() >= 2;
+    } else if constexpr (std::is_same<expr_t, logical_not>::value ||
+                         std::is_same<expr_t, logical_not_not>::value) {
+      return n.num_evaluated_operands() == 1;
+    } else if constexpr (std::is_same<expr_t, logical_and>::value ||
+                         std::is_same<expr_t, logical_or>::value ||
+                         std::is_same<expr_t, shared_subexpr>::value) {
+      return n.num_evaluated_operands() >= 1;
+    }
 
-  result_type operator()(expr &val) const { return truthy(val); }
+    return false;
+  }
 };
 
-template <> struct operator_impl<cat> : string_operator {
-  using string_operator::result_type;
+/// returns the order of operands that minimizes the expected cost of
+///   finding an operand with the truth value \p decisive, assuming
+///   independent operands; or an empty vector for the original order.
+/// \details
+///   operands that may throw keep their positions, so that the operands
+///   behind them cannot decide the node before they raise their errors.
+std::vector<std::uint32_t> cheapest_order(const std::vector<cost_estimate> &ops,
+                                          bool decisive) {
+  auto rank = [&ops, decisive](std::uint32_t i) -> double {
+    const double chance = decisive ? ops[i].truth : 1 - ops[i].truth;
+
+    return ops[i].cost / std::max(chance, 0.01);
+  };
 
-  result_type operator()(const json::string &lhs,
-                         const json::string &rhs) const {
-    json::string tmp;
+  std::vector<std::uint32_t> res(ops.size());
 
-    tmp.reserve(lhs.size() + rhs.size());
+  std::iota(res.begin(), res.end(), 0);
 
-    tmp.append(lhs.begin(), lhs.end());
-    tmp.append(rhs.begin(), rhs.end());
+  for (auto aa = res.begin(); aa != res.end();) {
+    auto zz = std::find_if(aa, res.end(), [&ops](std::uint32_t i) -> bool {
+      return !ops[i].nothrow;
+    });
 
-    return to_expr(std::move(tmp));
+    std::stable_sort(aa, zz,
+                     [&rank](std::uint32_t lhs, std::uint32_t rhs) -> bool {
+                       return rank(lhs) < rank(rhs);
+                     });
+    aa = (zz == res.end()) ? zz : zz + 1;
   }
-};
 
-template <>
-struct operator_impl<membership>
-    : string_operator // \todo the conversion rules differ
-{
-  using string_operator::result_type;
+  if (std::is_sorted(res.begin(), res.end()))
+    res.clear();
 
-  result_type operator()(const json::string &lhs,
-                         const json::string &rhs) const {
-    const bool res = (rhs.find(lhs) != json::string::npos);
+  return res;
+}
 
-    return to_expr(res);
-  }
-};
+/// estimates the cost of the subtree in \p n and sets the test order
+///   of the and and or nodes within it.
+cost_estimate estimate_and_order(expr &n, const logic_options &opts) {
+  cost_estimate res = generic_visit(node_estimate{}, &n);
+  const node_traits traits = generic_visit(node_signature{}, &n);
+
+  res.nothrow = generic_visit(node_nothrow{}, &n);
+
+  if (traits.op == nullptr)
+    return res;
+
+  const oper::container_type &operands = traits.op->operands();
+  std::vector<cost_estimate> subs;
+
+  subs.reserve(operands.size());
+
+  for (std::size_t i = 0; i < operands.size(); ++i) {
+    const cost_estimate sub = estimate_and_order(deref(operands[i].get()), opts);
+    const double repeat = (traits.has_body && i == 1) ? ASSUMED_ELEMENTS : 1;
+
+    res.cost += sub.cost * repeat;
+    res.pure = res.pure && sub.pure;
+    res.nothrow = res.nothrow && sub.nothrow;
+    subs.push_back(sub);
+  }
+
+  if (subs.empty())
+    return res;
+
+  if (may_down_cast<logical_not>(n)) {
+    res.truth = 1 - subs.front().truth;
+  } else if (may_down_cast<logical_not_not>(n) ||
+             may_down_cast<shared_subexpr>(n)) {
+    res.truth = subs.front().truth;
+  } else if (logical_nary *logop = may_down_cast<logical_nary>(n)) {
+    const bool isAnd = may_down_cast<logical_and>(n) != nullptr;
+    double allFalse = 1;
+    double allTrue = 1;
+
+    for (const cost_estimate &sub : subs) {
+      allFalse *= 1 - sub.truth;
+      allTrue *= sub.truth;
+    }
+
+    res.truth = isAnd ? allTrue : 1 - allFalse;
+
+    // an indexed or selects its operand by lookup
+    if (logical_or *logor = may_down_cast<logical_or>(n);
+        logor && logor->dispatch())
+      return res;
+
+    // operands with side effects are evaluated as written
+    if (res.pure && opts.reorder_operands)
+      logop->test_order(cheapest_order(subs, !isAnd));
+
+    if (res.pure && opts.adaptive_order &&
+        subs.size() <= operand_statistics::MAX_OPERANDS) {
+      std::uint32_t fixed = 0;
+
+      for (std::size_t i = 0; i < subs.size(); ++i)
+        if (!subs[i].nothrow)
+          fixed |= std::uint32_t(1) << i;
+
+      logop->statistics(std::make_unique<operand_statistics>(
+          subs.size(), logop->test_order(), fixed));
+    }
+  }
+
+  return res;
+}
+
+void order_logical_operands(any_expr &root, const logic_options &opts) {
+  estimate_and_order(*root, opts);
+}
+} // namespace
+
+//
+// to value_base conversion
+
+any_expr to_expr(std::nullptr_t) { return any_expr(new null_value); }
+any_expr to_expr(bool val) { return any_expr(new bool_value(val)); }
+any_expr to_expr(std::int64_t val) { return any_expr(new int_value(val)); }
+any_expr to_expr(std::uint64_t val) {
+  return any_expr(new unsigned_int_value(val));
+}
+any_expr to_expr(double val) { return any_expr(new real_value(val)); }
+any_expr to_expr(json::string val) {
+  return any_expr(new string_value(std::move(val)));
+}
+
+any_expr to_expr(const json::array &val) {
+  oper::container_type elems;
+
+  std::transform(val.begin(), val.end(), std::back_inserter(elems),
+                 [](const json::value &el) -> any_expr { return to_expr(el); });
+
+  array &arr = deref(new array);
+
+  arr.set_operands(std::move(elems));
+  return any_expr(&arr);
+}
+
+any_expr to_expr(const json::object &val) {
+  object_value::container_type elems;
+
+  elems.reserve(val.size());
+
+  for (const json::key_value_pair &el : val)
+    elems.emplace_back(scratch_string(el.key()), to_expr(el.value()));
+
+  object_value &obj = deref(new object_value);
+
+  obj.set_elements(std::move(elems));
+  return any_expr(&obj);
+}
+
+any_expr to_expr(const json::value &n) {
+  any_expr res;
+
+  switch (n.kind()) {
+  case json::kind::string: {
+    res = to_expr(scratch_string(n.get_string()));
+    break;
+  }
+
+  case json::kind::int64: {
+    res = to_expr(n.get_int64());
+    break;
+  }
+
+  case json::kind::uint64: {
+    res = to_expr(n.get_uint64());
+    break;
+  }
+
+  case json::kind::double_: {
+    res = to_expr(n.get_double());
+    break;
+  }
+
+  case json::kind::bool_: {
+    res = to_expr(n.get_bool());
+    break;
+  }
+
+  case json::kind::null: {
+    res = to_expr(nullptr);
+    break;
+  }
+
+  case json::kind::array: {
+    res = to_expr(n.get_array());
+    break;
+  }
+
+  case json::kind::object: {
+    res = to_expr(n.get_object());
+    break;
+  }
+
+  default:
+    unsupported();
+  }
+
+  assert(res.get());
+  return res;
+}
+
+namespace {
+
+//
+// coercion functions
+
+struct internal_coercion_error {};
+struct not_int64_error : internal_coercion_error {};
+struct not_uint64_error : internal_coercion_error {};
+struct unpacked_array_req : internal_coercion_error {};
+
+/// conversion to int64
+/// \{
+inline std::int64_t to_concrete(std::int64_t v, const std::int64_t &) {
+  return v;
+}
+inline std::int64_t to_concrete(const json::string &str, const std::int64_t &) {
+  return parse_number<std::int64_t>(str);
+}
+inline std::int64_t to_concrete(double v, const std::int64_t &) { return v; }
+inline std::int64_t to_concrete(bool v, const std::int64_t &) { return v; }
+inline std::int64_t to_concrete(std::nullptr_t, const std::int64_t &) {
+  return 0;
+}
+
+inline std::int64_t to_concrete(std::uint64_t v, const std::int64_t &) {
+  if (v > std::uint64_t(std::numeric_limits<std::int64_t>::max())) {
+    CXX_UNLIKELY;
+    throw not_int64_error{};
+  }
+
+  return v;
+}
+/// \}
+
+/// conversion to uint64
+/// \{
+inline std::uint64_t to_concrete(std::uint64_t v, const std::uint64_t &) {
+  return v;
+}
+inline std::uint64_t to_concrete(const json::string &str,
+                                 const std::uint64_t &) {
+  return parse_number<std::uint64_t>(str);
+}
+inline std::uint64_t to_concrete(double v, const std::uint64_t &) { return v; }
+inline std::uint64_t to_concrete(bool v, const std::uint64_t &) { return v; }
+inline std::uint64_t to_concrete(std::nullptr_t, const std::uint64_t &) {
+  return 0;
+}
+
+inline std::uint64_t to_concrete(std::int64_t v, const std::uint64_t &) {
+  if (v < 0) {
+    CXX_UNLIKELY;
+    throw not_uint64_error{};
+  }
+
+  return v;
+}
+/// \}
+
+/// conversion to double
+/// \{
+inline double to_concrete(const json::string &str, const double &) {
+  return parse_number<double>(str);
+}
+inline double to_concrete(std::int64_t v, const double &) { return v; }
+inline double to_concrete(std::uint64_t v, const double &) { return v; }
+inline double to_concrete(double v, const double &) { return v; }
+inline double to_concrete(bool v, const double &) { return v; }
+inline double to_concrete(std::nullptr_t, const double &) { return 0; }
+/// \}
+
+/// appends the text of a value to \p res; numbers are formatted
+///   as std::to_string formats them.
+/// \{
+template <class Val> inline void append_text(json::string &res, Val v) {
+  // a double in fixed notation has up to 309 integral digits
+  char buf[std::numeric_limits<double>::max_exponent10 + 16];
+  std::to_chars_result txt;
+
+  if constexpr (std::is_floating_point<Val>::value)
+    txt = std::to_chars(buf, std::end(buf), v, std::chars_format::fixed, 6);
+  else
+    txt = std::to_chars(buf, std::end(buf), v);
+
+  assert(txt.ec == std::errc{});
+  res.append(json::string_view(buf, txt.ptr - buf));
+}
+
+inline void append_text(json::string &res, bool v) {
+  res.append(v ? "true" : "false");
+}
+inline void append_text(json::string &res, const json::string &s) {
+  res.append(s);
+}
+inline void append_text(json::string &res, std::nullptr_t) {
+  res.append("null");
+}
+/// \}
+
+/// conversion to string
+/// \{
+template <class Val>
+inline json::string to_concrete(Val v, const json::string &) {
+  json::string res{scratch_storage()};
+
+  append_text(res, v);
+  return res;
+}
+
+inline json::string to_concrete(bool v, const json::string &) {
+  return scratch_string(v ? "true" : "false");
+}
+inline json::string to_concrete(const json::string &s, const json::string &) {
+  return s;
+}
+inline json::string to_concrete(std::nullptr_t, const json::string &) {
+  return scratch_string("null");
+}
+/// \}
+
+/// conversion to boolean
+///   implements truthy, falsy as described by https://jsonlogic.com/truthy.html
+/// \{
+inline bool to_concrete(bool v, const bool &) { return v; }
+inline bool to_concrete(std::int64_t v, const bool &) { return v; }
+inline bool to_concrete(std::uint64_t v, const bool &) { return v; }
+inline bool to_concrete(double v, const bool &) { return v; }
+inline bool to_concrete(const json::string &v, const bool &) {
+  return v.size() != 0;
+}
+inline bool to_concrete(std::nullptr_t, const bool &) { return false; }
+
+// \todo logical_not sure if conversions from arrays to values should be
+// supported like this
+inline bool to_concrete(const array &v, const bool &) {
+  return v.num_evaluated_operands();
+}
+/// \}
+
+struct comparison_operator_base {
+  enum {
+    defined_for_string = true,
+    defined_for_real = true,
+    defined_for_integer = true,
+    defined_for_boolean = true,
+    defined_for_null = true,
+    defined_for_array = true
+  };
+
+  using result_type = bool;
+};
+
+/// \brief a strict equality operator operates on operands of the same
+///        type. The operation on two different types returns false.
+///        NO type coercion is performed.
+struct strict_equality_operator : comparison_operator_base {
+  std::tuple<bool, bool> coerce(array *, array *) {
+    return {true, false}; // arrays are never equal
+  }
+
+  template <class LhsT, class RhsT>
+  std::tuple<LhsT, RhsT> coerce(LhsT *lv, RhsT *rv) {
+    return {std::move(*lv), std::move(*rv)};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
+                                                    std::nullptr_t) {
+    return {nullptr, nullptr}; // two null pointers are equal
+  }
+
+  template <class LhsT>
+  std::tuple<LhsT, std::nullptr_t> coerce(LhsT *lv, std::nullptr_t) {
+    return {std::move(*lv), nullptr};
+  }
+
+  template <class RhsT>
+  std::tuple<std::nullptr_t, RhsT> coerce(std::nullptr_t, RhsT *rv) {
+    return {nullptr, std::move(*rv)};
+  }
+};
+
+struct numeric_binary_operator_base {
+  std::tuple<double, double> coerce(double *lv, double *rv) {
+    return {*lv, *rv};
+  }
+
+  std::tuple<double, double> coerce(double *lv, std::int64_t *rv) {
+    return {*lv, to_concrete(*rv, *lv)};
+  }
+
+  std::tuple<double, double> coerce(double *lv, std::uint64_t *rv) {
+    return {*lv, to_concrete(*rv, *lv)};
+  }
+
+  std::tuple<double, double> coerce(std::int64_t *lv, double *rv) {
+    return {to_concrete(*lv, *rv), *rv};
+  }
+
+  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv,
+                                                std::int64_t *rv) {
+    return {*lv, *rv};
+  }
+
+  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv,
+                                                std::uint64_t *rv) {
+    return {*lv, to_concrete(*rv, *lv)};
+  }
+
+  std::tuple<double, double> coerce(std::uint64_t *lv, double *rv) {
+    return {to_concrete(*lv, *rv), *rv};
+  }
+
+  std::tuple<std::int64_t, std::int64_t> coerce(std::uint64_t *lv,
+                                                std::int64_t *rv) {
+    return {to_concrete(*lv, *rv), *rv};
+  }
+
+  std::tuple<std::uint64_t, std::uint64_t> coerce(std::uint64_t *lv,
+                                                  std::uint64_t *rv) {
+    return {*lv, *rv};
+  }
+};
+
+/// \brief an equality operator compares two values. if_expr the
+///        values have a different type, type coercion is performed
+///        on one of the operands.
+struct relational_operator_base : numeric_binary_operator_base {
+  using numeric_binary_operator_base::coerce;
+
+  std::tuple<double, double> coerce(double *lv, json::string *rv) {
+    return {*lv, to_concrete(*rv, *lv)};
+  }
+
+  std::tuple<double, double> coerce(double *lv, bool *rv) {
+    return {*lv, to_concrete(*rv, *lv)};
+  }
+
+  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv,
+                                                json::string *rv) {
+    return {*lv, to_concrete(*rv, *lv)};
+  }
+
+  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv, bool *rv) {
+    return {*lv, to_concrete(*rv, *lv)};
+  }
+
+  std::tuple<std::uint64_t, std::uint64_t> coerce(std::uint64_t *lv,
+                                                  json::string *rv) {
+    return {*lv, to_concrete(*rv, *lv)};
+  }
+
+  std::tuple<std::uint64_t, std::uint64_t> coerce(std::uint64_t *lv, bool *rv) {
+    return {*lv, to_concrete(*rv, *lv)};
+  }
+
+  std::tuple<double, double> coerce(json::string *lv, double *rv) {
+    return {to_concrete(*lv, *rv), *rv};
+  }
+
+  std::tuple<double, double> coerce(bool *lv, double *rv) {
+    return {to_concrete(*lv, *rv), *rv};
+  }
+
+  std::tuple<std::int64_t, std::int64_t> coerce(json::string *lv,
+                                                std::int64_t *rv) {
+    return {to_concrete(*lv, *rv), *rv};
+  }
+
+  std::tuple<std::int64_t, std::int64_t> coerce(bool *lv, std::int64_t *rv) {
+    return {to_concrete(*lv, *rv), *rv};
+  }
+
+  std::tuple<std::uint64_t, std::uint64_t> coerce(json::string *lv,
+                                                  std::uint64_t *rv) {
+    return {to_concrete(*lv, *rv), *rv};
+  }
+
+  std::tuple<std::uint64_t, std::uint64_t> coerce(bool *lv, std::uint64_t *rv) {
+    return {to_concrete(*lv, *rv), *rv};
+  }
+
+  std::tuple<bool, bool> coerce(json::string *, bool *rv) {
+    // strings and boolean are never equal
+    return {!*rv, *rv};
+  }
+
+  std::tuple<bool, bool> coerce(bool *lv, json::string *) {
+    // strings and boolean are never equal
+    return {*lv, !*lv};
+  }
+
+  // strings are compared in place, so that literals need not be copied
+  std::tuple<json::string_view, json::string_view> coerce(json::string *lv,
+                                                          json::string *rv) {
+    return {*lv, *rv};
+  }
+
+  std::tuple<bool, bool> coerce(bool *lv, bool *rv) { return {*lv, *rv}; }
+};
+
+struct equality_operator : relational_operator_base, comparison_operator_base {
+  using relational_operator_base::coerce;
+
+  // due to special conversion rules, the coercion function may just produce
+  //   the result instead of just unpacking and coercing values.
+
+  std::tuple<bool, bool> coerce(array *, array *) {
+    return {true, false}; // arrays are never equal
+  }
+
+  template <class T> std::tuple<bool, bool> coerce(T *lv, array *rv) {
+    // an array may be compared to a value_base
+    //   (1) *lv == arr[0], iff the array has exactly one element
+    if (rv->num_evaluated_operands() == 1)
+      throw unpacked_array_req{};
+
+    //   (2) or if [] and *lv converts to false
+    if (rv->num_evaluated_operands() > 1)
+      return {false, true};
+
+    const bool convToFalse = to_concrete(*lv, false) == false;
+
+    return {convToFalse, true /* zero elements */};
+  }
+
+  template <class T> std::tuple<bool, bool> coerce(array *lv, T *rv) {
+    // see comments membership coerce(T*,array*)
+    if (lv->num_evaluated_operands() == 1)
+      throw unpacked_array_req{};
+
+    if (lv->num_evaluated_operands() > 1)
+      return {false, true};
+
+    const bool convToFalse = to_concrete(*rv, false) == false;
+
+    return {true /* zero elements */, convToFalse};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
+                                                    std::nullptr_t) {
+    return {nullptr, nullptr}; // two null pointers are equal
+  }
+
+  template <class T> std::tuple<bool, bool> coerce(T *, std::nullptr_t) {
+    return {false, true}; // null pointer is only equal to itself
+  }
+
+  template <class T> std::tuple<bool, bool> coerce(std::nullptr_t, T *) {
+    return {true, false}; // null pointer is only equal to itself
+  }
+
+  std::tuple<bool, bool> coerce(array *, std::nullptr_t) {
+    return {true, false}; // null pointer is only equal to itself
+  }
+
+  std::tuple<bool, bool> coerce(std::nullptr_t, array *) {
+    return {true, false}; // null pointer is only equal to itself
+  }
+};
+
+struct relational_operator : relational_operator_base,
+                             comparison_operator_base {
+  using relational_operator_base::coerce;
+
+  std::tuple<array *, array *> coerce(array *lv, array *rv) { return {lv, rv}; }
+
+  template <class T> std::tuple<bool, bool> coerce(T *lv, array *rv) {
+    // an array may be equal to another value_base if
+    //   (1) *lv == arr[0], iff the array has exactly one element
+    if (rv->num_evaluated_operands() == 1)
+      throw unpacked_array_req{};
+
+    //   (2) or if [] and *lv converts to false
+    if (rv->num_evaluated_operands() > 1)
+      return {false, true};
+
+    const bool convToTrue = to_concrete(*lv, true) == true;
+
+    return {convToTrue, false /* zero elements */};
+  }
+
+  template <class T> std::tuple<bool, bool> coerce(array *lv, T *rv) {
+    // see comments membership coerce(T*,array*)
+    if (lv->num_evaluated_operands() == 1)
+      throw unpacked_array_req{};
+
+    if (lv->num_evaluated_operands() > 1)
+      return {false, true};
+
+    const bool convToTrue = to_concrete(*rv, true) == true;
+
+    return {false /* zero elements */, convToTrue};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
+                                                    std::nullptr_t) {
+    return {nullptr, nullptr}; // two null pointers are equal
+  }
+
+  std::tuple<bool, bool> coerce(bool *lv, std::nullptr_t) {
+    return {*lv, false}; // null pointer -> false
+  }
+
+  std::tuple<std::int64_t, std::int64_t> coerce(std::int64_t *lv,
+                                                std::nullptr_t) {
+    return {*lv, 0}; // null pointer -> 0
+  }
+
+  std::tuple<std::uint64_t, std::uint64_t> coerce(std::uint64_t *lv,
+                                                  std::nullptr_t) {
+    return {*lv, 0}; // null pointer -> 0
+  }
+
+  std::tuple<double, double> coerce(double *lv, std::nullptr_t) {
+    return {*lv, 0}; // null pointer -> 0.0
+  }
+
+  std::tuple<json::string_view, std::nullptr_t> coerce(json::string *lv,
+                                                       std::nullptr_t) {
+    return {*lv, nullptr}; // requires special handling
+  }
+
+  std::tuple<bool, bool> coerce(std::nullptr_t, bool *rv) {
+    return {false, *rv}; // null pointer -> false
+  }
+
+  std::tuple<std::int64_t, std::int64_t> coerce(std::nullptr_t,
+                                                std::int64_t *rv) {
+    return {0, *rv}; // null pointer -> 0
+  }
+
+  std::tuple<std::uint64_t, std::uint64_t> coerce(std::nullptr_t,
+                                                  std::uint64_t *rv) {
+    return {0, *rv}; // null pointer -> 0
+  }
+
+  std::tuple<double, double> coerce(std::nullptr_t, double *rv) {
+    return {0, *rv}; // null pointer -> 0
+  }
+
+  std::tuple<std::nullptr_t, json::string_view> coerce(std::nullptr_t,
+                                                       json::string *rv) {
+    return {nullptr, *rv}; // requires special handling
+  }
+};
+// @}
+
+// Arith
+struct arithmetic_operator : numeric_binary_operator_base {
+  enum {
+    defined_for_string = false,
+    defined_for_real = true,
+    defined_for_integer = true,
+    defined_for_boolean = false,
+    defined_for_null = true,
+    defined_for_array = false
+  };
+
+  using result_type = any_expr;
+
+  using numeric_binary_operator_base::coerce;
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(double *, std::nullptr_t) {
+    return {nullptr, nullptr};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::int64_t *,
+                                                    std::nullptr_t) {
+    return {nullptr, nullptr};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::uint64_t *,
+                                                    std::nullptr_t) {
+    return {nullptr, nullptr};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t, double *) {
+    return {nullptr, nullptr};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
+                                                    std::int64_t *) {
+    return {nullptr, nullptr};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
+                                                    std::uint64_t *) {
+    return {nullptr, nullptr};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
+                                                    std::nullptr_t) {
+    return {nullptr, nullptr};
+  }
+};
+
+struct integer_arithmetic_operator : arithmetic_operator {
+  enum {
+    defined_for_string = false,
+    defined_for_real = false,
+    defined_for_integer = true,
+    defined_for_boolean = false,
+    defined_for_null = false,
+    defined_for_array = false
+  };
+
+  using arithmetic_operator::coerce;
+};
+
+struct string_operator {
+  enum {
+    defined_for_string = true,
+    defined_for_real = false,
+    defined_for_integer = false,
+    defined_for_boolean = false,
+    defined_for_null = false,
+    defined_for_array = false
+  };
+
+  using result_type = any_expr;
+
+  std::tuple<json::string, json::string> coerce(json::string *lv,
+                                                json::string *rv) {
+    return {std::move(*lv), std::move(*rv)};
+  }
+};
+
+struct array_operator {
+  enum {
+    defined_for_string = false,
+    defined_for_real = false,
+    defined_for_integer = false,
+    defined_for_boolean = false,
+    defined_for_null = false,
+    defined_for_array = true
+  };
+
+  using result_type = any_expr;
+
+  std::tuple<array *, array *> coerce(array *lv, array *rv) { return {lv, rv}; }
+};
+
+/*
+  any_expr convert(any_expr val, ...)
+  {
+    return val;
+  }
+*/
+
+any_expr convert(any_expr val, const arithmetic_operator &) {
+  struct arithmetic_converter : forwarding_visitor {
+    explicit arithmetic_converter(any_expr val) : res(std::move(val)) {}
+
+    void visit(expr &) final { throw_type_error(); }
+
+    // defined for the following types
+    void visit(int_value &) final {}
+    void visit(unsigned_int_value &) final {}
+    void visit(real_value &) final {}
+    void visit(null_value &) final {}
+
+    // need to convert values
+    void visit(string_value &el) final {
+      double dd = to_concrete(el.value(), double{});
+      std::int64_t ii = to_concrete(el.value(), std::int64_t{});
+      // uint?
+
+      res = (dd != ii) ? to_expr(dd) : to_expr(ii);
+    }
+
+    void visit(bool_value &) final {
+      // \todo correct?
+      res = to_expr(nullptr);
+    }
+
+    any_expr result() && { return std::move(res); }
+
+  private:
+    any_expr res;
+  };
+
+  expr *node = val.get();
+  arithmetic_converter conv{std::move(val)};
+
+  node->accept(conv);
+  return std::move(conv).result();
+}
+
+/*
+  any_expr convert(any_expr val, const integer_arithmetic_operator&)
+  {
+    struct integer_arithmetic_converter : forwarding_visitor
+    {
+        explicit
+        integer_arithmetic_converter(any_expr val)
+        : res(std::move(val))
+        {}
+
+        void visit(expr&)               final { throw_type_error(); }
+
+        // defined for the following types
+        void visit(int_value&)          final {}
+        void visit(unsigned_int_value&) final {}
+
+        // need to convert values
+        void visit(string_value& el) final
+        {
+          res = to_expr(to_concrete(el.value(), std::int64_t{}));
+        }
+
+        void visit(bool_value& el) final
+        {
+          res = to_expr(to_concrete(el.value(), std::int64_t{}));
+        }
+
+        void visit(real_value& el) final
+        {
+          res = to_expr(to_concrete(el.value(), std::int64_t{}));
+        }
+
+        void visit(null_value&) final
+        {
+          res = to_expr(std::int64_t{0});
+        }
+
+        any_expr result() && { return std::move(res); }
+
+      private:
+        any_expr res;
+    };
+
+    expr*                        node = val.get();
+    integer_arithmetic_converter conv{std::move(val)};
+
+    node->accept(conv);
+    return std::move(conv).result();
+  }
+*/
+
+template <class value_t> struct unpacker : forwarding_visitor {
+  void assign(value_t &lhs, const value_t &val) { lhs = val; }
+
+  template <class U> void assign(value_t &lhs, const U &val) {
+    lhs = to_concrete(val, lhs);
+  }
+
+  CXX_NORETURN
+  void visit(expr &) final { throw_type_error(); }
+
+  // defined for the following types
+  void visit(string_value &el) final { assign(res, el.value()); }
+
+  // need to convert values
+  void visit(bool_value &el) final { assign(res, el.value()); }
+
+  void visit(int_value &el) final { assign(res, el.value()); }
+
+  void visit(unsigned_int_value &el) final { assign(res, el.value()); }
+
+  void visit(real_value &el) final { assign(res, el.value()); }
+
+  void visit(null_value &el) final { assign(res, el.value()); }
+
+  void visit(array &el) final {
+    if constexpr (std::is_same<value_t, bool>::value) {
+      CXX_LIKELY;
+      return assign(res, el);
+    }
+
+    throw_type_error();
+  }
+
+  void visit(object_value &) final {
+    // objects are truthy
+    if constexpr (std::is_same<value_t, bool>::value) {
+      CXX_LIKELY;
+      res = true;
+      return;
+    }
+
+    throw_type_error();
+  }
+
+  value_t result() && { return std::move(res); }
+
+private:
+  value_t res;
+};
+
+template <class T> T unpack_value(expr &expr) {
+  unpacker<T> unpack;
+
+  expr.accept(unpack);
+  return std::move(unpack).result();
+}
+
+template <class T> T unpack_value(const any_expr &el) {
+  return unpack_value<T>(*el);
+}
+
+template <class T> T unpack_value(any_expr &&el) {
+  return unpack_value<T>(*el);
+}
+
+//
+// Json Logic - truthy/falsy
+bool truthy(expr &el) { return unpack_value<bool>(el); }
+bool truthy(any_expr &&el) { return unpack_value<bool>(std::move(el)); }
+bool falsy(expr &el) { return !truthy(el); }
+// bool falsy(any_expr&& el)  { return !truthy(std::move(el)); }
+} // namespace
+
+bool truthy(const any_expr &el) { return unpack_value<bool>(el); }
+bool falsy(const any_expr &el) { return !truthy(el); }
+
+//
+// cloning
+
+namespace {
+any_expr clone_expr(const any_expr &expr);
+
+struct expr_cloner {
+  /// init functions that set up children
+  /// \{
+  expr &init(const oper &, oper &) const;
+  expr &init(const object_value &, object_value &) const;
+  /// \}
+
+  /// function family for type specific cloning
+  /// \param  n       the original node
+  /// \param  unnamed a tag parameter to summarily handle groups of types
+  /// \return the cloned node
+  /// \{
+  CXX_NORETURN
+  expr &clone(const expr &, const expr &) const { unsupported(); }
+
+  expr &clone(const error &, const error &) const { return deref(new error); }
+
+  template <class value_t>
+  expr &clone(const value_t &n, const value_base &) const {
+    return deref(new value_t(n.value()));
+  }
+
+  expr &clone(const string_value &n, const value_base &) const {
+    string_value &res = deref(new string_value(scratch_string(n.value())));
+
+    if (const numeric_string *num = n.number())
+      res.number(std::make_unique<numeric_string>(*num));
+
+    return res;
+  }
+
+  template <class oper_t> expr &clone(const oper_t &n, const oper &) const {
+    return init(n, deref(new oper_t));
+  }
+
+  expr &clone(const var &n, const oper &) const {
+    var &res = deref(new var);
+
+    res.num(n.num());
+    return init(n, res);
+  }
+
+  expr &clone(const reduce &n, const oper &) const {
+    reduce &res = deref(new reduce);
+
+    res.bindings(n.bindings());
+    return init(n, res);
+  }
+
+  expr &clone(const shared_subexpr &n, const oper &) const {
+    shared_subexpr &res = deref(new shared_subexpr);
+
+    res.slot(n.slot());
+    return init(n, res);
+  }
+
+  template <class oper_t>
+  expr &clone(const oper_t &n, const logical_nary &) const {
+    oper_t &res = deref(new oper_t);
+
+    res.test_order(current_test_order(n));
+
+    if (n.statistics())
+      res.statistics(std::make_unique<operand_statistics>(
+          n.size(), res.test_order(), n.statistics()->fixed_operands()));
+
+    init(n, res);
+
+    // the index refers to the nodes of the clone
+    if constexpr (std::is_same<oper_t, logical_or>::value)
+      if (n.dispatch())
+        index_equality_ladder(res);
+
+    return res;
+  }
+
+  expr &clone(const if_expr &n, const oper &) const {
+    if_expr &res = deref(new if_expr);
+
+    init(n, res);
+
+    if (n.dispatch())
+      index_equality_ladder(res);
+
+    return res;
+  }
+
+  expr &clone(const object_value &n, const object_value &) const {
+    return init(n, deref(new object_value));
+  }
+  /// \}
+
+  template <class expr_t> expr *operator()(expr_t &n) { return &clone(n, n); }
+};
+
+expr &expr_cloner::init(const oper &src, oper &tgt) const {
+  oper::container_type children;
+
+  std::transform(src.operands().begin(), src.operands().end(),
+                 std::back_inserter(children),
+                 [](const any_expr &e) -> any_expr { return clone_expr(e); });
+
+  tgt.set_operands(std::move(children));
+  tgt.memo_slot(src.memo_slot());
+  return tgt;
+}
+
+expr &expr_cloner::init(const object_value &src, object_value &tgt) const {
+  object_value::container_type elems;
+
+  elems.reserve(src.size());
+
+  std::transform(
+      src.begin(), src.end(), std::back_inserter(elems),
+      [](const object_value::value_type &entry) -> object_value::value_type {
+        return {scratch_string(entry.first), clone_expr(entry.second)};
+      });
+
+  tgt.set_elements(std::move(elems));
+  return tgt;
+}
+
+any_expr clone_expr(const any_expr &exp) {
+  // e.g., reduce over a value that is not an array has no result
+  if (!exp)
+    return nullptr;
+
+  return any_expr(generic_visit(expr_cloner{}, exp.get()));
+}
+
+template <class expr_t, class fn_t, class alt_fn_t>
+auto with_type(expr *e, fn_t fn, alt_fn_t altfn) -> decltype(altfn()) {
+  if (e == nullptr) {
+    CXX_UNLIKELY;
+    return altfn();
+  }
+
+  expr_t *casted = may_down_cast<expr_t>(*e);
+
+  return casted ? fn(*casted) : altfn();
+}
+
+/// true for operators that convert a string compared with a number to
+///   the type of the number
+template <class binary_op_t>
+constexpr bool converts_numeric_strings =
+    std::is_base_of<relational_operator_base, binary_op_t>::value;
+
+template <class T>
+constexpr bool is_number_pointer = std::is_same<T, std::int64_t *>::value ||
+                                   std::is_same<T, std::uint64_t *>::value ||
+                                   std::is_same<T, double *>::value;
+
+//
+// binary operator - double dispatch pattern
+
+template <class binary_op_t, class lhs_value_t>
+struct binary_operator_visitor_2 : forwarding_visitor {
+  using result_type = typename binary_op_t::result_type;
+
+  binary_operator_visitor_2(lhs_value_t lval, binary_op_t oper)
+      : lv(lval), op(oper), res() {}
+
+  template <class rhs_value_t> void calc(rhs_value_t rv) {
+    if constexpr (std::is_same<lhs_value_t, string_value *>::value) {
+      // a literal is compared with a number by its numeric interpretation,
+      //   and otherwise in place. Other operators may move from it.
+      if constexpr (converts_numeric_strings<binary_op_t>) {
+        if constexpr (is_number_pointer<rhs_value_t>) {
+          auto num = lv->number()->as(*rv);
+
+          return apply(&num, rv);
+        }
+
+        return apply(&lv->value(), rv);
+      }
+
+      json::string str = scratch_string(lv->value());
+
+      apply(&str, rv);
+    } else {
+      apply(lv, rv);
+    }
+  }
+
+  void visit(expr &) final { throw_type_error(); }
+
+  void visit(string_value &n) final {
+    if constexpr (binary_op_t::defined_for_string) {
+      if (const numeric_string *literal = n.number()) {
+        if constexpr (converts_numeric_strings<binary_op_t>) {
+          if constexpr (is_number_pointer<lhs_value_t>) {
+            auto num = literal->as(*lv);
+
+            return calc(&num);
+          }
+
+          // relational operators compare strings in place
+          return calc(&n.value());
+        }
+
+        json::string str = scratch_string(n.value());
+
+        return calc(&str);
+      }
+
+      return calc(&n.value());
+    }
+
+    throw_type_error();
+  }
+
+  void visit(null_value &) final {
+    if constexpr (binary_op_t::defined_for_null)
+      return calc(nullptr);
+
+    throw_type_error();
+  }
+
+  void visit(bool_value &n) final {
+    if constexpr (binary_op_t::defined_for_boolean)
+      return calc(&n.value());
+
+    throw_type_error();
+  }
+
+  void visit(int_value &n) final {
+    if constexpr (binary_op_t::defined_for_integer) {
+      try {
+        return calc(&n.value());
+      } catch (const not_int64_error &ex) {
+        if (n.value() < 0) {
+          CXX_UNLIKELY;
+          throw std::range_error{
+              "unable to consolidate uint>max(int) with int<0"};
+        }
+      }
+
+      std::uint64_t alt = n.value();
+      return calc(&alt);
+    }
+
+    throw_type_error();
+  }
+
+  void visit(unsigned_int_value &n) final {
+    if constexpr (binary_op_t::defined_for_integer) {
+      try {
+        return calc(&n.value());
+      } catch (const not_uint64_error &ex) {
+        if (n.value() > std::uint64_t(std::numeric_limits<std::int64_t>::max)) {
+          CXX_UNLIKELY;
+          throw std::range_error{
+              "unable to consolidate int<0 with uint>max(int)"};
+        }
+      }
+
+      std::int64_t alt = n.value();
+      return calc(&alt);
+    }
+
+    throw_type_error();
+  }
+
+  void visit(real_value &n) final {
+    if constexpr (binary_op_t::defined_for_real)
+      return calc(&n.value());
+
+    throw_type_error();
+  }
+
+  void visit(array &n) final {
+    if constexpr (binary_op_t::defined_for_array) {
+      try {
+        calc(&n);
+      } catch (const unpacked_array_req &) {
+        assert(n.num_evaluated_operands() == 1);
+        n.operand(0).accept(*this);
+      }
+
+      return;
+    }
+
+    throw_type_error();
+  }
+
+  result_type result() && { return std::move(res); }
+
+private:
+  lhs_value_t lv;
+  binary_op_t op;
+  result_type res;
+
+  template <class lhs_t, class rhs_t> void apply(lhs_t lhs, rhs_t rhs) {
+    auto [ll, rr] = op.coerce(lhs, rhs);
+
+    res = op(std::move(ll), std::move(rr));
+  }
+};
+
+template <class binary_op_t>
+struct binary_operator_visitor : forwarding_visitor {
+  using result_type = typename binary_op_t::result_type;
+
+  binary_operator_visitor(binary_op_t oper, expr &rhsarg)
+      : op(oper), rhs(rhsarg), res() {}
+
+  template <class LhsValue> void calc(LhsValue lv) {
+    using rhs_visitor = binary_operator_visitor_2<binary_op_t, LhsValue>;
+
+    rhs_visitor vis{lv, op};
+
+    rhs.accept(vis);
+    res = std::move(vis).result();
+  }
+
+  void visit(string_value &n) final {
+    if constexpr (binary_op_t::defined_for_string) {
+      // literals with a numeric interpretation are passed as node
+      //   (see binary_operator_visitor_2::calc)
+      if (n.number())
+        return calc(&n);
+
+      return calc(&n.value());
+    }
+
+    throw_type_error();
+  }
+
+  void visit(null_value &) final {
+    if constexpr (binary_op_t::defined_for_null)
+      return calc(nullptr);
+
+    throw_type_error();
+  }
+
+  void visit(bool_value &n) final {
+    if constexpr (binary_op_t::defined_for_boolean)
+      return calc(&n.value());
+
+    throw_type_error();
+  }
+
+  void visit(int_value &n) final {
+    if constexpr (binary_op_t::defined_for_integer) {
+      try {
+        return calc(&n.value());
+      } catch (const not_int64_error &ex) {
+        if (n.value() < 0) {
+          CXX_UNLIKELY;
+          throw std::range_error{
+              "unable to consolidate int<0 with uint>max(int)"};
+        }
+      }
+
+      std::uint64_t alt = n.value();
+      return calc(&alt);
+    }
+
+    throw_type_error();
+  }
+
+  void visit(unsigned_int_value &n) final {
+    if constexpr (binary_op_t::defined_for_integer) {
+      try {
+        return calc(&n.value());
+      } catch (const not_uint64_error &ex) {
+        if (n.value() > std::uint64_t(std::numeric_limits<std::int64_t>::max)) {
+          CXX_UNLIKELY;
+          throw std::range_error{
+              "unable to consolidate uint>max(int) with int<0"};
+        }
+      }
+
+      std::int64_t alt = n.value();
+      return calc(&alt);
+    }
+
+    throw_type_error();
+  }
+
+  void visit(real_value &n) final {
+    if constexpr (binary_op_t::defined_for_real)
+      return calc(&n.value());
+
+    throw_type_error();
+  }
+
+  void visit(array &n) final {
+    if constexpr (binary_op_t::defined_for_array) {
+      try {
+        calc(&n);
+      } catch (const unpacked_array_req &) {
+        assert(n.num_evaluated_operands() == 1);
+        n.operand(0).accept(*this);
+      }
+
+      return;
+    }
+
+    throw_type_error();
+  }
+
+  result_type result() && { return std::move(res); }
+
+private:
+  binary_op_t op;
+  expr &rhs;
+  result_type res;
+};
+
+//
+// compute and sequence functions
+
+template <class binary_op_t>
+typename binary_op_t::result_type compute(expr &lhs, expr &rhs,
+                                          binary_op_t op) {
+  using lhs_visitor = binary_operator_visitor<binary_op_t>;
+
+  lhs_visitor vis{op, rhs};
+
+  lhs.accept(vis);
+  return std::move(vis).result();
+}
+
+template <class binary_op_t>
+typename binary_op_t::result_type compute(any_expr &lhs, any_expr &rhs,
+                                          binary_op_t op) {
+  assert(lhs.get() && rhs.get());
+
+  return compute(*lhs, *rhs, op);
+}
+
+/// compares two arrays lexicographically
+/// \return a negative number, zero, or a positive number, if the first
+///         ordered pair of elements, or else the array lengths, are less,
+///         equal, or greater.
+int compare_sequence(array &lv, array &rv);
+
+template <class T> int three_way(const T &lhs, const T &rhs) {
+  return (lhs < rhs) ? -1 : int(rhs < lhs);
+}
+
+/// a three-way comparison that coerces its operands as the relational
+///   operators do; values that none of them orders (e.g., a string and
+///   null) compare as equal.
+struct three_way_operator : relational_operator {
+  using relational_operator::coerce;
+  using result_type = int;
+
+  // an array of several elements is unordered with respect to a value
+  template <class T> std::tuple<bool, bool> coerce(T *lv, array *rv) {
+    if (rv->num_evaluated_operands() > 1)
+      return {false, false};
+
+    return relational_operator::coerce(lv, rv);
+  }
+
+  template <class T> std::tuple<bool, bool> coerce(array *lv, T *rv) {
+    if (lv->num_evaluated_operands() > 1)
+      return {false, false};
+
+    return relational_operator::coerce(lv, rv);
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(json::string *,
+                                                    std::nullptr_t) {
+    return {nullptr, nullptr};
+  }
+
+  std::tuple<std::nullptr_t, std::nullptr_t> coerce(std::nullptr_t,
+                                                    json::string *) {
+    return {nullptr, nullptr};
+  }
+
+  result_type operator()(std::nullptr_t, std::nullptr_t) const { return 0; }
+
+  result_type operator()(array *lv, array *rv) const {
+    return compare_sequence(deref(lv), deref(rv));
+  }
+
+  result_type operator()(json::string_view lhs, json::string_view rhs) const {
+    return lhs.compare(rhs);
+  }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return three_way(lhs, rhs);
+  }
+};
+
+/// an array element that is compared without double dispatch
+struct sequence_key {
+  enum kind_t { other, integer, real, string };
+
+  kind_t kind;
+  std::int64_t ival;
+  double dval;
+  const json::string *str;
+};
+
+struct sequence_key_reader {
+  template <class expr_t> sequence_key operator()(expr_t &n) const {
+    if constexpr (std::is_same<expr_t, int_value>::value)
+      return {sequence_key::integer, n.value(), 0, nullptr};
+    else if constexpr (std::is_same<expr_t, real_value>::value)
+      return {sequence_key::real, 0, n.value(), nullptr};
+    else if constexpr (std::is_same<expr_t, string_value>::value)
+      return {sequence_key::string, 0, 0, &n.value()};
+
+    return {sequence_key::other, 0, 0, nullptr};
+  }
+};
+
+/// compares integers, reals, and strings as three_way_operator does
+/// \return false if \p lhs and \p rhs need to be coerced
+bool compare_keys(const sequence_key &lhs, const sequence_key &rhs, int &res) {
+  if (lhs.kind == sequence_key::integer && rhs.kind == sequence_key::integer)
+    res = three_way(lhs.ival, rhs.ival);
+  else if (lhs.kind == sequence_key::string && rhs.kind == sequence_key::string)
+    res = lhs.str->compare(*rhs.str);
+  else if (lhs.kind == sequence_key::other || rhs.kind == sequence_key::other ||
+           lhs.kind == sequence_key::string || rhs.kind == sequence_key::string)
+    return false;
+  else // reals, or an integer and a real
+    res = three_way(lhs.kind == sequence_key::real ? lhs.dval : lhs.ival,
+                    rhs.kind == sequence_key::real ? rhs.dval : rhs.ival);
+
+  return true;
+}
+
+int compare_sequence(array &lv, array &rv) {
+  const std::size_t lsz = lv.num_evaluated_operands();
+  const std::size_t rsz = rv.num_evaluated_operands();
+  const std::size_t len = std::min(lsz, rsz);
+
+  for (std::size_t i = 0; i < len; ++i) {
+    expr &lhs = lv.operand(i);
+    expr &rhs = rv.operand(i);
+    int res = 0;
+
+    // numbers and strings of the same type are compared directly
+    if (!compare_keys(generic_visit(sequence_key_reader{}, &lhs),
+                      generic_visit(sequence_key_reader{}, &rhs), res)) {
+      res = compute(lhs, rhs, three_way_operator{});
+    }
+
+    if (res != 0)
+      return res;
+  }
+
+  return three_way(lsz, rsz);
+}
+
+/// applies \p pred to the three-way comparison of \p lv and \p rv
+template <class binary_predicate_t>
+bool compare_sequence(array &lv, array &rv, binary_predicate_t pred) {
+  return pred(compare_sequence(lv, rv), 0);
+}
+
+template <class binary_predicate_t>
+bool compare_sequence(array *lv, array *rv, binary_predicate_t pred) {
+  return compare_sequence(deref(lv), deref(rv), std::move(pred));
+}
+
+/// convenience template that only returns \p R
+/// when the types \p U and \p V mismatch.
+/// matching \p U and \p V trigger a SFINAE error to invoke
+/// the regular operator.
+/// \{
+template <class U, class V, class R>
+struct mismatched_types
+{
+  using type = R;
+};
+
+template <class T, class R>
+struct mismatched_types<T,T,R>
+{
+  // using type // triggers SFINAE exclusion
+};
+/// \}
+
+//
+// the calc operator implementations
+
+template <class> struct operator_impl {};
+
+template <> struct operator_impl<equal> : equality_operator {
+  using equality_operator::result_type;
+
+  template <class U, class V>
+  auto operator()(const U&, const V&) const -> typename mismatched_types<U, V, result_type>::type {
+    return false;
+  }
+
+  template <class T> auto operator()(const T &lhs, const T &rhs) const -> result_type {
+    return lhs == rhs;
+  }
+};
+
+template <> struct operator_impl<not_equal> : equality_operator {
+  using equality_operator::result_type;
+
+  template <class U, class V>
+  auto operator()(const U&, const V&) const -> typename mismatched_types<U, V, result_type>::type {
+    return true;
+  }
+
+  template <class T> auto operator()(const T &lhs, const T &rhs) const -> result_type {
+    return lhs != rhs;
+  }
+};
+
+template <> struct operator_impl<strict_equal> : strict_equality_operator {
+  using strict_equality_operator::result_type;
+
+  template <class U, class V>
+  auto operator()(const U&, const V&) const -> typename mismatched_types<U, V, result_type>::type {
+    return false;
+  }
+
+  template <class T> auto operator()(const T &lhs, const T &rhs) const -> result_type {
+    return lhs == rhs;
+  }
+};
+
+template <> struct operator_impl<strict_not_equal> : strict_equality_operator {
+  using strict_equality_operator::result_type;
+
+  template <class U, class V>
+  auto operator()(const U&, const V&) const -> typename mismatched_types<U, V, result_type>::type {
+    return true;
+  }
+
+  template <class T> auto operator()(const T &lhs, const T &rhs) const -> result_type {
+    return lhs != rhs;
+  }
+};
+
+template <> struct operator_impl<less> : relational_operator {
+  using relational_operator::result_type;
+
+  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
+    return false;
+  }
+
+  result_type operator()(array *lv, array *rv) const {
+    return compare_sequence(lv, rv, *this);
+  }
+
+  result_type operator()(json::string_view, std::nullptr_t) const {
+    return false;
+  }
+
+  result_type operator()(std::nullptr_t, json::string_view) const {
+    return false;
+  }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return lhs < rhs;
+  }
+};
+
+template <> struct operator_impl<greater> : relational_operator {
+  using relational_operator::result_type;
+
+  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
+    return false;
+  }
+
+  result_type operator()(array *lv, array *rv) const {
+    return compare_sequence(lv, rv, *this);
+  }
+
+  result_type operator()(json::string_view, std::nullptr_t) const {
+    return false;
+  }
+
+  result_type operator()(std::nullptr_t, json::string_view) const {
+    return false;
+  }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return rhs < lhs;
+  }
+};
+
+template <> struct operator_impl<less_or_equal> : relational_operator {
+  using relational_operator::result_type;
+
+  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
+    return true;
+  }
+
+  result_type operator()(array *lv, array *rv) const {
+    return compare_sequence(lv, rv, *this);
+  }
+
+  result_type operator()(json::string_view lhs, std::nullptr_t) const {
+    return lhs.empty();
+  }
+
+  result_type operator()(std::nullptr_t, json::string_view rhs) const {
+    return rhs.empty();
+  }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return lhs <= rhs;
+  }
+};
+
+template <> struct operator_impl<greater_or_equal> : relational_operator {
+  using relational_operator::result_type;
+
+  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
+    return true;
+  }
+
+  result_type operator()(array *lv, array *rv) const {
+    return compare_sequence(lv, rv, *this);
+  }
+
+  result_type operator()(json::string_view lhs, std::nullptr_t) const {
+    return lhs.empty();
+  }
+
+  result_type operator()(std::nullptr_t, json::string_view rhs) const {
+    return rhs.empty();
+  }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return rhs <= lhs;
+  }
+};
+
+template <> struct operator_impl<add> : arithmetic_operator {
+  using arithmetic_operator::result_type;
+
+  result_type operator()(std::nullptr_t, std::nullptr_t) const {
+    return to_expr(nullptr);
+  }
+
+  /// computes the result for unboxed operands
+  template <class T> static T fold(T lhs, T rhs) { return lhs + rhs; }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return to_expr(fold(lhs, rhs));
+  }
+};
+
+template <> struct operator_impl<subtract> : arithmetic_operator {
+  using arithmetic_operator::result_type;
+
+  result_type operator()(std::nullptr_t, std::nullptr_t) const {
+    return to_expr(nullptr);
+  }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return to_expr(lhs - rhs);
+  }
+};
+
+template <> struct operator_impl<multiply> : arithmetic_operator {
+  using arithmetic_operator::result_type;
+
+  result_type operator()(std::nullptr_t, std::nullptr_t) const {
+    return to_expr(nullptr);
+  }
+
+  /// computes the result for unboxed operands
+  template <class T> static T fold(T lhs, T rhs) { return lhs * rhs; }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return to_expr(fold(lhs, rhs));
+  }
+};
+
+template <> struct operator_impl<divide> : arithmetic_operator {
+  using arithmetic_operator::result_type;
+
+  result_type operator()(std::nullptr_t, std::nullptr_t) const {
+    return to_expr(nullptr);
+  }
+
+  result_type operator()(double lhs, double rhs) const {
+    double res = lhs / rhs;
+
+    // if (isInteger(res)) return toInt(res);
+    return to_expr(res);
+  }
+
+  template <class Int_t> result_type operator()(Int_t lhs, Int_t rhs) const {
+    if (lhs % rhs)
+      return (*this)(double(lhs), double(rhs));
+
+    return to_expr(lhs / rhs);
+  }
+};
+
+template <> struct operator_impl<modulo> : integer_arithmetic_operator {
+  using integer_arithmetic_operator::result_type;
+
+  std::nullptr_t operator()(std::nullptr_t, std::nullptr_t) const {
+    return nullptr;
+  }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    if (rhs == 0)
+      return to_expr(nullptr);
+
+    return to_expr(lhs % rhs);
+  }
+};
+
+template <> struct operator_impl<min> : arithmetic_operator {
+  using arithmetic_operator::result_type;
+
+  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
+    return nullptr;
+  }
+
+  /// computes the result for unboxed operands
+  template <class T> static T fold(T lhs, T rhs) { return std::min(lhs, rhs); }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return to_expr(fold(lhs, rhs));
+  }
+};
+
+template <> struct operator_impl<max> : arithmetic_operator {
+  using arithmetic_operator::result_type;
+
+  result_type operator()(const std::nullptr_t, std::nullptr_t) const {
+    return nullptr;
+  }
+
+  /// computes the result for unboxed operands
+  template <class T> static T fold(T lhs, T rhs) { return std::max(lhs, rhs); }
+
+  template <class T> result_type operator()(const T &lhs, const T &rhs) const {
+    return to_expr(fold(lhs, rhs));
+  }
+};
+
+/// a number that n-ary arithmetic operators accumulate without creating
+///   expression nodes
+struct unboxed_number {
+  enum kind_t : std::uint8_t { none, integer, real };
+
+  kind_t kind = none;
+  std::int64_t ival = 0;
+  double dval = 0;
+
+  double as_real() const { return kind == real ? dval : double(ival); }
+};
+
+/// reads int_value and real_value nodes as unboxed_number; other nodes
+///   yield an unboxed_number of kind none.
+struct number_unboxer {
+  template <class expr_t> unboxed_number operator()(expr_t &n) const {
+    if constexpr (std::is_same<expr_t, int_value>::value)
+      return {unboxed_number::integer, n.value(), 0};
+    else if constexpr (std::is_same<expr_t, real_value>::value)
+      return {unboxed_number::real, 0, n.value()};
+    else if constexpr (std::is_same<expr_t, string_value>::value) {
+      // as convert(.., arithmetic_operator) converts a string
+      if (const numeric_string *num = n.number()) {
+        const double dd = num->as(double{});
+        const std::int64_t ii = num->as(std::int64_t{});
+
+        if (dd != ii)
+          return {unboxed_number::real, 0, dd};
+
+        return {unboxed_number::integer, ii, 0};
+      }
+    }
+
+    return {};
+  }
+};
+
+/// combines two numbers, promoting integers to real as
+///   numeric_binary_operator_base::coerce does.
+template <class binary_op_t>
+unboxed_number fold(const unboxed_number &lhs, const unboxed_number &rhs,
+                    const binary_op_t &) {
+  if (lhs.kind == unboxed_number::real || rhs.kind == unboxed_number::real)
+    return {unboxed_number::real, 0,
+            binary_op_t::fold(lhs.as_real(), rhs.as_real())};
+
+  return {unboxed_number::integer, binary_op_t::fold(lhs.ival, rhs.ival), 0};
+}
+
+/// creates the node holding \p num
+any_expr box(const unboxed_number &num) {
+  if (num.kind == unboxed_number::real)
+    return to_expr(num.dval);
+
+  return to_expr(num.ival);
+}
+
+/// the evaluated operands of an n-ary operation; a few are stored
+///   in place.
+class evaluated_operands {
+public:
+  explicit evaluated_operands(int num) {
+    if (num > INPLACE) {
+      CXX_UNLIKELY;
+      overflow.resize(num);
+      vals = overflow.data();
+    }
+  }
+
+  evaluated_operands(const evaluated_operands &) = delete;
+  evaluated_operands &operator=(const evaluated_operands &) = delete;
+
+  any_expr &operator[](int i) { return vals[i]; }
+
+private:
+  static constexpr int INPLACE = 8;
+
+  std::array<any_expr, INPLACE> inplace;
+  std::vector<any_expr> overflow;
+  any_expr *vals = inplace.data();
+};
+
+template <> struct operator_impl<logical_not> {
+  using result_type = bool;
+
+  result_type operator()(expr &val) const { return falsy(val); }
+};
+
+template <> struct operator_impl<logical_not_not> {
+  using result_type = bool;
+
+  result_type operator()(expr &val) const { return truthy(val); }
+};
+
+/// cat is n-ary; the evaluator sizes the result from all operands
+///   before it appends their texts.
+template <> struct operator_impl<cat> : string_operator {
+  /// the characters reserved for a value that is converted to a string;
+  ///   longer texts grow the result.
+  static constexpr std::size_t CONVERTED_CHARS = 24;
+
+  /// returns the characters reserved for an operand
+  /// \throws type_error if the operand is not a scalar value
+  struct text_length {
+    template <class expr_t> std::size_t operator()(expr_t &n) const {
+      if constexpr (std::is_same<expr_t, string_value>::value)
+        return n.value().size();
+      else if constexpr (std::is_base_of<value_base, expr_t>::value)
+        return CONVERTED_CHARS;
+
+      throw_type_error();
+    }
+  };
+
+  /// appends the text of an operand that passed text_length
+  struct text_appender {
+    template <class expr_t> bool operator()(expr_t &n) const {
+      if constexpr (std::is_base_of<value_base, expr_t>::value)
+        append_text(*res, n.value());
+
+      return true;
+    }
+
+    json::string *res;
+  };
+};
 
-#if WITH_JSON_LOGIC_CPP_EXTENSIONS
+template <>
+struct operator_impl<membership>
+    : string_operator // \todo the conversion rules differ
+{
+  using string_operator::result_type;
+
+  result_type operator()(const json::string &lhs,
+                         const json::string &rhs) const {
+    const bool res = (rhs.find(lhs) != json::string::npos);
+
+    return to_expr(res);
+  }
+};
+
+#if WITH_JSON_LOGIC_CPP_EXTENSIONS
 template <>
 struct operator_impl<regex_match>
     : string_operator // \todo the conversion rules differ
 {
   using string_operator::result_type;
 
-  result_type operator()(const json::string &lhs,
-                         const json::string &rhs) const {
-    std::regex rgx(lhs.c_str(), lhs.size());
+  result_type operator()(const json::string &lhs,
+                         const json::string &rhs) const {
+    std::regex rgx(lhs.c_str(), lhs.size());
+
+    return to_expr(std::regex_search(rhs.begin(), rhs.end(), rgx));
+  }
+};
+#endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
+
+/// merge is n-ary; the evaluator counts the elements of all operands
+///   before it moves them into the result.
+template <> struct operator_impl<merge> : array_operator {
+  /// returns the number of elements an operand contributes; a scalar
+  ///   value is a single element.
+  /// \throws type_error if the operand is neither an array nor a scalar
+  struct element_count {
+    template <class expr_t> std::size_t operator()(expr_t &n) const {
+      if constexpr (std::is_same<expr_t, array>::value)
+        return n.operands().size();
+      else if constexpr (std::is_base_of<value_base, expr_t>::value)
+        return 1;
+
+      throw_type_error();
+    }
+  };
+};
+
+struct node_memo;
+
+#if WITH_JSON_LOGIC_CPP_PROFILER
+/// the per-node statistics of a profiler
+struct profile_state {
+  using clock = std::chrono::steady_clock;
+
+  static constexpr std::size_t NO_PARENT = std::size_t(-1);
+
+  /// a node under evaluation
+  struct frame {
+    std::size_t id;
+    clock::time_point start;
+    std::uint64_t allocations;           ///< node_allocations at entry
+    std::chrono::nanoseconds operands{}; ///< inclusive time of operands
+    std::uint64_t operandAllocations = 0;
+  };
+
+  /// indexes the operator nodes in the tree rooted in \p n
+  /// \details
+  ///   shared_subexpr nodes are transparent.
+  void analyze(expr &n, std::size_t parent);
+
+  /// calls fn and attributes its cost to \p n
+  template <class fn_t> auto measure(expr &n, fn_t fn) -> decltype(fn());
+
+  /// records an exception that the current node caught
+  void caught_exception();
+
+  std::vector<expr *> nodes; ///< operator nodes in pre-order
+  std::vector<std::size_t> parents;
+  std::vector<profiler::counters> stats;
+  std::unordered_map<const expr *, std::size_t> index;
+  std::vector<frame> stack;
+  bool unwinding = false; ///< an exception was counted and propagates
+  profile_state *prev = nullptr;
+
+private:
+  void enter(std::size_t id);
+  void leave();
+};
+
+void profile_state::analyze(expr &n, std::size_t parent) {
+  oper *op = may_down_cast<oper>(n);
+
+  if (op == nullptr)
+    return;
+
+  if (may_down_cast<shared_subexpr>(n) == nullptr) {
+    const std::size_t id = nodes.size();
+
+    nodes.push_back(&n);
+    parents.push_back(parent);
+    index.emplace(&n, id);
+    parent = id;
+  }
+
+  for (any_expr &sub : op->operands())
+    analyze(deref(sub.get()), parent);
+}
+
+template <class fn_t>
+auto profile_state::measure(expr &n, fn_t fn) -> decltype(fn()) {
+  auto pos = index.find(&n);
+
+  // nodes of other rules are not profiled. The boolean evaluation of
+  //   a node may fall back to its regular evaluation, which counts once.
+  if (pos == index.end() || (!stack.empty() && stack.back().id == pos->second))
+    return fn();
+
+  enter(pos->second);
+
+  try {
+    auto res = fn();
+
+    leave();
+    return res;
+  } catch (...) {
+    if (!unwinding) {
+      ++stats[pos->second].exceptions;
+      unwinding = true;
+    }
+
+    leave();
+    throw;
+  }
+}
+
+void profile_state::enter(std::size_t id) {
+  unwinding = false;
+  stack.push_back({id, clock::now(), node_allocations});
+}
+
+void profile_state::leave() {
+  const frame top = stack.back();
+  const std::chrono::nanoseconds inclusive = clock::now() - top.start;
+  const std::uint64_t allocations = node_allocations - top.allocations;
+  profiler::counters &cnt = stats[top.id];
+
+  stack.pop_back();
+  ++cnt.evaluations;
+  cnt.inclusive += inclusive;
+  cnt.exclusive += inclusive - top.operands;
+  cnt.allocations += allocations - top.operandAllocations;
+
+  if (!stack.empty()) {
+    stack.back().operands += inclusive;
+    stack.back().operandAllocations += allocations;
+  }
+}
+
+void profile_state::caught_exception() {
+  // an exception that escaped from an operand was already counted
+  if (unwinding) {
+    unwinding = false;
+    return;
+  }
+
+  if (!stack.empty())
+    ++stats[stack.back().id].exceptions;
+}
+
+/// the innermost profiler on this thread
+thread_local profile_state *active_profiler = nullptr;
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
+
+/// reports an exception that the evaluation of a node caught to the
+///   active profiler
+inline void profile_exception() {
+#if WITH_JSON_LOGIC_CPP_PROFILER
+  if (active_profiler)
+    active_profiler->caught_exception();
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
+}
+
+//
+// tracing
+
+/// stores the value of a node in a trace record
+/// \return the type of the stored value
+struct trace_value_writer {
+  trace_record *rec;
+
+  template <class expr_t> trace_value operator()(expr_t &n) const {
+    if constexpr (std::is_same<expr_t, null_value>::value) {
+      return trace_value::null;
+    } else if constexpr (std::is_same<expr_t, bool_value>::value) {
+      rec->value.boolean = n.value();
+      return trace_value::boolean;
+    } else if constexpr (std::is_same<expr_t, int_value>::value) {
+      rec->value.integer = n.value();
+      return trace_value::integer;
+    } else if constexpr (std::is_same<expr_t, unsigned_int_value>::value) {
+      rec->value.unsigned_integer = n.value();
+      return trace_value::unsigned_integer;
+    } else if constexpr (std::is_same<expr_t, real_value>::value) {
+      rec->value.real = n.value();
+      return trace_value::real;
+    } else if constexpr (std::is_same<expr_t, string_value>::value) {
+      const json::string &str = n.value();
+
+      rec->value.size = str.size();
+      rec->length = std::uint16_t(std::min(str.size(), sizeof(rec->text)));
+      std::memcpy(rec->text, str.data(), rec->length);
+      return trace_value::string;
+    } else if constexpr (std::is_same<expr_t, array>::value) {
+      rec->value.size = n.size();
+      return trace_value::array;
+    } else if constexpr (std::is_same<expr_t, object_value>::value) {
+      rec->value.size = n.size();
+      return trace_value::object;
+    }
+
+    return trace_value::none;
+  }
+};
+
+/// returns a record of event \p ev at node \p n without value
+trace_record make_trace_record(trace_event ev, const expr &n,
+                               std::int32_t detail = -1) {
+  using clock = std::chrono::steady_clock;
+
+  trace_record rec;
+
+  rec.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 clock::now().time_since_epoch())
+                 .count();
+  rec.node = &n;
+  rec.event = ev;
+  rec.type = trace_value::none;
+  rec.length = 0;
+  rec.detail = detail;
+  rec.value.size = 0;
+  return rec;
+}
+
+/// reports event \p ev at node \p n carrying the value \p val
+void trace(trace_sink &sink, trace_event ev, const expr &n, std::int32_t detail,
+           const any_expr &val) {
+  trace_record rec = make_trace_record(ev, n, detail);
+
+  if (val)
+    rec.type = generic_visit(trace_value_writer{&rec}, val.get());
+
+  sink.record(rec);
+}
+
+/// reports event \p ev at node \p n carrying the truth value \p val
+void trace(trace_sink &sink, trace_event ev, const expr &n, std::int32_t detail,
+           bool val) {
+  trace_record rec = make_trace_record(ev, n, detail);
+
+  rec.type = trace_value::boolean;
+  rec.value.boolean = val;
+  sink.record(rec);
+}
+
+//
+// logging
+
+/// the default log sink
+struct stderr_log_sink : log_sink {
+  void write(json::string_view line) final {
+    thread_local std::string text;
+
+    // a single write per line keeps lines of concurrent evaluations intact
+    text.assign(line.data(), line.size());
+    text.push_back('\n');
+    std::cerr.write(text.data(), text.size());
+  }
+};
+
+shared_setting<log_sink> active_log_sink;
+
+/// writes \p val as a line to the current log sink
+void write_log(const any_expr &val) {
+  thread_local std::string line;
+
+  line.clear();
+  serialize(val, line);
+
+  // holds the sink until the line is written
+  if (std::shared_ptr<log_sink> sink = active_log_sink.get()) {
+    sink->write(line);
+    return;
+  }
+
+  static stderr_log_sink fallback;
+
+  fallback.write(line);
+}
+
+struct evaluator : forwarding_visitor {
+  explicit evaluator(variable_accessor varAccess)
+      : vars(std::move(varAccess)), calcres(nullptr) {}
+
+  /// creates an evaluator for a lambda body (e.g., of map), which shares
+  ///   the trace sink of \p parent.
+  evaluator(variable_accessor varAccess, const evaluator &parent)
+      : vars(std::move(varAccess)), calcres(nullptr), tracer(parent.tracer) {}
+
+  void visit(equal &) final;
+  void visit(strict_equal &) final;
+  void visit(not_equal &) final;
+  void visit(strict_not_equal &) final;
+  void visit(less &) final;
+  void visit(greater &) final;
+  void visit(less_or_equal &) final;
+  void visit(greater_or_equal &) final;
+  void visit(logical_and &) final;
+  void visit(logical_or &) final;
+  void visit(logical_not &) final;
+  void visit(logical_not_not &) final;
+  void visit(add &) final;
+  void visit(subtract &) final;
+  void visit(multiply &) final;
+  void visit(divide &) final;
+  void visit(modulo &) final;
+  void visit(min &) final;
+  void visit(max &) final;
+  void visit(array &) final;
+  void visit(map &) final;
+  void visit(reduce &) final;
+  void visit(filter &) final;
+  void visit(all &) final;
+  void visit(none &) final;
+  void visit(some &) final;
+  void visit(merge &) final;
+  void visit(cat &) final;
+  void visit(substr &) final;
+  void visit(membership &) final;
+  void visit(var &) final;
+  void visit(missing &) final;
+  void visit(missing_some &) final;
+  void visit(log &) final;
+  void visit(shared_subexpr &) final;
+
+  void visit(if_expr &) final;
+
+  void visit(null_value &n) final;
+  void visit(bool_value &n) final;
+  void visit(int_value &n) final;
+  void visit(unsigned_int_value &n) final;
+  void visit(real_value &n) final;
+  void visit(string_value &n) final;
+
+  void visit(error &n) final;
+
+#if WITH_JSON_LOGIC_CPP_EXTENSIONS
+  void visit(regex_match &n) final;
+#endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
+
+  any_expr eval(expr &n);
+
+  /// evaluates \p n in a boolean context and returns its truthiness
+  /// \details
+  ///   logical operators, conditionals and comparisons are evaluated
+  ///   without materializing intermediate boolean results.
+  bool eval_truthy(expr &n);
+
+  /// reuses results of a previous evaluation that are still valid
+  void reuse_results(node_memo &m) { memo = &m; }
+
+  /// reports evaluation events to \p sink; nullptr disables tracing
+  void trace_to(trace_sink *sink) { tracer = sink; }
+
+private:
+  variable_accessor vars;
+  any_expr calcres;
+  node_memo *memo = nullptr;
+  trace_sink *tracer = nullptr;
+  std::vector<any_expr> shared; ///< values of shared subexpressions
+
+  friend struct truthiness_evaluator;
+  friend struct node_memo;
+
+  /// evaluates \p n, bypassing the profiler
+  any_expr eval_unprofiled(expr &n);
+
+  /// evaluates \p n in a boolean context, bypassing the profiler
+  bool eval_truthy_unprofiled(expr &n);
+
+  /// evaluates \p n using \p fn and reports entering and leaving \p n
+  ///   to the trace sink.
+  template <class eval_fn_t>
+  auto eval_traced(expr &n, eval_fn_t fn) -> decltype(fn());
+
+  /// reports that the conditional or logical operator \p n was decided
+  ///   by operand \p idx with truth value \p val.
+  void trace_decision(const expr &n, int idx, bool val) {
+    if (tracer) {
+      CXX_UNLIKELY;
+      trace(*tracer, trace_event::short_circuit, n, idx, val);
+    }
+  }
+
+  /// evaluates \p n, bypassing the memo
+  any_expr eval_node(expr &n);
+
+  evaluator(const evaluator &) = delete;
+  evaluator(evaluator &&) = delete;
+  evaluator &operator=(const evaluator &) = delete;
+  evaluator &operator=(evaluator &&) = delete;
+
+  //
+  // opers
+
+  /// implements relop : [1, 2, 3, whatever] as 1 relop 2 relop 3
+  template <class binary_predicate_t>
+  void eval_pair_short_circuit(oper &n, binary_predicate_t pred);
+
+  /// returns the result of relop : [1, 2, 3, whatever]
+  template <class binary_predicate_t>
+  bool compare_pairwise(oper &n, binary_predicate_t pred);
+
+  /// evaluates the array n[0] and tests its elements with the predicate n[1]
+  ///   using \p quantifier (i.e., std::all_of, std::any_of, std::none_of).
+  template <class quantifier_t> bool quantify(oper &n, quantifier_t quantifier);
+
+  /// returns the first expression membership [ e1, e2, e3 ] that evaluates to
+  /// val,
+  ///   or the last expression otherwise
+  void eval_short_circuit(oper &n, bool val);
+
+  /// returns the position of the first condition of \p n that holds, or
+  ///   of the else branch if none does; \p test evaluates a condition.
+  template <class test_fn_t> int select_branch(if_expr &n, test_fn_t test);
+
+  /// returns the position of the first comparison of \p n that holds,
+  ///   or NO_MATCH, using the equality dispatch of \p n.
+  /// \return UNINDEXED if the operands need to be evaluated
+  std::uint32_t select_operand(logical_or &n);
+
+  /// returns \p n if it is a literal with a numeric interpretation, or
+  ///   the result of evaluating \p n, which is stored in \p val.
+  expr &comparison_operand(expr &n, any_expr &val);
+
+  /// reduction operation on all elements
+  template <class binary_op_t> void reduce_sequence(oper &n, binary_op_t op);
+
+  /// computes unary operation on n[0]
+  template <class UnaryOperator> void unary(oper &n, UnaryOperator calc);
+
+  /// binary operation on all elements (invents an element if none is present)
+  template <class binary_op_t> void binary(oper &n, binary_op_t binop);
+
+  /// evaluates and unpacks n[argpos] to a fundamental value_base
+  template <class value_t>
+  value_t unpack_optional_arg(oper &n, int argpos, const value_t &defaultVal);
+
+  /// tests which of the variables named by \p elems exist, and stores
+  ///   the results in \p found.
+  void probe_variables(array &elems, bool *found);
+
+  /// removes the keys of the variables that exist from \p elems
+  /// \return the number of removed keys
+  std::size_t missing_aux(array &elems);
+
+  template <class ValueNode> void _value(const ValueNode &val) {
+    calcres = to_expr(val.value());
+  }
+
+  void _value(const string_value &val) {
+    calcres = to_expr(scratch_string(val.value()));
+  }
+};
+
+/// looks up \p path in \p obj, where dots separate the keys of nested objects
+/// \return the member, or nullptr if \p path cannot be resolved
+const any_expr *find_member(object_value &obj, json::string_view path) {
+  if (auto pos = obj.find(path); pos != obj.end())
+    return &pos->second;
+
+  const std::size_t dot = path.find('.');
+
+  if (dot == json::string_view::npos)
+    return nullptr;
+
+  auto pos = obj.find(path.substr(0, dot));
+
+  if (pos == obj.end())
+    return nullptr;
+
+  object_value *sub = may_down_cast<object_value>(deref(pos->second.get()));
+
+  return sub ? find_member(*sub, path.substr(dot + 1)) : nullptr;
+}
+
+struct sequence_function {
+  sequence_function(expr &e, const evaluator &calc) : exp(e), parent(calc) {}
+
+  any_expr operator()(any_expr &&elem) const {
+    return eval_element(
+        elem, [](evaluator &sub, expr &e) -> any_expr { return sub.eval(e); });
+  }
+
+protected:
+  /// sets up an evaluator where var accesses refer to \p elem and
+  ///   calls fn(evaluator, expression).
+  template <class eval_fn_t>
+  auto eval_element(any_expr &elem, eval_fn_t fn) const
+      -> decltype(fn(std::declval<evaluator &>(), std::declval<expr &>())) {
+    any_expr *elptr = &elem; // workaround, b/c unique_ptr cannot be captured
+
+    evaluator sub{[elptr](const json::value &keyval, int) -> any_expr {
+                    if (const json::string *pkey = keyval.if_string()) {
+                      const json::string &key = *pkey;
+
+                      if (key.size() == 0)
+                        return clone_expr(*elptr);
+
+                      if (object_value *o =
+                              may_down_cast<object_value>(**elptr)) {
+                        if (const any_expr *member = find_member(*o, key))
+                          return clone_expr(*member);
+                      }
+                    }
+
+                    return to_expr(nullptr);
+                  },
+                  parent};
+
+    return fn(sub, exp);
+  }
+
+private:
+  expr &exp;
+  const evaluator &parent;
+};
+
+/// evaluates the predicate in a boolean context
+/// \note
+///   the element is only read through the variable accessor, which
+///   clones the requested values. Thus, the predicate is non-destructive
+///   and can be used for evaluating and copying (e.g., filter).
+struct sequence_predicate : sequence_function {
+  using sequence_function::sequence_function;
+
+  bool operator()(any_expr &&elem) const {
+    return eval_element(
+        elem, [](evaluator &sub, expr &e) -> bool { return sub.eval_truthy(e); });
+  }
+};
+
+using sequence_predicate_nondestructive = sequence_predicate;
+
+/// evaluates the body of a reduction for each element
+/// \details
+///   current and accumulator are bound by reference. A variable that
+///   the body reads at most once is moved into the body, otherwise each
+///   read copies it.
+class sequence_reduction {
+public:
+  sequence_reduction(reduce &n, const evaluator &calc)
+      : exp(n.operand(1)), binds(n.bindings()),
+        sub{[this](const json::value &keyval, int) -> any_expr {
+              return read(keyval);
+            },
+            calc} {}
+
+  /// evaluates the body for \p elem and returns the next accumulator
+  any_expr operator()(any_expr &&accu, any_expr &&elem) {
+    accumulator = std::move(accu);
+    current = std::move(elem);
+    return sub.eval(exp);
+  }
+
+private:
+  expr &exp;
+  const unsigned binds;
+  any_expr current;
+  any_expr accumulator;
+  evaluator sub;
+
+  any_expr read(const json::value &keyval) {
+    if (const json::string *pkey = keyval.if_string()) {
+      if (*pkey == "current")
+        return take(current, reduce::moves_current);
+
+      if (*pkey == "accumulator")
+        return take(accumulator, reduce::moves_accumulator);
+    }
+
+    return to_expr(nullptr);
+  }
+
+  any_expr take(any_expr &val, unsigned moved) {
+    if (binds & moved)
+      return std::move(val);
+
+    return clone_expr(val);
+  }
+};
+
+/// reduces \p elems by a body {op:[accumulator, current]}, or
+///   {op:[current, accumulator]} if \p currentFirst.
+/// \details
+///   integer and real accumulators are folded unboxed, as the n-ary
+///   operator does; other values are combined by evaluating the body.
+template <class binary_op_t>
+any_expr fold_sequence(array &elems, any_expr accu, bool currentFirst,
+                       sequence_reduction &step, const binary_op_t &op) {
+  auto unbox = [](const any_expr &val) -> unboxed_number {
+    return val ? generic_visit(number_unboxer{}, val.get()) : unboxed_number{};
+  };
+
+  unboxed_number acc = unbox(accu);
+
+  for (any_expr &elem : elems) {
+    const unboxed_number val = unbox(elem);
+
+    if (acc.kind != unboxed_number::none && val.kind != unboxed_number::none) {
+      CXX_LIKELY;
+      acc = currentFirst ? fold(val, acc, op) : fold(acc, val, op);
+      continue;
+    }
+
+    if (acc.kind != unboxed_number::none)
+      accu = box(acc);
+
+    accu = step(std::move(accu), std::move(elem));
+    acc = unbox(accu);
+  }
+
+  if (acc.kind != unboxed_number::none)
+    return box(acc);
+
+  return accu;
+}
+
+/// calls fold_sequence with the operator of the reduction body
+struct sequence_folder {
+  array &elems;
+  any_expr &accu;
+  sequence_reduction &step;
+
+  template <class expr_t> any_expr operator()(expr_t &body) const {
+    if constexpr (std::is_same<expr_t, add>::value ||
+                  std::is_same<expr_t, multiply>::value ||
+                  std::is_same<expr_t, min>::value ||
+                  std::is_same<expr_t, max>::value) {
+      const json::string &first =
+          down_cast<string_value>(down_cast<var>(body.operand(0)).operand(0))
+              .value();
+
+      return fold_sequence(elems, std::move(accu), first == "current", step,
+                           operator_impl<expr_t>{});
+    } else {
+      unsupported();
+    }
+  }
+};
+
+template <class value_t>
+value_t evaluator::unpack_optional_arg(oper &n, int argpos,
+                                       const value_t &defaultVal) {
+  if (std::size_t(argpos) >= n.size()) {
+    CXX_UNLIKELY;
+    return defaultVal;
+  }
+
+  return unpack_value<value_t>(*eval(n.operand(argpos)));
+}
+
+template <class unary_predicate_t>
+void evaluator::unary(oper &n, unary_predicate_t pred) {
+  CXX_MAYBE_UNUSED
+  const int num = n.num_evaluated_operands();
+  assert(num == 1);
+
+  const bool res = pred(*eval(n.operand(0)));
+
+  calcres = to_expr(res);
+}
+
+template <class binary_op_t>
+void evaluator::binary(oper &n, binary_op_t binop) {
+  const int num = n.num_evaluated_operands();
+  assert(num == 1 || num == 2);
+
+  int idx = -1;
+  any_expr lhs;
+
+  if (num == 2) {
+    CXX_LIKELY;
+    lhs = eval(n.operand(++idx));
+  } else {
+    lhs = to_expr(std::int64_t(0));
+  }
+
+  any_expr rhs = eval(n.operand(++idx));
+
+  calcres = compute(lhs, rhs, binop);
+}
+
+template <class binary_op_t>
+void evaluator::reduce_sequence(oper &n, binary_op_t op) {
+  const int num = n.num_evaluated_operands();
+  assert(num >= 1);
+
+  int idx = -1;
+  any_expr res;
+
+  if constexpr (std::is_base_of<arithmetic_operator, binary_op_t>::value) {
+    // integers and reals are accumulated unboxed; the first other value
+    //   (e.g., null or an unsigned integer) continues pairwise.
+    unboxed_number acc;
+    bool unboxed = true;
+
+    while (unboxed && idx != (num - 1)) {
+      expr &arg = n.operand(++idx);
+
+      // literals are read in place
+      unboxed_number val = generic_visit(number_unboxer{}, &arg);
+      any_expr boxed;
+
+      if (val.kind == unboxed_number::none) {
+        boxed = convert(eval(arg), op);
+        val = generic_visit(number_unboxer{}, boxed.get());
+      }
+
+      if (val.kind == unboxed_number::none) {
+        if (idx == 0) {
+          res = std::move(boxed);
+        } else {
+          any_expr lhs = box(acc);
+
+          res = compute(lhs, boxed, op);
+        }
+
+        unboxed = false;
+      } else {
+        acc = (idx == 0) ? val : fold(acc, val, op);
+      }
+    }
+
+    if (unboxed) {
+      calcres = box(acc);
+      return;
+    }
+  } else {
+    res = convert(eval(n.operand(++idx)), op);
+  }
+
+  while (idx != (num - 1)) {
+    any_expr rhs = eval(n.operand(++idx));
+
+    rhs = convert(std::move(rhs), op);
+    res = compute(res, rhs, op);
+  }
+
+  calcres = std::move(res);
+}
+
+template <class binary_predicate_t>
+void evaluator::eval_pair_short_circuit(oper &n, binary_predicate_t pred) {
+  calcres = to_expr(compare_pairwise(n, std::move(pred)));
+}
+
+expr &evaluator::comparison_operand(expr &n, any_expr &val) {
+  // the literal's numeric interpretation is read in place
+  if (string_value *str = may_down_cast<string_value>(n); str && str->number())
+    return n;
+
+  val = eval(n);
+  assert(val.get());
+  return *val;
+}
+
+template <class binary_predicate_t>
+bool evaluator::compare_pairwise(oper &n, binary_predicate_t pred) {
+  const int num = n.num_evaluated_operands();
+  assert(num >= 2);
+
+  bool res = true;
+  int idx = -1;
+  any_expr rhsval;
+  expr *rhs = &comparison_operand(n.operand(++idx), rhsval);
+
+  while (res && (idx != (num - 1))) {
+    any_expr lhsval = std::move(rhsval);
+    expr *lhs = rhs;
+
+    rhs = &comparison_operand(n.operand(++idx), rhsval);
+    res = compute(*lhs, *rhs, pred);
+  }
+
+  return res;
+}
+
+template <class quantifier_t>
+bool evaluator::quantify(oper &n, quantifier_t quantifier) {
+  any_expr arr = eval(n.operand(0));
+  array &elems = down_cast<array>(*arr); // evaluated elements
+  expr &expr = n.operand(1);
+
+  return quantifier(std::make_move_iterator(elems.begin()),
+                    std::make_move_iterator(elems.end()),
+                    sequence_predicate{expr, *this});
+}
+
+void evaluator::eval_short_circuit(oper &n, bool val) {
+  const int num = n.num_evaluated_operands();
+
+  if (num == 0) {
+    CXX_UNLIKELY;
+    throw_type_error();
+  }
+
+  int idx = -1;
+  any_expr oper = eval(n.operand(++idx));
+  //~ std::cerr << idx << ") " << oper << std::endl;
+
+  bool found = (idx == num - 1) || (truthy(*oper) == val);
+
+  // loop until *aa == val or when *aa is the last valid element
+  while (!found) {
+    oper = eval(n.operand(++idx));
+    //~ std::cerr << idx << ") " << oper << std::endl;
+
+    found = (idx == (num - 1)) || (truthy(*oper) == val);
+  }
+
+  if (tracer) {
+    CXX_UNLIKELY;
+    trace(*tracer, trace_event::short_circuit, n, idx, truthy(*oper));
+  }
+
+  calcres = std::move(oper);
+}
+
+/// properties of a node that decide whether its result is memoized
+struct memo_traits {
+  oper *op;          ///< the node as operator, or nullptr
+  bool has_body;     ///< operand 1 is evaluated per element
+  bool recomputed;   ///< the node is recomputed in every evaluation
+  bool worth_saving; ///< the node computes more than a variable lookup
+};
+
+/// computes the memo_traits of a node
+struct memo_signature {
+  template <class expr_t> memo_traits operator()(expr_t &n) const {
+    if constexpr (std::is_base_of<oper, expr_t>::value) {
+      constexpr bool isSequence = std::is_same<expr_t, map>::value ||
+                                  std::is_same<expr_t, filter>::value ||
+                                  std::is_same<expr_t, reduce>::value ||
+                                  std::is_same<expr_t, all>::value ||
+                                  std::is_same<expr_t, none>::value ||
+                                  std::is_same<expr_t, some>::value;
+      constexpr bool isVar = std::is_same<expr_t, var>::value;
+      bool recomputed = std::is_same<expr_t, missing>::value ||
+                        std::is_same<expr_t, missing_some>::value ||
+                        std::is_same<expr_t, log>::value;
+
+      if constexpr (isVar)
+        recomputed = n.num() < 0;
+
+      return {&n, isSequence, recomputed, !isVar};
+    } else {
+      return {nullptr, false, false, false};
+    }
+  }
+};
+
+/// numbers the memoized nodes in the subtree rooted in \p n
+/// \return true if the subtree is recomputed in every evaluation
+bool number_memoized_nodes(expr &n, std::uint32_t &next) {
+  const memo_traits traits = generic_visit(memo_signature{}, &n);
+
+  if (traits.op == nullptr)
+    return false; // values do not depend on variables
+
+  // the body of a sequence operation refers to the elements and is
+  //   evaluated by a separate evaluator.
+  oper::container_type &operands = traits.op->operands();
+  bool recomputed = traits.recomputed;
+
+  for (std::size_t i = 0; i < operands.size(); ++i) {
+    if (traits.has_body && i == 1)
+      continue;
+
+    recomputed = number_memoized_nodes(deref(operands[i].get()), next) ||
+                 recomputed;
+  }
+
+  traits.op->memo_slot((traits.worth_saving && !recomputed)
+                           ? next++
+                           : std::uint32_t(oper::NO_MEMO_SLOT));
+  return recomputed;
+}
+
+void number_memoized_nodes(any_expr &root) {
+  std::uint32_t next = 0;
+
+  number_memoized_nodes(deref(root.get()), next);
+}
+
+/// results of the memoized nodes from a previous evaluation, together
+///   with the variable slots each node depends on.
+/// \details
+///   results are stored by the memo slots of the nodes, which are
+///   numbered when the rule is compiled.
+struct node_memo {
+  struct node_state {
+    any_expr value;
+    bool dirty = true;
+  };
+
+  /// the variable slots a subtree depends on
+  using dependencies = std::vector<int>;
+
+  /// collects the dependencies of the memoized nodes in the tree rooted
+  ///   in \p n
+  dependencies analyze(expr &n);
+
+  any_expr eval(evaluator &ev, expr &n);
+
+  /// marks the nodes that depend on \p slot
+  void changed(int slot);
+
+  /// marks all nodes
+  void invalidate();
+
+  std::vector<node_state> states;
+  std::vector<std::vector<std::uint32_t>> dependents; ///< nodes per var slot
+  std::size_t recomputed = 0;
+  std::size_t reused = 0;
+};
+
+node_memo::dependencies node_memo::analyze(expr &n) {
+  dependencies res;
+  const memo_traits traits = generic_visit(memo_signature{}, &n);
+
+  if (traits.op == nullptr)
+    return res;
+
+  if (var *v = may_down_cast<var>(n); v && v->num() >= 0)
+    res.push_back(v->num());
+
+  const oper::container_type &operands = traits.op->operands();
+
+  for (std::size_t i = 0; i < operands.size(); ++i) {
+    if (traits.has_body && i == 1)
+      continue;
+
+    dependencies sub = analyze(deref(operands[i].get()));
+
+    res.insert(res.end(), sub.begin(), sub.end());
+  }
+
+  std::sort(res.begin(), res.end());
+  res.erase(std::unique(res.begin(), res.end()), res.end());
+
+  const std::uint32_t id = traits.op->memo_slot();
+
+  if (id == oper::NO_MEMO_SLOT)
+    return res;
+
+  if (states.size() <= id)
+    states.resize(id + 1);
+
+  for (int slot : res) {
+    if (dependents.size() <= std::size_t(slot))
+      dependents.resize(slot + 1);
+
+    dependents[slot].push_back(id);
+  }
+
+  return res;
+}
+
+any_expr node_memo::eval(evaluator &ev, expr &n) {
+  oper *op = may_down_cast<oper>(n);
+
+  if (op == nullptr || op->memo_slot() >= states.size())
+    return ev.eval_node(n);
+
+  node_state &state = states[op->memo_slot()];
+
+  if (!state.dirty) {
+    ++reused;
+    return clone_expr(state.value);
+  }
+
+  any_expr res = ev.eval_node(n);
+
+  ++recomputed;
+
+  {
+    // the results outlive the evaluation
+    scratch_scope heap{nullptr};
+
+    state.value = clone_expr(res);
+  }
+
+  state.dirty = false;
+  return res;
+}
+
+void node_memo::changed(int slot) {
+  if (slot < 0) {
+    invalidate();
+    return;
+  }
+
+  if (std::size_t(slot) >= dependents.size())
+    return;
+
+  for (std::uint32_t id : dependents[slot])
+    states[id].dirty = true;
+}
+
+void node_memo::invalidate() {
+  for (node_state &state : states)
+    state.dirty = true;
+}
+
+template <class eval_fn_t>
+auto evaluator::eval_traced(expr &n, eval_fn_t fn) -> decltype(fn()) {
+  trace_sink &sink = *tracer;
+
+  sink.record(make_trace_record(trace_event::enter, n));
+
+  try {
+    auto res = fn();
+
+    trace(sink, trace_event::exit, n, -1, res);
+    return res;
+  } catch (...) {
+    sink.record(make_trace_record(trace_event::exit, n));
+    throw;
+  }
+}
+
+any_expr evaluator::eval(expr &n) {
+#if WITH_JSON_LOGIC_CPP_PROFILER
+  if (active_profiler) {
+    CXX_UNLIKELY;
+    return active_profiler->measure(
+        n, [this, &n]() -> any_expr { return eval_unprofiled(n); });
+  }
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
+
+  return eval_unprofiled(n);
+}
+
+any_expr evaluator::eval_unprofiled(expr &n) {
+  if (tracer) {
+    CXX_UNLIKELY;
+    return eval_traced(n, [this, &n]() -> any_expr {
+      return memo ? memo->eval(*this, n) : eval_node(n);
+    });
+  }
+
+  if (memo) {
+    CXX_UNLIKELY;
+    return memo->eval(*this, n);
+  }
+
+  return eval_node(n);
+}
+
+any_expr evaluator::eval_node(expr &n) {
+  any_expr res;
+
+  n.accept(*this);
+  res.swap(calcres);
+
+  return res;
+}
+
+/// evaluates expressions in a boolean context
+/// \details
+///   nodes without a boolean shortcut are evaluated by the evaluator
+///   and the truthiness of the result is returned.
+struct truthiness_evaluator : forwarding_visitor {
+  explicit truthiness_evaluator(evaluator &ev) : calc(ev), res(false) {}
+
+  void visit(expr &n) final { res = truthy(calc.eval(n)); }
+
+  void visit(equal &n) final { compare(n, operator_impl<equal>{}); }
+  void visit(strict_equal &n) final {
+    compare(n, operator_impl<strict_equal>{});
+  }
+  void visit(not_equal &n) final { compare(n, operator_impl<not_equal>{}); }
+  void visit(strict_not_equal &n) final {
+    compare(n, operator_impl<strict_not_equal>{});
+  }
+  void visit(less &n) final { compare(n, operator_impl<less>{}); }
+  void visit(greater &n) final { compare(n, operator_impl<greater>{}); }
+  void visit(less_or_equal &n) final {
+    compare(n, operator_impl<less_or_equal>{});
+  }
+  void visit(greater_or_equal &n) final {
+    compare(n, operator_impl<greater_or_equal>{});
+  }
+
+  void visit(logical_and &n) final { res = !short_circuit(n, false); }
+  void visit(logical_or &n) final;
+  void visit(logical_not &n) final { res = !calc.eval_truthy(n.operand(0)); }
+  void visit(logical_not_not &n) final {
+    res = calc.eval_truthy(n.operand(0));
+  }
+
+  void visit(all &n) final {
+    res = calc.quantify(n, [](auto aa, auto zz, auto pred) -> bool {
+      return std::all_of(aa, zz, pred);
+    });
+  }
+
+  void visit(none &n) final {
+    res = calc.quantify(n, [](auto aa, auto zz, auto pred) -> bool {
+      return std::none_of(aa, zz, pred);
+    });
+  }
+
+  void visit(some &n) final {
+    res = calc.quantify(n, [](auto aa, auto zz, auto pred) -> bool {
+      return std::any_of(aa, zz, pred);
+    });
+  }
+
+  void visit(if_expr &n) final;
+
+  // values are tested in place, w/o creating a copy
+  void visit(null_value &) final { res = false; }
+  void visit(bool_value &n) final { res = n.value(); }
+  void visit(int_value &n) final { res = truthy(n); }
+  void visit(unsigned_int_value &n) final { res = truthy(n); }
+  void visit(real_value &n) final { res = truthy(n); }
+  void visit(string_value &n) final { res = truthy(n); }
+
+  bool result() const { return res; }
+
+private:
+  evaluator &calc;
+  bool res;
+
+  template <class binary_predicate_t>
+  void compare(oper &n, binary_predicate_t pred) {
+    res = calc.compare_pairwise(n, std::move(pred));
+  }
+
+  /// returns true iff some operand has the truth value \p val
+  /// \details
+  ///    operands are tested in the test order of \p n, or in the order
+  ///    of its operand statistics. If that throws, the operands are
+  ///    tested from left to right, so that exceptions only escape if
+  ///    they would without reordering.
+  bool short_circuit(logical_nary &n, bool val);
+
+  /// tests the operands at the positions pos(0) .. pos(num-1)
+  template <class position_fn>
+  bool test_in_order(logical_nary &n, std::size_t num, position_fn pos,
+                     bool val);
+
+  /// tests the operands in the order of \p stats; every
+  ///   SAMPLE_PERIOD-th evaluation of \p n samples all operands instead.
+  bool adaptive_short_circuit(logical_nary &n, operand_statistics &stats,
+                              bool val);
+
+  /// evaluates all operands and records their outcomes and times
+  bool sample_operands(logical_nary &n, operand_statistics &stats, bool val);
+};
+
+bool truthiness_evaluator::short_circuit(logical_nary &n, bool val) {
+  const int num = n.num_evaluated_operands();
+
+  if (num == 0) {
+    CXX_UNLIKELY;
+    throw_type_error();
+  }
+
+  if (operand_statistics *stats = n.statistics()) {
+    try {
+      return adaptive_short_circuit(n, *stats, val);
+    } catch (...) {
+      profile_exception();
+    }
+  } else if (const std::vector<std::uint32_t> &order = n.test_order();
+             !order.empty()) {
+    try {
+      return test_in_order(
+          n, order.size(),
+          [&order](std::size_t i) -> std::uint32_t { return order[i]; }, val);
+    } catch (...) {
+      profile_exception();
+    }
+  }
+
+  return test_in_order(
+      n, num, [](std::size_t i) -> std::uint32_t { return i; }, val);
+}
+
+template <class position_fn>
+bool truthiness_evaluator::test_in_order(logical_nary &n, std::size_t num,
+                                         position_fn pos, bool val) {
+  for (std::size_t i = 0; i < num; ++i) {
+    const std::uint32_t idx = pos(i);
+
+    if (calc.eval_truthy(n.operand(idx)) == val) {
+      calc.trace_decision(n, idx, val);
+      return true;
+    }
+  }
+
+  calc.trace_decision(n, pos(num - 1), !val);
+  return false;
+}
+
+bool truthiness_evaluator::adaptive_short_circuit(logical_nary &n,
+                                                  operand_statistics &stats,
+                                                  bool val) {
+  if (stats.sample_due())
+    return sample_operands(n, stats, val);
+
+  const std::uint64_t packed = stats.test_order();
+
+  return test_in_order(
+      n, stats.size(),
+      [packed](std::size_t i) -> std::uint32_t {
+        return operand_statistics::position(packed, i);
+      },
+      val);
+}
+
+bool truthiness_evaluator::sample_operands(logical_nary &n,
+                                           operand_statistics &stats,
+                                           bool val) {
+  using clock = std::chrono::steady_clock;
+
+  const std::uint64_t packed = stats.test_order();
+  const std::size_t num = stats.size();
+  std::array<std::uint64_t, operand_statistics::MAX_OPERANDS> times;
+  std::array<bool, operand_statistics::MAX_OPERANDS> decided;
+  std::uint32_t decision = operand_statistics::position(packed, num - 1);
+  bool res = false;
+
+  // an exception discards the sample; the caller retests left to right
+  for (std::size_t i = 0; i < num; ++i) {
+    const std::uint32_t idx = operand_statistics::position(packed, i);
+
+    // once decided, operands that may throw are not evaluated
+    if (res && stats.is_fixed(idx)) {
+      decided[idx] = false;
+      times[idx] = 0;
+      continue;
+    }
+
+    const clock::time_point start = clock::now();
+
+    decided[idx] = (calc.eval_truthy(n.operand(idx)) == val);
+    times[idx] = std::chrono::nanoseconds(clock::now() - start).count();
+
+    if (decided[idx] && !res) {
+      decision = idx;
+      res = true;
+    }
+  }
+
+  for (std::size_t idx = 0; idx < num; ++idx)
+    stats.record(idx, decided[idx], times[idx]);
+
+  stats.completed();
+  calc.trace_decision(n, decision, res ? val : !val);
+  return res;
+}
+
+void truthiness_evaluator::visit(if_expr &n) {
+  const int num = n.num_evaluated_operands();
+  const int pos = calc.select_branch(
+      n, [this](expr &cond) -> bool { return calc.eval_truthy(cond); });
+
+  if (pos < num - 1)
+    res = calc.eval_truthy(n.operand(pos + 1));
+  else
+    res = (pos < num) && calc.eval_truthy(n.operand(pos));
+}
+
+void truthiness_evaluator::visit(logical_or &n) {
+  const std::uint32_t pos = calc.select_operand(n);
+
+  if (pos == equality_dispatch::UNINDEXED)
+    res = short_circuit(n, true);
+  else
+    res = (pos != equality_dispatch::NO_MATCH);
+}
+
+bool evaluator::eval_truthy(expr &n) {
+#if WITH_JSON_LOGIC_CPP_PROFILER
+  if (active_profiler) {
+    CXX_UNLIKELY;
+    return active_profiler->measure(
+        n, [this, &n]() -> bool { return eval_truthy_unprofiled(n); });
+  }
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
+
+  return eval_truthy_unprofiled(n);
+}
+
+bool evaluator::eval_truthy_unprofiled(expr &n) {
+  truthiness_evaluator tester{*this};
+
+  if (tracer) {
+    CXX_UNLIKELY;
+    return eval_traced(n, [&n, &tester]() -> bool {
+      n.accept(tester);
+      return tester.result();
+    });
+  }
+
+  n.accept(tester);
+  return tester.result();
+}
+
+void evaluator::visit(equal &n) {
+  eval_pair_short_circuit(n, operator_impl<equal>{});
+}
+
+void evaluator::visit(strict_equal &n) {
+  eval_pair_short_circuit(n, operator_impl<strict_equal>{});
+}
+
+void evaluator::visit(not_equal &n) {
+  eval_pair_short_circuit(n, operator_impl<not_equal>{});
+}
+
+void evaluator::visit(strict_not_equal &n) {
+  eval_pair_short_circuit(n, operator_impl<strict_not_equal>{});
+}
+
+void evaluator::visit(less &n) {
+  eval_pair_short_circuit(n, operator_impl<less>{});
+}
+
+void evaluator::visit(greater &n) {
+  eval_pair_short_circuit(n, operator_impl<greater>{});
+}
+
+void evaluator::visit(less_or_equal &n) {
+  eval_pair_short_circuit(n, operator_impl<less_or_equal>{});
+}
+
+void evaluator::visit(greater_or_equal &n) {
+  eval_pair_short_circuit(n, operator_impl<greater_or_equal>{});
+}
+
+void evaluator::visit(logical_and &n) { eval_short_circuit(n, false); }
+
+void evaluator::visit(logical_or &n) {
+  const std::uint32_t pos = select_operand(n);
+
+  if (pos == equality_dispatch::UNINDEXED) {
+    eval_short_circuit(n, true);
+    return;
+  }
+
+  // the operands are comparisons, which yield booleans
+  calcres = to_expr(pos != equality_dispatch::NO_MATCH);
+}
+
+std::uint32_t evaluator::select_operand(logical_or &n) {
+  const equality_dispatch *index = n.dispatch();
+
+  if (index == nullptr)
+    return equality_dispatch::UNINDEXED;
+
+  any_expr val = eval(index->subject());
+  const std::uint32_t pos = index->find(*val);
+
+  if (pos == equality_dispatch::NO_MATCH)
+    trace_decision(n, n.num_evaluated_operands() - 1, false);
+  else if (pos != equality_dispatch::UNINDEXED)
+    trace_decision(n, pos, true);
+
+  return pos;
+}
+
+void evaluator::visit(logical_not &n) {
+  unary(n, operator_impl<logical_not>{});
+}
+
+void evaluator::visit(logical_not_not &n) {
+  unary(n, operator_impl<logical_not_not>{});
+}
+
+void evaluator::visit(add &n) { reduce_sequence(n, operator_impl<add>{}); }
+
+void evaluator::visit(subtract &n) { binary(n, operator_impl<subtract>{}); }
+
+void evaluator::visit(multiply &n) {
+  reduce_sequence(n, operator_impl<multiply>{});
+}
+
+void evaluator::visit(divide &n) { binary(n, operator_impl<divide>{}); }
+
+void evaluator::visit(modulo &n) { binary(n, operator_impl<modulo>{}); }
+
+void evaluator::visit(min &n) { reduce_sequence(n, operator_impl<min>{}); }
+
+void evaluator::visit(max &n) { reduce_sequence(n, operator_impl<max>{}); }
+
+void evaluator::visit(cat &n) {
+  using cat_op = operator_impl<cat>;
+
+  const int num = n.num_evaluated_operands();
+  evaluated_operands vals{num};
+  std::size_t len = 0;
+
+  for (int i = 0; i < num; ++i) {
+    expr *arg = &n.operand(i);
+
+    // literals are read in place
+    if (may_down_cast<value_base>(*arg) == nullptr) {
+      vals[i] = eval(*arg);
+      arg = vals[i].get();
+    }
+
+    len += generic_visit(cat_op::text_length{}, arg);
+  }
+
+  json::string res{scratch_storage()};
+
+  res.reserve(len);
+
+  for (int i = 0; i < num; ++i) {
+    expr *arg = vals[i] ? vals[i].get() : &n.operand(i);
+
+    generic_visit(cat_op::text_appender{&res}, arg);
+  }
+
+  calcres = to_expr(std::move(res));
+}
+
+void evaluator::visit(membership &n) { binary(n, operator_impl<membership>{}); }
+
+#if WITH_JSON_LOGIC_CPP_EXTENSIONS
+void evaluator::visit(regex_match &n) {
+  binary(n, operator_impl<membership>{});
+}
+#endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
+
+void evaluator::visit(substr &n) {
+  assert(n.num_evaluated_operands() >= 1);
+
+  json::string str = unpack_value<json::string>(*eval(n.operand(0)));
+  std::int64_t ofs = unpack_optional_arg<std::int64_t>(n, 1, 0);
+  std::int64_t cnt = unpack_optional_arg<std::int64_t>(n, 2, 0);
+
+  if (ofs < 0) {
+    CXX_UNLIKELY;
+    ofs = std::max(std::int64_t(str.size()) + ofs, std::int64_t(0));
+  }
+
+  if (cnt < 0) {
+    CXX_UNLIKELY;
+    cnt = std::max(std::int64_t(str.size()) - ofs + cnt, std::int64_t(0));
+  }
+
+  calcres = to_expr(scratch_string(str.subview(ofs, cnt)));
+}
+
+void evaluator::visit(array &n) {
+  oper::container_type elems;
+  evaluator *self = this;
+
+  // \todo consider making arrays lazy
+  std::transform(
+      std::make_move_iterator(n.begin()), std::make_move_iterator(n.end()),
+      std::back_inserter(elems),
+      [self](any_expr &&exp) -> any_expr { return self->eval(*exp); });
+
+  array &res = deref(new array);
+
+  res.set_operands(std::move(elems));
+
+  calcres = any_expr(&res);
+}
+
+void evaluator::visit(merge &n) {
+  using merge_op = operator_impl<merge>;
+
+  const int num = n.num_evaluated_operands();
+  evaluated_operands vals{num};
+  std::size_t len = 0;
+
+  for (int i = 0; i < num; ++i) {
+    vals[i] = eval(n.operand(i));
+    len += generic_visit(merge_op::element_count{}, vals[i].get());
+  }
+
+  array &res = deref(new array);
+  any_expr resexpr(&res);
+  oper::container_type &elems = res.operands();
+
+  elems.reserve(len);
+
+  for (int i = 0; i < num; ++i) {
+    if (array *arr = may_down_cast<array>(*vals[i])) {
+      oper::container_type &arrelems = arr->operands();
+
+      elems.insert(elems.end(), std::make_move_iterator(arrelems.begin()),
+                   std::make_move_iterator(arrelems.end()));
+    } else {
+      elems.push_back(std::move(vals[i]));
+    }
+  }
+
+  calcres = std::move(resexpr);
+}
+
+void evaluator::visit(reduce &n) {
+  any_expr arr = eval(n.operand(0));
+  any_expr accu = eval(n.operand(2));
+
+  auto op = [&n, &accu, calc = this](array &elems) -> any_expr {
+    sequence_reduction step{n, *calc};
+
+    // a traced evaluation reports the reads of the body
+    if ((n.bindings() & reduce::folds) && !calc->tracer)
+      return generic_visit(sequence_folder{elems, accu, step}, &n.operand(1));
+
+    for (any_expr &elem : elems)
+      accu = step(std::move(accu), std::move(elem));
+
+    return std::move(accu);
+  };
+
+  calcres =
+      with_type<array>(arr.get(), op, []() -> any_expr { return nullptr; });
+}
+
+void evaluator::visit(map &n) {
+  any_expr arr = eval(n.operand(0));
+  auto mapper = [&n, &arr, calc = this](array &arrop) -> any_expr {
+    expr &expr = n.operand(1);
+    oper::container_type mapped_elements;
+
+    std::transform(std::make_move_iterator(arrop.begin()),
+                   std::make_move_iterator(arrop.end()),
+                   std::back_inserter(mapped_elements),
+                   sequence_function{expr, *calc});
+
+    arrop.set_operands(std::move(mapped_elements));
+    return std::move(arr);
+  };
+
+  calcres = with_type<array>(arr.get(), mapper,
+                             []() -> any_expr { return any_expr{new array}; });
+}
+
+void evaluator::visit(filter &n) {
+  any_expr arr = eval(n.operand(0));
+  auto filter = [&n, &arr, calc = this](array &arrop) -> any_expr {
+    expr &expr = n.operand(1);
+    oper::container_type filtered_elements;
+
+    // non destructive predicate is required for evaluating and copying
+    std::copy_if(std::make_move_iterator(arrop.begin()),
+                 std::make_move_iterator(arrop.end()),
+                 std::back_inserter(filtered_elements),
+                 sequence_predicate_nondestructive{expr, *calc});
 
-    return to_expr(std::regex_search(rhs.begin(), rhs.end(), rgx));
-  }
-};
-#endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
+    arrop.set_operands(std::move(filtered_elements));
+    return std::move(arr);
+  };
 
-template <> struct operator_impl<merge> : array_operator {
-  using array_operator::result_type;
+  calcres = with_type<array>(arr.get(), filter,
+                             []() -> any_expr { return any_expr{new array}; });
+}
 
-  result_type operator()(array *lhs, array *rhs) const {
-    // note, to use the lhs entirely, it would need to be released
-    //   from its any_expr
-    array &res = deref(new array);
+void evaluator::visit(all &n) {
+  calcres = to_expr(quantify(n, [](auto aa, auto zz, auto pred) -> bool {
+    return std::all_of(aa, zz, pred);
+  }));
+}
 
-    {
-      oper::container_type &opers = res.operands();
+void evaluator::visit(none &n) {
+  calcres = to_expr(quantify(n, [](auto aa, auto zz, auto pred) -> bool {
+    return std::none_of(aa, zz, pred);
+  }));
+}
+
+void evaluator::visit(some &n) {
+  calcres = to_expr(quantify(n, [](auto aa, auto zz, auto pred) -> bool {
+    return std::any_of(aa, zz, pred);
+  }));
+}
+
+void evaluator::visit(error &) { unsupported(); }
+
+void evaluator::visit(var &n) {
+  assert(n.num_evaluated_operands() >= 1);
+
+  any_expr elm = eval(n.operand(0));
+  value_base &val = down_cast<value_base>(*elm);
+
+  try {
+    calcres = vars(val.to_json(), n.num());
+  } catch (...) {
+    profile_exception();
+    calcres = (n.num_evaluated_operands() > 1) ? eval(n.operand(1))
+                                               : to_expr(nullptr);
+  }
+
+  if (tracer) {
+    CXX_UNLIKELY;
+    trace(*tracer, trace_event::variable, n, n.num(), calcres);
+  }
+}
 
-      opers.swap(lhs->operands());
+void evaluator::probe_variables(array &elems, bool *found) {
+  const std::size_t num = elems.size();
+  const probing_accessor *acc = vars.target<probing_accessor>();
 
-      oper::container_type &ropers = rhs->operands();
+  if (acc == nullptr || !acc->probe) {
+    // other accessors report missing variables by throwing
+    for (std::size_t i = 0; i < num; ++i) {
+      try {
+        value_base &val = down_cast<value_base>(elems.operand(int(i)));
 
-      opers.insert(opers.end(), std::make_move_iterator(ropers.begin()),
-                   std::make_move_iterator(ropers.end()));
+        vars(val.to_json(), -1 /* logical_not membership varmap */);
+        found[i] = true;
+      } catch (...) {
+        profile_exception();
+        found[i] = false;
+      }
     }
 
-    return any_expr(&res);
+    return;
   }
-};
 
-struct evaluator : forwarding_visitor {
-  evaluator(variable_accessor varAccess, std::ostream &out)
-      : vars(std::move(varAccess)), logger(out), calcres(nullptr) {}
+  std::vector<json::value> keys;
 
-  void visit(equal &) final;
-  void visit(strict_equal &) final;
-  void visit(not_equal &) final;
-  void visit(strict_not_equal &) final;
-  void visit(less &) final;
-  void visit(greater &) final;
-  void visit(less_or_equal &) final;
-  void visit(greater_or_equal &) final;
-  void visit(logical_and &) final;
-  void visit(logical_or &) final;
-  void visit(logical_not &) final;
-  void visit(logical_not_not &) final;
-  void visit(add &) final;
-  void visit(subtract &) final;
-  void visit(multiply &) final;
-  void visit(divide &) final;
-  void visit(modulo &) final;
-  void visit(min &) final;
-  void visit(max &) final;
-  void visit(array &) final;
-  void visit(map &) final;
-  void visit(reduce &) final;
-  void visit(filter &) final;
-  void visit(all &) final;
-  void visit(none &) final;
-  void visit(some &) final;
-  void visit(merge &) final;
-  void visit(cat &) final;
-  void visit(substr &) final;
-  void visit(membership &) final;
-  void visit(var &) final;
-  void visit(missing &) final;
-  void visit(missing_some &) final;
-  void visit(log &) final;
+  keys.reserve(num);
 
-  void visit(if_expr &) final;
+  for (any_expr &elem : elems) {
+    value_base *val = may_down_cast<value_base>(deref(elem.get()));
 
-  void visit(null_value &n) final;
-  void visit(bool_value &n) final;
-  void visit(int_value &n) final;
-  void visit(unsigned_int_value &n) final;
-  void visit(real_value &n) final;
-  void visit(string_value &n) final;
+    keys.push_back(val ? val->to_json() : json::value{});
+  }
 
-  void visit(error &n) final;
+  acc->probe(keys.data(), num, found);
+}
 
-#if WITH_JSON_LOGIC_CPP_EXTENSIONS
-  void visit(regex_match &n) final;
-#endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
+std::size_t evaluator::missing_aux(array &elems) {
+  oper::container_type &keys = elems.operands();
+  std::unique_ptr<bool[]> found{new bool[keys.size()]};
 
-  any_expr eval(expr &n);
+  probe_variables(elems, found.get());
 
-private:
-  variable_accessor vars;
-  std::ostream &logger;
-  any_expr calcres;
+  // keeps the missing keys in order
+  auto pos = keys.begin();
 
-  evaluator(const evaluator &) = delete;
-  evaluator(evaluator &&) = delete;
-  evaluator &operator=(const evaluator &) = delete;
-  evaluator &operator=(evaluator &&) = delete;
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    if (!found[i]) {
+      if (pos != keys.begin() + i)
+        *pos = std::move(keys[i]);
 
-  //
-  // opers
+      ++pos;
+    }
+  }
 
-  /// implements relop : [1, 2, 3, whatever] as 1 relop 2 relop 3
-  template <class binary_predicate_t>
-  void eval_pair_short_circuit(oper &n, binary_predicate_t pred);
+  const std::size_t res = std::distance(pos, keys.end());
 
-  /// returns the first expression membership [ e1, e2, e3 ] that evaluates to
-  /// val,
-  ///   or the last expression otherwise
-  void eval_short_circuit(oper &n, bool val);
+  keys.erase(pos, keys.end());
+  return res;
+}
 
-  /// reduction operation on all elements
-  template <class binary_op_t> void reduce_sequence(oper &n, binary_op_t op);
+void evaluator::visit(missing &n) {
+  any_expr arg = eval(n.operand(0));
+  auto non_array_alt = [&arg, &n, calc = this]() -> array & {
+    // copy the remaining operands, so that the rule can be evaluated again
+    oper::container_type elems;
 
-  /// computes unary operation on n[0]
-  template <class UnaryOperator> void unary(oper &n, UnaryOperator calc);
+    elems.reserve(n.size());
+    elems.emplace_back(std::move(arg));
+    std::transform(std::next(n.begin()), n.end(), std::back_inserter(elems),
+                   [](const any_expr &e) -> any_expr { return clone_expr(e); });
 
-  /// binary operation on all elements (invents an element if none is present)
-  template <class binary_op_t> void binary(oper &n, binary_op_t binop);
+    array &res = deref(new array);
 
-  /// evaluates and unpacks n[argpos] to a fundamental value_base
-  template <class value_t>
-  value_t unpack_optional_arg(oper &n, int argpos, const value_t &defaultVal);
+    res.set_operands(std::move(elems));
+    arg.reset(&res);
+    calc->visit(res);
 
-  /// auxiliary missing method
-  std::size_t missing_aux(array &elems);
+    return res;
+  };
 
-  template <class ValueNode> void _value(const ValueNode &val) {
-    calcres = to_expr(val.value());
+  array &elems = with_type<array>(
+      arg.get(), [](array &arr) -> array & { return arr; }, // ignore other args
+      non_array_alt);
+
+  missing_aux(elems);
+  calcres = std::move(arg);
+}
+
+void evaluator::visit(missing_some &n) {
+  const std::uint64_t minreq = unpack_value<std::uint64_t>(eval(n.operand(0)));
+  any_expr arr = eval(n.operand(1));
+  array &elems = down_cast<array>(*arr); // evaluated elements
+  std::size_t avail = missing_aux(elems);
+
+  if (avail >= minreq)
+    elems.operands().clear();
+
+  calcres = std::move(arr);
+}
+
+template <class test_fn_t>
+int evaluator::select_branch(if_expr &n, test_fn_t test) {
+  const int num = n.num_evaluated_operands();
+
+  if (const equality_dispatch *index = n.dispatch()) {
+    any_expr val = eval(index->subject());
+    const std::uint32_t sel = index->find(*val);
+
+    if (sel == equality_dispatch::NO_MATCH) {
+      // the else branch, or num if there is none
+      const int pos = num - (num % 2);
+
+      trace_decision(n, pos, false);
+      return pos;
+    }
+
+    if (sel != equality_dispatch::UNINDEXED) {
+      trace_decision(n, sel, true);
+      return sel;
+    }
   }
-};
 
-struct sequence_function {
-  sequence_function(expr &e, std::ostream &logstream)
-      : exp(e), logger(logstream) {}
+  const int lim = num - 1;
+  int pos = 0;
 
-  any_expr operator()(any_expr &&elem) const {
-    any_expr *elptr = &elem; // workaround, b/c unique_ptr cannot be captured
+  while (pos < lim) {
+    if (test(n.operand(pos))) {
+      trace_decision(n, pos, true);
+      return pos;
+    }
 
-    evaluator sub{[elptr](const json::value &keyval, int) -> any_expr {
-                    if (const json::string *pkey = keyval.if_string()) {
-                      const json::string &key = *pkey;
+    pos += 2;
+  }
 
-                      if (key.size() == 0)
-                        return clone_expr(*elptr);
+  trace_decision(n, pos, false);
+  return pos;
+}
 
-                      try {
-                        object_value &o = down_cast<object_value>(**elptr);
+void evaluator::visit(if_expr &n) {
+  const int num = n.num_evaluated_operands();
 
-                        if (auto pos = o.find(key); pos != o.end())
-                          return clone_expr(pos->second);
-                      } catch (const type_error &) {
-                      }
-                    }
+  if (num == 0) {
+    calcres = to_expr(nullptr);
+    return;
+  }
 
-                    return to_expr(nullptr);
-                  },
-                  logger};
+  const int pos = select_branch(
+      n, [this](expr &cond) -> bool { return truthy(eval(cond)); });
 
-    return sub.eval(exp);
+  if (pos < num - 1)
+    calcres = eval(n.operand(pos + 1));
+  else
+    calcres = (pos < num) ? eval(n.operand(pos)) : to_expr(nullptr);
+}
+
+void evaluator::visit(log &n) {
+  assert(n.num_evaluated_operands() == 1);
+
+  calcres = eval(n.operand(0));
+
+  write_log(calcres);
+}
+
+void evaluator::visit(shared_subexpr &n) {
+  const std::size_t slot = n.slot();
+
+  if (shared.size() <= slot || !shared[slot]) {
+    // the operand may contain shared subexpressions, which can grow
+    // shared; thus the slot is only accessed after the evaluation.
+    any_expr val = eval(n.operand(0));
+
+    if (shared.size() <= slot)
+      shared.resize(slot + 1);
+
+    shared[slot] = std::move(val);
   }
 
-private:
-  expr &exp;
-  std::ostream &logger;
-};
+  calcres = clone_expr(shared[slot]);
+}
 
-struct sequence_predicate : sequence_function {
-  using sequence_function::sequence_function;
+void evaluator::visit(null_value &n) { _value(n); }
+void evaluator::visit(bool_value &n) { _value(n); }
+void evaluator::visit(int_value &n) { _value(n); }
+void evaluator::visit(unsigned_int_value &n) { _value(n); }
+void evaluator::visit(real_value &n) { _value(n); }
+void evaluator::visit(string_value &n) { _value(n); }
+
+any_expr apply(expr &exp, const variable_accessor &vars) {
+  evaluator ev{vars};
+
+  return ev.eval(exp);
+}
+
+bool matches(expr &exp, const variable_accessor &vars) {
+  evaluator ev{vars};
+
+  return ev.eval_truthy(exp);
+}
+
+any_expr eval_path(json::string_view path, const json::object &obj) {
+  if (auto pos = obj.find(path); pos != obj.end())
+    return jsonlogic::to_expr(pos->value());
+
+  if (std::size_t pos = path.find('.'); pos != json::string_view::npos) {
+    json::string_view selector = path.substr(0, pos);
+    json::string_view suffix = path.substr(pos + 1);
+
+    return eval_path(suffix, obj.at(selector).as_object());
+  }
+
+  throw std::out_of_range("jsonlogic - unable to locate path");
+}
+
+template <class IntT> any_expr eval_index(IntT idx, const json::array &arr) {
+  return jsonlogic::to_expr(arr[idx]);
+}
+
+/// tests if eval_path finds \p path in \p obj
+bool has_path(json::string_view path, const json::object &obj) {
+  if (obj.find(path) != obj.end())
+    return true;
+
+  const std::size_t pos = path.find('.');
+
+  if (pos == json::string_view::npos)
+    return false;
+
+  auto sel = obj.find(path.substr(0, pos));
+
+  if (sel == obj.end())
+    return false;
+
+  const json::object *sub = sel->value().if_object();
+
+  return sub && has_path(path.substr(pos + 1), *sub);
+}
 
-  bool operator()(any_expr &&elem) const {
-    return truthy(sequence_function::operator()(std::move(elem)));
+/// tests if the data accessor finds the variable \p keyval in \p data
+bool has_variable(const json::value &keyval, const json::value &data) {
+  if (const json::string *ppath = keyval.if_string()) {
+    const json::object *obj = data.if_object();
+
+    return ppath->empty() || (obj && has_path(*ppath, *obj));
   }
-};
 
-struct sequence_predicate_nondestructive : sequence_function {
-  using sequence_function::sequence_function;
+  const json::array *arr = data.if_array();
 
-  bool operator()(any_expr &&elem) const {
-    return truthy(sequence_function::operator()(clone_expr(elem)));
-  }
-};
+  if (arr == nullptr)
+    return false;
 
-/*
-  template <class InputIterator, class BinaryOperation>
-  any_expr
-  accumulate_move(InputIterator pos, InputIterator lim, any_expr accu,
-  BinaryOperation binop)
-  {
-    for ( ; pos != lim; ++pos)
-      accu = binop(std::move(accu), std::move(*first));
+  if (const std::int64_t *pidx = keyval.if_int64())
+    return *pidx >= 0 && std::uint64_t(*pidx) < arr->size();
 
-    return accu;
-  }
-*/
+  if (const std::uint64_t *pidx = keyval.if_uint64())
+    return *pidx < arr->size();
 
-struct sequence_reduction {
-  sequence_reduction(expr &e, std::ostream &logstream)
-      : exp(e), logger(logstream) {}
-
-  // for compatibility reasons, the first argument is passed membership as
-  // templated && ref.
-  //   g++ -std=c++17 passes membership a & ref, while g++ -std=c++20 passes
-  //   membership a &&.
-  // the templated && together with reference collapsing make the code portable
-  // across standard versions.
-  // \note const ValueExprT& would also work, but currently the
-  //       visitor calls membership clone_expr require a non-const reference.
-  template <class ValueExprT>
-  any_expr operator()(ValueExprT &&accu, any_expr elem) const {
-    any_expr *acptr = &accu; // workaround, b/c unique_ptr cannot be captured
-    any_expr *elptr = &elem; // workaround, b/c unique_ptr cannot be captured
+  return false;
+}
 
-    evaluator sub{[acptr, elptr](const json::value &keyval, int) -> any_expr {
-                    if (const json::string *pkey = keyval.if_string()) {
-                      if (*pkey == "current")
-                        return clone_expr(*elptr);
+} // namespace
 
-                      if (*pkey == "accumulator")
-                        return clone_expr(*acptr);
-                    }
+any_expr apply(const any_expr &exp, const variable_accessor &vars) {
+  assert(exp.get());
+  return apply(*exp, vars);
+}
 
-                    return to_expr(nullptr);
-                  },
-                  logger};
+any_expr apply(const any_expr &exp, const variable_accessor &vars,
+               evaluation_context &ctx, result_storage storage) {
+  assert(exp.get());
 
-    return sub.eval(exp);
-  }
+  scratch_scope arena{ctx.storage().get()};
+  any_expr res = apply(*exp, vars);
 
-private:
-  expr &exp;
-  std::ostream &logger;
-};
+  if (storage == result_storage::arena)
+    return res;
 
-template <class value_t>
-value_t evaluator::unpack_optional_arg(oper &n, int argpos,
-                                       const value_t &defaultVal) {
-  if (std::size_t(argpos) >= n.size()) {
-    CXX_UNLIKELY;
-    return defaultVal;
-  }
+  // copy the result out of the arena
+  scratch_scope heap{nullptr};
 
-  return unpack_value<value_t>(*eval(n.operand(argpos)));
+  return clone_expr(res);
 }
 
-template <class unary_predicate_t>
-void evaluator::unary(oper &n, unary_predicate_t pred) {
-  CXX_MAYBE_UNUSED
-  const int num = n.num_evaluated_operands();
-  assert(num == 1);
+evaluation_context::evaluation_context(std::size_t initial_size)
+    : arena(initial_size) {}
 
-  const bool res = pred(*eval(n.operand(0)));
+void evaluation_context::release() {
+  assert(scratch_arena != &arena);
+  arena.release();
+}
 
-  calcres = to_expr(res);
+json::storage_ptr evaluation_context::storage() {
+  return json::storage_ptr(&arena);
 }
 
-template <class binary_op_t>
-void evaluator::binary(oper &n, binary_op_t binop) {
-  const int num = n.num_evaluated_operands();
-  assert(num == 1 || num == 2);
+//
+// incremental evaluation
 
-  int idx = -1;
-  any_expr lhs;
+struct incremental_evaluator::impl {
+  const logic_details &logic;
+  node_memo memo;
+};
 
-  if (num == 2) {
-    CXX_LIKELY;
-    lhs = eval(n.operand(++idx));
-  } else {
-    lhs = to_expr(std::int64_t(0));
-  }
+incremental_evaluator::incremental_evaluator(const logic_details &logic)
+    : pimpl(new impl{logic, {}}) {
+  pimpl->memo.analyze(deref(logic.synatx_tree().get()));
+}
 
-  any_expr rhs = eval(n.operand(++idx));
+incremental_evaluator::~incremental_evaluator() = default;
 
-  calcres = compute(lhs, rhs, binop);
+any_expr incremental_evaluator::evaluate(const variable_accessor &vars) {
+  evaluator ev{vars};
+  node_memo &memo = pimpl->memo;
+
+  memo.recomputed = memo.reused = 0;
+  ev.reuse_results(memo);
+  return ev.eval(deref(pimpl->logic.synatx_tree().get()));
 }
 
-template <class binary_op_t>
-void evaluator::reduce_sequence(oper &n, binary_op_t op) {
-  const int num = n.num_evaluated_operands();
-  assert(num >= 1);
+void incremental_evaluator::changed(int slot) { pimpl->memo.changed(slot); }
 
-  int idx = -1;
-  any_expr res = eval(n.operand(++idx));
+void incremental_evaluator::changed(json::string_view name) {
+  const std::string_view changedName{name.data(), name.size()};
+  const std::vector<json::string> &names = pimpl->logic.variable_names();
 
-  res = convert(std::move(res), op);
+  // a path is also affected by changes to its prefixes and extensions
+  auto affects = [](std::string_view path, std::string_view prefix) -> bool {
+    return path.size() > prefix.size() &&
+           path.compare(0, prefix.size(), prefix) == 0 &&
+           path[prefix.size()] == '.';
+  };
 
-  while (idx != (num - 1)) {
-    any_expr rhs = eval(n.operand(++idx));
+  for (std::size_t slot = 0; slot < names.size(); ++slot) {
+    const std::string_view slotName = key_view(names[slot]);
 
-    rhs = convert(std::move(rhs), op);
-    res = compute(res, rhs, op);
+    if (slotName == changedName || affects(slotName, changedName) ||
+        affects(changedName, slotName))
+      pimpl->memo.changed(slot);
   }
+}
 
-  calcres = std::move(res);
+void incremental_evaluator::invalidate() { pimpl->memo.invalidate(); }
+
+std::size_t incremental_evaluator::recomputed() const {
+  return pimpl->memo.recomputed;
 }
 
-template <class binary_predicate_t>
-void evaluator::eval_pair_short_circuit(oper &n, binary_predicate_t pred) {
-  const int num = n.num_evaluated_operands();
-  assert(num >= 2);
+std::size_t incremental_evaluator::reused() const {
+  return pimpl->memo.reused;
+}
 
-  bool res = true;
-  int idx = -1;
-  any_expr rhs = eval(n.operand(++idx));
-  assert(rhs.get());
+#if WITH_JSON_LOGIC_CPP_PROFILER
+//
+// profiler
 
-  while (res && (idx != (num - 1))) {
-    any_expr lhs = std::move(rhs);
-    assert(lhs.get());
+namespace {
 
-    rhs = eval(n.operand(++idx));
-    assert(rhs.get());
+/// returns the name of an operator node
+struct operator_name {
+  template <class expr_t> std::string_view operator()(expr_t &) const {
+    if constexpr (std::is_same<expr_t, array>::value) {
+      return "[]";
+    } else if constexpr (std::is_same<expr_t, var>::value) {
+      return "var";
+    } else if constexpr (std::is_base_of<oper, expr_t>::value) {
+      for (const operator_entry &op : builtin_operators)
+        if (op.build == &mk_operator<expr_t>)
+          return op.name;
+    }
 
-    res = compute(lhs, rhs, pred);
+    return "?";
   }
+};
 
-  calcres = to_expr(res);
+json::object to_json(const profiler::counters &cnt) {
+  return {{"evaluations", cnt.evaluations},
+          {"inclusive_ns", cnt.inclusive.count()},
+          {"exclusive_ns", cnt.exclusive.count()},
+          {"allocations", cnt.allocations},
+          {"exceptions", cnt.exceptions}};
 }
 
-void evaluator::eval_short_circuit(oper &n, bool val) {
-  const int num = n.num_evaluated_operands();
+json::value annotate(expr &n, const profile_state &state) {
+  if (value_base *val = may_down_cast<value_base>(n))
+    return val->to_json();
 
-  if (num == 0) {
-    CXX_UNLIKELY;
-    throw_type_error();
-  }
+  oper *op = may_down_cast<oper>(n);
 
-  int idx = -1;
-  any_expr oper = eval(n.operand(++idx));
-  //~ std::cerr << idx << ") " << oper << std::endl;
+  if (op == nullptr)
+    return nullptr;
 
-  bool found = (idx == num - 1) || (truthy(*oper) == val);
+  if (may_down_cast<shared_subexpr>(n))
+    return annotate(op->operand(0), state);
 
-  // loop until *aa == val or when *aa is the last valid element
-  while (!found) {
-    oper = eval(n.operand(++idx));
-    //~ std::cerr << idx << ") " << oper << std::endl;
+  json::array operands;
 
-    found = (idx == (num - 1)) || (truthy(*oper) == val);
-  }
+  for (any_expr &sub : op->operands())
+    operands.push_back(annotate(deref(sub.get()), state));
 
-  calcres = std::move(oper);
-}
+  if (may_down_cast<array>(n))
+    return operands;
 
-any_expr evaluator::eval(expr &n) {
-  any_expr res;
+  const std::string_view name = generic_visit(operator_name{}, &n);
+  json::object res;
+  json::value &args = res[json::string_view{name.data(), name.size()}];
 
-  n.accept(*this);
-  res.swap(calcres);
+  if (operands.size() == 1)
+    args = std::move(operands[0]);
+  else
+    args = std::move(operands);
+
+  if (auto pos = state.index.find(&n); pos != state.index.end())
+    res["profile"] = to_json(state.stats[pos->second]);
 
   return res;
 }
+} // namespace
 
-void evaluator::visit(equal &n) {
-  eval_pair_short_circuit(n, operator_impl<equal>{});
-}
+struct profiler::impl {
+  expr &root;
+  profile_state state;
+};
 
-void evaluator::visit(strict_equal &n) {
-  eval_pair_short_circuit(n, operator_impl<strict_equal>{});
-}
+profiler::profiler(const logic_details &logic)
+    : pimpl(new impl{deref(logic.synatx_tree().get()), {}}) {
+  profile_state &state = pimpl->state;
 
-void evaluator::visit(not_equal &n) {
-  eval_pair_short_circuit(n, operator_impl<not_equal>{});
+  state.analyze(pimpl->root, profile_state::NO_PARENT);
+  state.stats.resize(state.nodes.size());
+  state.prev = active_profiler;
+  active_profiler = &state;
 }
 
-void evaluator::visit(strict_not_equal &n) {
-  eval_pair_short_circuit(n, operator_impl<strict_not_equal>{});
+profiler::~profiler() {
+  assert(active_profiler == &pimpl->state);
+  active_profiler = pimpl->state.prev;
 }
 
-void evaluator::visit(less &n) {
-  eval_pair_short_circuit(n, operator_impl<less>{});
+json::value profiler::annotated() const {
+  return annotate(pimpl->root, pimpl->state);
 }
 
-void evaluator::visit(greater &n) {
-  eval_pair_short_circuit(n, operator_impl<greater>{});
-}
+void profiler::write_folded(std::ostream &os) const {
+  const profile_state &state = pimpl->state;
+  std::vector<std::string> paths;
 
-void evaluator::visit(less_or_equal &n) {
-  eval_pair_short_circuit(n, operator_impl<less_or_equal>{});
-}
+  // parents precede their children in pre-order
+  paths.reserve(state.nodes.size());
 
-void evaluator::visit(greater_or_equal &n) {
-  eval_pair_short_circuit(n, operator_impl<greater_or_equal>{});
-}
+  for (std::size_t id = 0; id < state.nodes.size(); ++id) {
+    std::string path;
 
-void evaluator::visit(logical_and &n) { eval_short_circuit(n, false); }
+    if (state.parents[id] != profile_state::NO_PARENT)
+      path = paths[state.parents[id]] + ';';
 
-void evaluator::visit(logical_or &n) { eval_short_circuit(n, true); }
+    path += generic_visit(operator_name{}, state.nodes[id]);
+    paths.push_back(path);
 
-void evaluator::visit(logical_not &n) {
-  unary(n, operator_impl<logical_not>{});
+    if (state.stats[id].evaluations)
+      os << path << ' ' << state.stats[id].exclusive.count() << '\n';
+  }
 }
 
-void evaluator::visit(logical_not_not &n) {
-  unary(n, operator_impl<logical_not_not>{});
+profiler::counters profiler::total() const {
+  return pimpl->state.stats.empty() ? counters{} : pimpl->state.stats.front();
 }
 
-void evaluator::visit(add &n) { reduce_sequence(n, operator_impl<add>{}); }
-
-void evaluator::visit(subtract &n) { binary(n, operator_impl<subtract>{}); }
+void profiler::reset() {
+  std::fill(pimpl->state.stats.begin(), pimpl->state.stats.end(), counters{});
+}
+#endif /* WITH_JSON_LOGIC_CPP_PROFILER */
 
-void evaluator::visit(multiply &n) {
-  reduce_sequence(n, operator_impl<multiply>{});
+any_expr apply(const any_expr &exp) {
+  return jsonlogic::apply(exp, [](const json::value &, int) -> any_expr {
+    throw std::runtime_error{"variable not available"};
+  });
 }
 
-void evaluator::visit(divide &n) { binary(n, operator_impl<divide>{}); }
+variable_accessor data_accessor(json::value data) {
+  // the lookup and the probe share the data
+  auto doc = std::make_shared<const json::value>(std::move(data));
 
-void evaluator::visit(modulo &n) { binary(n, operator_impl<modulo>{}); }
+  variable_accessor lookup = [doc](const json::value &keyval,
+                                   int) -> any_expr {
+    const json::value &data = *doc;
 
-void evaluator::visit(min &n) { reduce_sequence(n, operator_impl<min>{}); }
+    if (const json::string *ppath = keyval.if_string()) {
+      //~ std::cerr << *ppath << std::endl;
+      return ppath->size() ? eval_path(*ppath, data.as_object())
+                           : to_expr(data);
+    }
 
-void evaluator::visit(max &n) { reduce_sequence(n, operator_impl<max>{}); }
+    if (const std::int64_t *pidx = keyval.if_int64())
+      return eval_index(*pidx, data.as_array());
 
-void evaluator::visit(cat &n) { reduce_sequence(n, operator_impl<cat>{}); }
+    if (const std::uint64_t *pidx = keyval.if_uint64())
+      return eval_index(*pidx, data.as_array());
 
-void evaluator::visit(membership &n) { binary(n, operator_impl<membership>{}); }
+    throw std::logic_error{"jsonlogic - unsupported var access"};
+  };
 
-#if WITH_JSON_LOGIC_CPP_EXTENSIONS
-void evaluator::visit(regex_match &n) {
-  binary(n, operator_impl<membership>{});
-}
-#endif /* WITH_JSON_LOGIC_CPP_EXTENSIONS */
+  variable_probe probe = [doc](const json::value *keys, std::size_t num,
+                               bool *found) -> void {
+    for (std::size_t i = 0; i < num; ++i)
+      found[i] = has_variable(keys[i], *doc);
+  };
 
-void evaluator::visit(substr &n) {
-  assert(n.num_evaluated_operands() >= 1);
+  return probing_accessor{std::move(lookup), std::move(probe)};
+}
 
-  json::string str = unpack_value<json::string>(*eval(n.operand(0)));
-  std::int64_t ofs = unpack_optional_arg<std::int64_t>(n, 1, 0);
-  std::int64_t cnt = unpack_optional_arg<std::int64_t>(n, 2, 0);
+any_expr apply(json::value rule, json::value data) {
+  if (std::shared_ptr<rule_cache> cache = active_rule_cache.get()) {
+    std::shared_ptr<const logic_details> logic = cache->get(rule);
 
-  if (ofs < 0) {
-    CXX_UNLIKELY;
-    ofs = std::max(std::int64_t(str.size()) + ofs, std::int64_t(0));
+    return jsonlogic::apply(logic->synatx_tree(),
+                            data_accessor(std::move(data)));
   }
 
-  if (cnt < 0) {
-    CXX_UNLIKELY;
-    cnt = std::max(std::int64_t(str.size()) - ofs + cnt, std::int64_t(0));
-  }
+  logic_details logic = create_logic(rule);
 
-  calcres = to_expr(json::string{str.subview(ofs, cnt)});
+  return jsonlogic::apply(logic.synatx_tree(), data_accessor(std::move(data)));
 }
 
-void evaluator::visit(array &n) {
-  oper::container_type elems;
-  evaluator *self = this;
+bool matches(const any_expr &exp, const variable_accessor &vars) {
+  assert(exp.get());
+  return matches(*exp, vars);
+}
 
-  // \todo consider making arrays lazy
-  std::transform(
-      std::make_move_iterator(n.begin()), std::make_move_iterator(n.end()),
-      std::back_inserter(elems),
-      [self](any_expr &&exp) -> any_expr { return self->eval(*exp); });
+bool matches(json::value rule, json::value data) {
+  if (std::shared_ptr<rule_cache> cache = active_rule_cache.get()) {
+    std::shared_ptr<const logic_details> logic = cache->get(rule);
 
-  array &res = deref(new array);
+    return jsonlogic::matches(logic->synatx_tree(),
+                              data_accessor(std::move(data)));
+  }
 
-  res.set_operands(std::move(elems));
+  logic_details logic = create_logic(rule);
 
-  calcres = any_expr(&res);
+  return jsonlogic::matches(logic.synatx_tree(),
+                            data_accessor(std::move(data)));
 }
 
-void evaluator::visit(merge &n) { reduce_sequence(n, operator_impl<merge>{}); }
+//
+// tracing
 
-void evaluator::visit(reduce &n) {
-  any_expr arr = eval(n.operand(0));
-  expr &expr = n.operand(1);
-  any_expr accu = eval(n.operand(2));
-  any_expr *acptr = &accu;
+any_expr apply(const any_expr &exp, const variable_accessor &vars,
+               trace_sink *sink) {
+  assert(exp.get());
 
-  auto op = [&expr, acptr,
-             calclogger = &this->logger](array &arrop) -> any_expr {
-    // non destructive predicate is required for evaluating and copying
-    return std::accumulate(std::make_move_iterator(arrop.begin()),
-                           std::make_move_iterator(arrop.end()),
-                           std::move(*acptr),
-                           sequence_reduction{expr, *calclogger});
-  };
+  evaluator ev{vars};
 
-  calcres =
-      with_type<array>(arr.get(), op, []() -> any_expr { return nullptr; });
+  ev.trace_to(sink);
+  return ev.eval(*exp);
 }
 
-void evaluator::visit(map &n) {
-  any_expr arr = eval(n.operand(0));
-  auto mapper = [&n, &arr,
-                 calclogger = &this->logger](array &arrop) -> any_expr {
-    expr &expr = n.operand(1);
-    oper::container_type mapped_elements;
-
-    std::transform(std::make_move_iterator(arrop.begin()),
-                   std::make_move_iterator(arrop.end()),
-                   std::back_inserter(mapped_elements),
-                   sequence_function{expr, *calclogger});
+bool matches(const any_expr &exp, const variable_accessor &vars,
+             trace_sink *sink) {
+  assert(exp.get());
 
-    arrop.set_operands(std::move(mapped_elements));
-    return std::move(arr);
-  };
+  evaluator ev{vars};
 
-  calcres = with_type<array>(arr.get(), mapper,
-                             []() -> any_expr { return any_expr{new array}; });
+  ev.trace_to(sink);
+  return ev.eval_truthy(*exp);
 }
 
-void evaluator::visit(filter &n) {
-  any_expr arr = eval(n.operand(0));
-  auto filter = [&n, &arr,
-                 calclogger = &this->logger](array &arrop) -> any_expr {
-    expr &expr = n.operand(1);
-    oper::container_type filtered_elements;
+namespace {
+/// a single-producer single-consumer ring of trace records
+struct trace_ring {
+  explicit trace_ring(std::size_t capacity) : records(capacity) {}
 
-    // non destructive predicate is required for evaluating and copying
-    std::copy_if(std::make_move_iterator(arrop.begin()),
-                 std::make_move_iterator(arrop.end()),
-                 std::back_inserter(filtered_elements),
-                 sequence_predicate_nondestructive{expr, *calclogger});
+  std::vector<trace_record> records;
+
+  // separate cache lines for the producer and consumer positions
+  alignas(64) std::atomic<std::uint64_t> head{0}; ///< next write position
+  alignas(64) std::atomic<std::uint64_t> tail{0}; ///< next read position
+};
+
+/// the ring of the last trace buffer used by this thread
+struct trace_ring_cache {
+  std::uint64_t owner = 0; ///< the id of the trace buffer
+  trace_ring *ring = nullptr;
+};
+
+thread_local trace_ring_cache last_trace_ring;
+
+/// trace buffer ids are never reused, so that a cached ring of a
+///   destroyed buffer cannot be confused with the ring of a new buffer.
+std::atomic<std::uint64_t> trace_buffer_ids{0};
+} // namespace
+
+struct trace_buffer::impl {
+  explicit impl(std::size_t cap)
+      : capacity(cap), id(++trace_buffer_ids) {}
+
+  /// returns the ring of the calling thread
+  trace_ring &local_ring() {
+    if (last_trace_ring.owner == id) {
+      CXX_LIKELY;
+      return *last_trace_ring.ring;
+    }
+
+    std::lock_guard<std::mutex> lock{mtx};
+    std::unique_ptr<trace_ring> &ring = rings[std::this_thread::get_id()];
+
+    if (!ring)
+      ring.reset(new trace_ring{capacity});
+
+    last_trace_ring = trace_ring_cache{id, ring.get()};
+    return *ring;
+  }
 
-    arrop.set_operands(std::move(filtered_elements));
-    return std::move(arr);
-  };
+  const std::size_t capacity; ///< a power of two
+  const std::uint64_t id;
+  std::atomic<std::uint64_t> dropped{0};
 
-  calcres = with_type<array>(arr.get(), filter,
-                             []() -> any_expr { return any_expr{new array}; });
-}
+  /// guards rings and serializes consumers
+  std::mutex mtx;
+  std::unordered_map<std::thread::id, std::unique_ptr<trace_ring>> rings;
+};
 
-void evaluator::visit(all &n) {
-  any_expr arr = eval(n.operand(0));
-  array &elems = down_cast<array>(*arr); // evaluated elements
-  expr &expr = n.operand(1);
-  const bool res = std::all_of(std::make_move_iterator(elems.begin()),
-                               std::make_move_iterator(elems.end()),
-                               sequence_predicate{expr, logger});
+trace_buffer::trace_buffer(std::size_t capacity) {
+  std::size_t cap = 1;
 
-  calcres = to_expr(res);
+  while (cap < capacity)
+    cap *= 2;
+
+  pimpl.reset(new impl{cap});
 }
 
-void evaluator::visit(none &n) {
-  any_expr arr = eval(n.operand(0));
-  array &elems = down_cast<array>(*arr); // evaluated elements
-  expr &expr = n.operand(1);
-  const bool res = std::none_of(std::make_move_iterator(elems.begin()),
-                                std::make_move_iterator(elems.end()),
-                                sequence_predicate{expr, logger});
+trace_buffer::~trace_buffer() = default;
 
-  calcres = to_expr(res);
-}
+void trace_buffer::record(const trace_record &rec) {
+  trace_ring &ring = pimpl->local_ring();
+  const std::uint64_t head = ring.head.load(std::memory_order_relaxed);
 
-void evaluator::visit(some &n) {
-  any_expr arr = eval(n.operand(0));
-  array &elems = down_cast<array>(*arr); // evaluated elements
-  expr &expr = n.operand(1);
-  const bool res = std::any_of(std::make_move_iterator(elems.begin()),
-                               std::make_move_iterator(elems.end()),
-                               sequence_predicate{expr, logger});
+  if (head - ring.tail.load(std::memory_order_acquire) == pimpl->capacity) {
+    CXX_UNLIKELY;
+    pimpl->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
 
-  calcres = to_expr(res);
+  ring.records[head & (pimpl->capacity - 1)] = rec;
+  ring.head.store(head + 1, std::memory_order_release);
 }
 
-void evaluator::visit(error &) { unsupported(); }
+std::size_t trace_buffer::drain(std::vector<trace_record> &out) {
+  std::lock_guard<std::mutex> lock{pimpl->mtx};
+  const std::size_t mask = pimpl->capacity - 1;
+  const std::size_t before = out.size();
 
-void evaluator::visit(var &n) {
-  assert(n.num_evaluated_operands() >= 1);
+  for (auto &entry : pimpl->rings) {
+    trace_ring &ring = *entry.second;
+    const std::uint64_t head = ring.head.load(std::memory_order_acquire);
+    std::uint64_t tail = ring.tail.load(std::memory_order_relaxed);
 
-  any_expr elm = eval(n.operand(0));
-  value_base &val = down_cast<value_base>(*elm);
+    for (; tail != head; ++tail)
+      out.push_back(ring.records[tail & mask]);
 
-  try {
-    calcres = vars(val.to_json(), n.num());
-  } catch (...) {
-    calcres = (n.num_evaluated_operands() > 1) ? eval(n.operand(1))
-                                               : to_expr(nullptr);
+    ring.tail.store(tail, std::memory_order_release);
   }
+
+  return out.size() - before;
 }
 
-std::size_t evaluator::missing_aux(array &elems) {
-  auto avail = [calc = this](any_expr &v) -> bool {
-    try {
-      value_base &val = down_cast<value_base>(*v);
+std::uint64_t trace_buffer::dropped() const {
+  return pimpl->dropped.load(std::memory_order_relaxed);
+}
 
-      calc->vars(val.to_json(), -1 /* logical_not membership varmap */);
-    } catch (...) {
-      return false;
-    }
+//
+// logging
 
-    return true;
-  };
+void use_log_sink(std::shared_ptr<log_sink> sink) {
+  active_log_sink.set(std::move(sink));
+}
 
-  array::iterator beg = elems.begin();
-  array::iterator lim = elems.end();
-  array::iterator pos = std::remove_if(beg, lim, avail);
-  std::size_t res = std::distance(pos, lim);
+namespace {
+/// the lines that a thread logged since the last batch
+struct log_buffer {
+  std::mutex guard; ///< only contended while the batch is taken
+  std::string text;
+};
 
-  elems.operands().erase(pos, lim);
-  return res;
-}
+/// the buffer of the last async log sink used by this thread
+struct log_buffer_cache {
+  std::uint64_t owner = 0; ///< the id of the async log sink
+  log_buffer *buffer = nullptr;
+};
 
-void evaluator::visit(missing &n) {
-  any_expr arg = eval(n.operand(0));
-  auto non_array_alt = [&arg, &n, calc = this]() -> array & {
-    array &res = deref(new array);
+thread_local log_buffer_cache last_log_buffer;
 
-    res.set_operands(std::move(n).move_operands());
-    res.operands().front().swap(arg);
-    arg.reset(&res);
-    calc->visit(res);
+std::atomic<std::uint64_t> async_log_sink_ids{0};
+} // namespace
 
-    return res;
-  };
+struct async_log_sink::impl {
+  impl(writer w, async_log_options o)
+      : out(std::move(w)), opts(o), id(++async_log_sink_ids) {
+    worker = std::thread{[this]() -> void { run(); }};
+  }
 
-  array &elems = with_type<array>(
-      arg.get(), [](array &arr) -> array & { return arr; }, // ignore other args
-      non_array_alt);
+  /// returns the buffer of the calling thread
+  log_buffer &local_buffer() {
+    if (last_log_buffer.owner == id) {
+      CXX_LIKELY;
+      return *last_log_buffer.buffer;
+    }
 
-  missing_aux(elems);
-  calcres = std::move(arg);
-}
+    std::lock_guard<std::mutex> lock{guard};
+    std::unique_ptr<log_buffer> &buf = buffers[std::this_thread::get_id()];
 
-void evaluator::visit(missing_some &n) {
-  const std::uint64_t minreq = unpack_value<std::uint64_t>(eval(n.operand(0)));
-  any_expr arr = eval(n.operand(1));
-  array &elems = down_cast<array>(*arr); // evaluated elements
-  std::size_t avail = missing_aux(elems);
+    if (!buf)
+      buf.reset(new log_buffer);
 
-  if (avail >= minreq)
-    elems.operands().clear();
+    last_log_buffer = log_buffer_cache{id, buf.get()};
+    return *buf;
+  }
 
-  calcres = std::move(arr);
-}
+  /// returns true if the rate limit admits another line
+  bool admit() {
+    using clock = std::chrono::steady_clock;
 
-void evaluator::visit(if_expr &n) {
-  const int num = n.num_evaluated_operands();
+    if (opts.max_lines_per_second == 0)
+      return true;
 
-  if (num == 0) {
-    calcres = to_expr(nullptr);
-    return;
+    const std::int64_t second =
+        std::chrono::duration_cast<std::chrono::seconds>(
+            clock::now().time_since_epoch())
+            .count();
+    std::int64_t current = window.load(std::memory_order_relaxed);
+
+    if (current != second &&
+        window.compare_exchange_strong(current, second,
+                                       std::memory_order_relaxed))
+      windowLines.store(0, std::memory_order_relaxed);
+
+    return windowLines.fetch_add(1, std::memory_order_relaxed) <
+           opts.max_lines_per_second;
   }
 
-  const int lim = num - 1;
-  int pos = 0;
+  /// wakes the background thread before the interval elapses
+  void request_batch() {
+    std::lock_guard<std::mutex> lock{guard};
 
-  while (pos < lim) {
-    if (truthy(eval(n.operand(pos)))) {
-      calcres = eval(n.operand(pos + 1));
-      return;
+    urgent = true;
+    wakeup.notify_one();
+  }
+
+  /// passes the content of all buffers to the writer
+  void write_batches() {
+    std::vector<log_buffer *> all;
+
+    {
+      std::lock_guard<std::mutex> lock{guard};
+
+      all.reserve(buffers.size());
+
+      for (auto &entry : buffers)
+        all.push_back(entry.second.get());
     }
 
-    pos += 2;
+    for (log_buffer *buf : all) {
+      {
+        std::lock_guard<std::mutex> lock{buf->guard};
+
+        batch.swap(buf->text);
+      }
+
+      if (!batch.empty())
+        out(batch);
+
+      batch.clear();
+    }
   }
 
-  calcres = (pos < num) ? eval(n.operand(pos)) : to_expr(nullptr);
-}
+  /// the loop of the background thread
+  void run() {
+    std::unique_lock<std::mutex> lock{guard};
 
-void evaluator::visit(log &n) {
-  assert(n.num_evaluated_operands() == 1);
+    for (;;) {
+      wakeup.wait_for(lock, opts.interval, [this]() -> bool {
+        return stopping || urgent || requested != completed;
+      });
 
-  calcres = eval(n.operand(0));
+      const bool last = stopping;
+      const std::uint64_t serving = requested;
 
-  logger << calcres << std::endl;
-}
+      urgent = false;
+      lock.unlock();
+      write_batches();
+      lock.lock();
 
-void evaluator::visit(null_value &n) { _value(n); }
-void evaluator::visit(bool_value &n) { _value(n); }
-void evaluator::visit(int_value &n) { _value(n); }
-void evaluator::visit(unsigned_int_value &n) { _value(n); }
-void evaluator::visit(real_value &n) { _value(n); }
-void evaluator::visit(string_value &n) { _value(n); }
+      completed = serving;
+      flushed.notify_all();
 
-any_expr apply(expr &exp, const variable_accessor &vars) {
-  evaluator ev{vars, std::cerr};
+      if (last)
+        return;
+    }
+  }
 
-  return ev.eval(exp);
-}
+  writer out;
+  const async_log_options opts;
+  const std::uint64_t id;
+  std::atomic<std::uint64_t> dropped{0};
 
-any_expr eval_path(const json::string &path, const json::object &obj) {
-  if (auto pos = obj.find(path); pos != obj.end())
-    return jsonlogic::to_expr(pos->value());
+  // the rate limit counts the lines per second
+  std::atomic<std::int64_t> window{-1};
+  std::atomic<std::uint64_t> windowLines{0};
 
-  if (std::size_t pos = path.find('.'); pos != json::string::npos) {
-    json::string selector = path.subview(0, pos);
-    json::string suffix = path.subview(pos + 1);
+  std::string batch; ///< only used by the background thread
 
-    return eval_path(suffix, obj.at(selector).as_object());
-  }
+  /// guards buffers and the state of the background thread
+  std::mutex guard;
+  std::condition_variable wakeup;
+  std::condition_variable flushed;
+  std::unordered_map<std::thread::id, std::unique_ptr<log_buffer>> buffers;
+  std::uint64_t requested = 0; ///< the number of flush requests
+  std::uint64_t completed = 0; ///< the number of served flush requests
+  bool urgent = false;
+  bool stopping = false;
+  std::thread worker;
+};
 
-  throw std::out_of_range("jsonlogic - unable to locate path");
-}
+async_log_sink::async_log_sink(writer out, async_log_options opts)
+    : pimpl(new impl{std::move(out), opts}) {}
 
-template <class IntT> any_expr eval_index(IntT idx, const json::array &arr) {
-  return jsonlogic::to_expr(arr[idx]);
-}
+async_log_sink::~async_log_sink() {
+  {
+    std::lock_guard<std::mutex> lock{pimpl->guard};
 
-} // namespace
+    pimpl->stopping = true;
+    pimpl->wakeup.notify_one();
+  }
 
-any_expr apply(const any_expr &exp, const variable_accessor &vars) {
-  assert(exp.get());
-  return apply(*exp, vars);
+  pimpl->worker.join();
 }
 
-any_expr apply(const any_expr &exp) {
-  return jsonlogic::apply(exp, [](const json::value &, int) -> any_expr {
-    throw std::runtime_error{"variable not available"};
-  });
-}
+void async_log_sink::write(json::string_view line) {
+  if (!pimpl->admit()) {
+    CXX_UNLIKELY;
+    pimpl->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
 
-variable_accessor data_accessor(json::value data) {
-  return [data = std::move(data)](const json::value &keyval, int) -> any_expr {
-    if (const json::string *ppath = keyval.if_string()) {
-      //~ std::cerr << *ppath << std::endl;
-      return ppath->size() ? eval_path(*ppath, data.as_object())
-                           : to_expr(data);
-    }
+  log_buffer &buf = pimpl->local_buffer();
+  bool full = false;
 
-    if (const std::int64_t *pidx = keyval.if_int64())
-      return eval_index(*pidx, data.as_array());
+  {
+    std::lock_guard<std::mutex> lock{buf.guard};
 
-    if (const std::uint64_t *pidx = keyval.if_uint64())
-      return eval_index(*pidx, data.as_array());
+    buf.text.append(line.data(), line.size());
+    buf.text.push_back('\n');
+    full = buf.text.size() >= pimpl->opts.batch_bytes;
+  }
 
-    throw std::logic_error{"jsonlogic - unsupported var access"};
-  };
+  if (full) {
+    CXX_UNLIKELY;
+    pimpl->request_batch();
+  }
 }
 
-any_expr apply(json::value rule, json::value data) {
-  logic_details logic = create_logic(rule);
+void async_log_sink::flush() {
+  std::unique_lock<std::mutex> lock{pimpl->guard};
+  const std::uint64_t ticket = ++pimpl->requested;
 
-  return jsonlogic::apply(logic.synatx_tree(), data_accessor(std::move(data)));
+  pimpl->wakeup.notify_one();
+  pimpl->flushed.wait(lock, [this, ticket]() -> bool {
+    return pimpl->completed >= ticket;
+  });
+}
+
+std::uint64_t async_log_sink::dropped() const {
+  return pimpl->dropped.load(std::memory_order_relaxed);
 }
 
 namespace {
@@ -2679,6 +7197,23 @@ struct value_printer : forwarding_visitor {
     os << "]";
   }
 
+  void visit(object_value &n) final {
+    bool first = true;
+
+    os << "{";
+    for (object_value::value_type &el : n) {
+      if (first)
+        first = false;
+      else
+        os << ",";
+
+      os << json::value(el.first) << ":";
+      deref(el.second).accept(*this);
+    }
+
+    os << "}";
+  }
+
 private:
   std::ostream &os;
 };
@@ -2692,6 +7227,216 @@ std::ostream &operator<<(std::ostream &os, any_expr &n) {
   return os;
 }
 
+namespace {
+
+/// writes json text into a string buffer
+struct json_writer : forwarding_visitor {
+  explicit json_writer(std::string &buffer) : out(buffer) {}
+
+  void visit(expr &) final { unsupported(); }
+
+  void visit(null_value &) final { out.append("null"); }
+  void visit(bool_value &n) final { out.append(n.value() ? "true" : "false"); }
+  void visit(int_value &n) final { number(n.value()); }
+  void visit(unsigned_int_value &n) final { number(n.value()); }
+  void visit(real_value &n) final;
+  void visit(string_value &n) final { string(n.value()); }
+  void visit(array &n) final;
+  void visit(object_value &n) final;
+
+private:
+  std::string &out;
+
+  template <class Num> void number(Num val) {
+    char buf[32];
+    std::to_chars_result res = std::to_chars(buf, buf + sizeof(buf), val);
+
+    assert(res.ec == std::errc{});
+    out.append(buf, res.ptr);
+  }
+
+  void string(json::string_view str);
+};
+
+void json_writer::visit(real_value &n) {
+  const double val = n.value();
+
+  // follow boost::json's representation of non-finite values
+  if (std::isnan(val)) {
+    CXX_UNLIKELY;
+    out.append("null");
+    return;
+  }
+
+  if (std::isinf(val)) {
+    CXX_UNLIKELY;
+    out.append(val < 0 ? "-1e99999" : "1e99999");
+    return;
+  }
+
+  const std::size_t ofs = out.size();
+
+  number(val);
+
+  // keep the value a floating point number when the text is parsed
+  if (out.find_first_of(".eE", ofs) == std::string::npos)
+    out.append(".0");
+}
+
+void json_writer::string(json::string_view str) {
+  static constexpr char hexdigits[] = "0123456789abcdef";
+
+  const char *pos = str.data();
+  const char *lim = pos + str.size();
+  const char *run = pos;
+
+  out.reserve(out.size() + str.size() + 2);
+  out.push_back('"');
+
+  // copies runs of characters that do not need escaping in bulk
+  for (; pos != lim; ++pos) {
+    const unsigned char ch = *pos;
+
+    if ((ch >= 0x20) && (ch != '"') && (ch != '\\'))
+      continue;
+
+    out.append(run, pos);
+    run = pos + 1;
+
+    switch (ch) {
+    case '"':
+      out.append("\\\"");
+      break;
+    case '\\':
+      out.append("\\\\");
+      break;
+    case '\b':
+      out.append("\\b");
+      break;
+    case '\f':
+      out.append("\\f");
+      break;
+    case '\n':
+      out.append("\\n");
+      break;
+    case '\r':
+      out.append("\\r");
+      break;
+    case '\t':
+      out.append("\\t");
+      break;
+    default: {
+      const char esc[] = {'\\', 'u', '0', '0', hexdigits[ch >> 4],
+                          hexdigits[ch & 0xf]};
+
+      out.append(esc, sizeof(esc));
+    }
+    }
+  }
+
+  out.append(run, pos);
+  out.push_back('"');
+}
+
+void json_writer::visit(array &n) {
+  bool first = true;
+
+  out.push_back('[');
+  for (any_expr &el : n) {
+    if (first)
+      first = false;
+    else
+      out.push_back(',');
+
+    deref(el).accept(*this);
+  }
+
+  out.push_back(']');
+}
+
+void json_writer::visit(object_value &n) {
+  bool first = true;
+
+  out.push_back('{');
+  for (object_value::value_type &el : n) {
+    if (first)
+      first = false;
+    else
+      out.push_back(',');
+
+    string(el.first);
+    out.push_back(':');
+    deref(el.second).accept(*this);
+  }
+
+  out.push_back('}');
+}
+
+/// builds a json value using a given storage
+struct json_builder : forwarding_visitor {
+  explicit json_builder(json::storage_ptr storage)
+      : sp(std::move(storage)), res(sp) {}
+
+  void visit(expr &) final { unsupported(); }
+
+  void visit(null_value &) final { res = json::value(nullptr, sp); }
+  void visit(bool_value &n) final { res = json::value(n.value(), sp); }
+  void visit(int_value &n) final { res = json::value(n.value(), sp); }
+  void visit(unsigned_int_value &n) final {
+    res = json::value(n.value(), sp);
+  }
+  void visit(real_value &n) final { res = json::value(n.value(), sp); }
+  void visit(string_value &n) final {
+    res = json::value(json::string_view(n.value()), sp);
+  }
+
+  void visit(array &n) final {
+    json::array arr(sp);
+
+    arr.reserve(n.size());
+    for (any_expr &el : n)
+      arr.push_back(build(el));
+
+    res = json::value(std::move(arr), sp);
+  }
+
+  void visit(object_value &n) final {
+    json::object obj(sp);
+
+    for (object_value::value_type &el : n)
+      obj.emplace(el.first, build(el.second));
+
+    res = json::value(std::move(obj), sp);
+  }
+
+  json::value result() && { return std::move(res); }
+
+private:
+  json::storage_ptr sp;
+  json::value res;
+
+  json::value build(const any_expr &el) const {
+    json_builder sub{sp};
+
+    deref(el.get()).accept(sub);
+    return std::move(sub).result();
+  }
+};
+} // namespace
+
+json::value to_json(const any_expr &e, json::storage_ptr sp) {
+  json_builder builder{std::move(sp)};
+
+  deref(e.get()).accept(builder);
+  return std::move(builder).result();
+}
+
+void serialize(const any_expr &e, std::string &out) {
+  json_writer writer{out};
+
+  deref(e.get()).accept(writer);
+}
+
 expr &oper::operand(int n) const { return deref(this->at(n).get()); }
 } // namespace jsonlogic
 